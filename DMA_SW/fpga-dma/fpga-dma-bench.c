@@ -0,0 +1,399 @@
+/* DMA Engine and Queue Depth Benchmark
+ *
+ * Measures loopback throughput (TX then RX of the same data from one user
+ * buffer into another) for each transfer engine of the driver and several
+ * queue depths, so the engines are compared on identical workloads:
+ *
+ *   bounce  read()/write() copied through the driver's FIFO sized buffer
+ *   sg      read()/write() on pinned user pages
+ *   pool    data copied into mmap()ed pool buffers, FPGA_DMA_XFER_DRVBUF
+ *   cyclic  TX with write(), RX consumed from the cyclic ring
+ *   duplex  sg, TX and RX of a slot in one FPGA_DMA_IOC_TRANSCEIVE call
+ *
+ * Depth 1 is the old behaviour: every transfer blocks until it is done.
+ * Deeper queues open the device with O_NONBLOCK so the driver keeps up to
+ * queue_depth transfers per direction in flight, and fsync() collects the
+ * results at the end. bounce always waits for each transfer.
+ *
+ * Without the board, ../libfpgadma/fpgadma-bench -L sweeps queue depths
+ * against the library's software loopback.
+ *
+ * gcc -O2 -o bench fpga-dma-bench.c
+ * ./bench [-s bytes] [-n transfers] [-d depth,...] [-e engine,...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "fpga-dma.h"
+
+#define DEPTH_PARAM	"/sys/module/fpga_dma/parameters/queue_depth"
+#define MAX_DEPTHS	16
+/* buffer slots, must stay above the deepest queue we ask for */
+#define NUM_SLOTS	64
+
+enum engine { BOUNCE, SG, POOL, CYCLIC, DUPLEX, NUM_ENGINES };
+
+static const char *const engine_names[NUM_ENGINES] = {
+	"bounce", "sg", "pool", "cyclic", "duplex",
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int set_queue_depth(int depth)
+{
+	FILE *f = fopen(DEPTH_PARAM, "w");
+
+	if (!f) {
+		perror(DEPTH_PARAM);
+		return -1;
+	}
+	fprintf(f, "%d\n", depth);
+	fclose(f);
+	return 0;
+}
+
+/* the bounce engine moves at most one FIFO worth per call */
+static int bounce_rw(int dma_fd, char *write_buf, char *read_buf,
+		     size_t size)
+{
+	size_t done;
+	ssize_t n;
+
+	for (done = 0; done < size; done += n) {
+		n = write(dma_fd, write_buf + done, size - done);
+		if (n <= 0)
+			return -1;
+		if (read(dma_fd, read_buf + done, n) != n)
+			return -1;
+	}
+	return 0;
+}
+
+/* read()/write() through the bounce or the sg engine */
+static int rw_run(int dma_fd, enum engine e, size_t size, int count,
+		  char *write_buf, char *read_buf)
+{
+	__u32 engine = e == BOUNCE ? FPGA_DMA_ENGINE_BOUNCE : FPGA_DMA_ENGINE_SG;
+	int i, slot;
+
+	if (ioctl(dma_fd, FPGA_DMA_IOC_SET_ENGINE, &engine) < 0) {
+		perror("FPGA_DMA_IOC_SET_ENGINE");
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		slot = i % NUM_SLOTS;
+		if (e == BOUNCE ? bounce_rw(dma_fd, write_buf + slot * size,
+					    read_buf + slot * size, size) :
+		    write(dma_fd, write_buf + slot * size, size) < 0 ||
+		    read(dma_fd, read_buf + slot * size, size) < 0) {
+			perror("dma transfer");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* TX and RX of each slot overlapped in one call */
+static int duplex_run(int dma_fd, size_t size, int count, char *write_buf,
+		      char *read_buf)
+{
+	struct fpga_dma_transceive xc;
+	int i, slot;
+
+	memset(&xc, 0, sizeof(xc));
+	xc.tx.len = xc.rx.len = size;
+	for (i = 0; i < count; i++) {
+		slot = i % NUM_SLOTS;
+		xc.tx.addr = (unsigned long)(write_buf + slot * size);
+		xc.rx.addr = (unsigned long)(read_buf + slot * size);
+		if (ioctl(dma_fd, FPGA_DMA_IOC_TRANSCEIVE, &xc) < 0) {
+			perror("FPGA_DMA_IOC_TRANSCEIVE");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* copy transfers [first, first + n) out of the RX pool buffer */
+static void pool_copy_out(char *read_buf, const char *rxpool, size_t size,
+			  size_t slots, int first, int n)
+{
+	int i;
+
+	for (i = first; i < first + n; i++)
+		memcpy(read_buf + (i % NUM_SLOTS) * size,
+		       rxpool + (i % slots) * size, size);
+}
+
+/* TX from pool buffer 0, RX into pool buffer 1, copying in and out */
+static int pool_run(int dma_fd, size_t size, int count, char *write_buf,
+		    char *read_buf)
+{
+	struct fpga_dma_status st;
+	struct fpga_dma_xfer tx, rx;
+	struct fpga_dma_wait wait;
+	char *txpool, *rxpool;
+	size_t slots;
+	int i, j, slot, ret = -1;
+
+	if (ioctl(dma_fd, FPGA_DMA_IOC_STATUS, &st) < 0 || st.pool_bufs < 2 ||
+	    st.buf_size < size) {
+		fprintf(stderr, "pool: need two pool buffers of %zu bytes\n",
+			size);
+		return -1;
+	}
+	txpool = mmap(NULL, st.buf_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		      dma_fd, 0);
+	rxpool = mmap(NULL, st.buf_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		      dma_fd, st.buf_size);
+	if (txpool == MAP_FAILED || rxpool == MAP_FAILED) {
+		perror("mmap");
+		goto out;
+	}
+	slots = st.buf_size / size;
+	if (slots > NUM_SLOTS)
+		slots = NUM_SLOTS;
+
+	memset(&tx, 0, sizeof(tx));
+	tx.len = size;
+	tx.dir = FPGA_DMA_TX;
+	tx.flags = FPGA_DMA_XFER_DRVBUF;
+	rx = tx;
+	rx.dir = FPGA_DMA_RX;
+	rx.handle = 1;
+	wait.dir = FPGA_DMA_RX;
+	for (i = 0; i < count; i++) {
+		/* a slot may only be reused once its last RX is back */
+		if (i >= slots && i % slots == 0) {
+			wait.cookie = 0;
+			if (ioctl(dma_fd, FPGA_DMA_IOC_WAIT, &wait) < 0)
+				break;
+			pool_copy_out(read_buf, rxpool, size, slots,
+				      i - slots, slots);
+		}
+		slot = i % NUM_SLOTS;
+		tx.addr = rx.addr = (i % slots) * size;
+		memcpy(txpool + tx.addr, write_buf + slot * size, size);
+		if (ioctl(dma_fd, FPGA_DMA_IOC_SUBMIT, &tx) < 0 ||
+		    ioctl(dma_fd, FPGA_DMA_IOC_SUBMIT, &rx) < 0) {
+			perror("FPGA_DMA_IOC_SUBMIT");
+			break;
+		}
+	}
+	wait.cookie = 0;
+	if (i == count && !ioctl(dma_fd, FPGA_DMA_IOC_WAIT, &wait)) {
+		j = (count - 1) / slots * slots;
+		pool_copy_out(read_buf, rxpool, size, slots, j, count - j);
+		ret = 0;
+	}
+out:
+	if (txpool != MAP_FAILED)
+		munmap(txpool, st.buf_size);
+	if (rxpool != MAP_FAILED)
+		munmap(rxpool, st.buf_size);
+	return ret;
+}
+
+/* TX with write(), RX consumed period by period from the cyclic ring */
+static int cyclic_run(int dma_fd, size_t size, int count, char *write_buf,
+		      char *read_buf)
+{
+	struct fpga_dma_ring_setup setup;
+	volatile struct fpga_dma_ring_ctrl *ctrl;
+	unsigned int seen, consumed = 0;
+	char *map;
+	int i = 0, ret = -1;
+
+	memset(&setup, 0, sizeof(setup));
+	setup.period_len = size;
+	setup.periods = NUM_SLOTS;
+	if (ioctl(dma_fd, FPGA_DMA_IOC_RING_START, &setup) < 0) {
+		perror("FPGA_DMA_IOC_RING_START");
+		return -1;
+	}
+	map = mmap(NULL, setup.mmap_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   dma_fd, setup.mmap_offset);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		goto out;
+	}
+	ctrl = (struct fpga_dma_ring_ctrl *)map;
+
+	while (consumed < count) {
+		if (i < count && i - consumed < NUM_SLOTS) {
+			if (write(dma_fd, write_buf + (i % NUM_SLOTS) * size,
+				  size) < 0) {
+				perror("dma transfer");
+				goto out;
+			}
+			i++;
+		} else if (ctrl->produced == consumed) {
+			seen = consumed;
+			if (ioctl(dma_fd, FPGA_DMA_IOC_RING_WAIT, &seen) < 0) {
+				perror("FPGA_DMA_IOC_RING_WAIT");
+				goto out;
+			}
+		}
+		while (ctrl->produced != consumed) {
+			memcpy(read_buf + (consumed % NUM_SLOTS) * size,
+			       map + ctrl->data_offset +
+			       (consumed % NUM_SLOTS) * size, size);
+			ctrl->consumed = ++consumed;
+		}
+	}
+	if (ctrl->overruns)
+		printf("cyclic: %u ring overruns\n", ctrl->overruns);
+	ret = 0;
+out:
+	ioctl(dma_fd, FPGA_DMA_IOC_RING_STOP);
+	if (map != MAP_FAILED)
+		munmap(map, setup.mmap_len);
+	return ret;
+}
+
+static double device_run(enum engine e, int depth, size_t size, int count,
+			 char *write_buf, char *read_buf)
+{
+	double t1, t2;
+	int dma_fd, ret;
+
+	if (set_queue_depth(depth))
+		return 0;
+	dma_fd = open(FPGA_DMA_DEV, depth > 1 ? O_RDWR | O_NONBLOCK : O_RDWR);
+	if (dma_fd < 0) {
+		perror(FPGA_DMA_DEV);
+		return 0;
+	}
+	memset(read_buf, 0, size * NUM_SLOTS);
+
+	t1 = now_us();
+	switch (e) {
+	case POOL:
+		ret = pool_run(dma_fd, size, count, write_buf, read_buf);
+		break;
+	case CYCLIC:
+		ret = cyclic_run(dma_fd, size, count, write_buf, read_buf);
+		break;
+	case DUPLEX:
+		ret = duplex_run(dma_fd, size, count, write_buf, read_buf);
+		break;
+	default:
+		ret = rw_run(dma_fd, e, size, count, write_buf, read_buf);
+		break;
+	}
+	if (fsync(dma_fd))
+		perror("fsync");
+	t2 = now_us();
+
+	close(dma_fd);
+	if (ret)
+		return 0;
+	if (memcmp(write_buf, read_buf,
+		   size * (count < NUM_SLOTS ? count : NUM_SLOTS)))
+		printf("%s depth %d: loopback data mismatch\n",
+		       engine_names[e], depth);
+	return t2 - t1;
+}
+
+static int parse_engines(char *list, int *engines)
+{
+	char *tok;
+	int n = 0, e;
+
+	for (tok = strtok(list, ","); tok && n < NUM_ENGINES;
+	     tok = strtok(NULL, ",")) {
+		for (e = 0; e < NUM_ENGINES; e++)
+			if (!strcmp(tok, engine_names[e]))
+				break;
+		if (e == NUM_ENGINES) {
+			fprintf(stderr, "unknown engine %s\n", tok);
+			return -1;
+		}
+		engines[n++] = e;
+	}
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	int depths[MAX_DEPTHS] = { 1, 8, 32 };
+	int num_depths = 3;
+	int engines[NUM_ENGINES] = { SG };
+	int num_engines = 1;
+	size_t size = 8192;
+	int count = 50000;
+	char *write_buf = NULL, *read_buf = NULL;
+	char *tok;
+	double t, base;
+	int opt, i, j;
+
+	while ((opt = getopt(argc, argv, "s:n:d:e:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'd':
+			num_depths = 0;
+			for (tok = strtok(optarg, ","); tok && num_depths < MAX_DEPTHS;
+			     tok = strtok(NULL, ","))
+				depths[num_depths++] = atoi(tok);
+			break;
+		case 'e':
+			num_engines = parse_engines(optarg, engines);
+			if (num_engines <= 0)
+				return 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s bytes] [-n transfers] "
+				"[-d depth,...] [-e bounce,sg,pool,cyclic,duplex]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!size || count <= 0)
+		return 1;
+	write_buf = malloc(size * NUM_SLOTS);
+	read_buf = calloc(NUM_SLOTS, size);
+	if (!write_buf || !read_buf)
+		return 1;
+	for (i = 0; i < size * NUM_SLOTS; i++)
+		write_buf[i] = i * 7;
+
+	printf("%s, %zu bytes x %d transfers\n", FPGA_DMA_DEV, size, count);
+	printf("engine depth      time(us)       MB/s   speedup\n");
+	for (j = 0; j < num_engines; j++) {
+		base = 0;
+		for (i = 0; i < num_depths; i++) {
+			if (depths[i] < 1 || depths[i] >= NUM_SLOTS)
+				continue;
+			t = device_run(engines[j], depths[i], size, count,
+				       write_buf, read_buf);
+			if (t <= 0)
+				continue;
+			if (!base)
+				base = t;
+			printf("%-6s %5d  %12.0f  %9.2f  %7.2fx\n",
+			       engine_names[engines[j]], depths[i], t,
+			       (double)size * count / t, base / t);
+		}
+	}
+
+	free(write_buf);
+	free(read_buf);
+	return 0;
+}
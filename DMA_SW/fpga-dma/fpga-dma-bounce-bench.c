@@ -0,0 +1,126 @@
+/* DMA Bounce Crossover Benchmark
+ *
+ * Loops back transfers from 64 bytes to 64 KB through write()/read() on
+ * the sg engine twice: with bounce_max=0, so every transfer pins the user
+ * pages, and with bounce_max at its largest, so everything that fits is
+ * copied through the driver's per-CPU buffers. The output is one line per
+ * size with the microseconds per loopback in both modes, in a format
+ * gnuplot reads directly:
+ *
+ * gcc -O2 -o bounce-bench fpga-dma-bounce-bench.c
+ * ./bounce-bench > crossover.dat && gnuplot fpga-dma-crossover.gp
+ *
+ * The driver's own threshold, measured at probe, is printed in the header
+ * and restored at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include "fpga-dma.h"
+
+#define BOUNCE_PARAM	"/sys/module/fpga_dma/parameters/bounce_max"
+#define MAX_SIZE	(64 * 1024)
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int param(const char *mode, char *val, size_t len)
+{
+	FILE *f = fopen(BOUNCE_PARAM, mode);
+	int ret = 0;
+
+	if (!f) {
+		perror(BOUNCE_PARAM);
+		return -1;
+	}
+	if (*mode == 'r')
+		ret = fgets(val, len, f) ? 0 : -1;
+	else
+		fputs(val, f);
+	fclose(f);
+	return ret;
+}
+
+/* microseconds per loopback of @size bytes */
+static double run(int tx_fd, int rx_fd, char *write_buf, char *read_buf,
+		  size_t size, int count)
+{
+	double t1;
+	int i;
+
+	t1 = now_us();
+	for (i = 0; i < count; i++)
+		if (write(tx_fd, write_buf, size) < 0 ||
+		    read(rx_fd, read_buf, size) < 0) {
+			perror("dma transfer");
+			return -1;
+		}
+	if (fsync(tx_fd)) {
+		perror("fsync");
+		return -1;
+	}
+	return (now_us() - t1) / count;
+}
+
+int main(int argc, char *argv[])
+{
+	char saved[32], *write_buf, *read_buf;
+	double pin_us, copy_us;
+	int count = 2000, tx_fd, rx_fd, opt;
+	size_t size;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n transfers]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (count <= 0 || param("r", saved, sizeof(saved)))
+		return 1;
+
+	/* TX is queued without waiting, the blocking read waits for both */
+	tx_fd = open(FPGA_DMA_DEV, O_RDWR | O_NONBLOCK);
+	rx_fd = open(FPGA_DMA_DEV, O_RDWR);
+	write_buf = malloc(MAX_SIZE);
+	read_buf = malloc(MAX_SIZE);
+	if (tx_fd < 0 || rx_fd < 0 || !write_buf || !read_buf) {
+		perror(FPGA_DMA_DEV);
+		return 1;
+	}
+	memset(write_buf, 0xa5, MAX_SIZE);
+
+	printf("# %d loopbacks per size, driver bounce_max %s", count, saved);
+	printf("# bytes   pin_us  copy_us\n");
+	for (size = 64; size <= MAX_SIZE; size *= 2) {
+		if (param("w", "0\n", 0))
+			break;
+		pin_us = run(tx_fd, rx_fd, write_buf, read_buf, size, count);
+		if (param("w", "65536\n", 0))
+			break;
+		copy_us = run(tx_fd, rx_fd, write_buf, read_buf, size, count);
+		if (pin_us < 0 || copy_us < 0)
+			break;
+		printf("%7zu %8.2f %8.2f\n", size, pin_us, copy_us);
+		fflush(stdout);
+	}
+
+	param("w", saved, 0);
+	free(write_buf);
+	free(read_buf);
+	close(tx_fd);
+	close(rx_fd);
+	return 0;
+}
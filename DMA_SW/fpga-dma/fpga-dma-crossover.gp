@@ -0,0 +1,15 @@
+# Plots the output of fpga-dma-bounce-bench:
+#   ./bounce-bench > crossover.dat && gnuplot fpga-dma-crossover.gp
+# The size where the two curves cross is the best bounce_max.
+
+set terminal png size 800,500
+set output "crossover.png"
+set title "fpga-dma: pinning vs copying through the per-CPU buffers"
+set xlabel "transfer size (bytes)"
+set ylabel "us per loopback"
+set logscale xy 2
+set key top left
+set grid
+
+plot "crossover.dat" using 1:2 with linespoints title "pin user pages", \
+     "crossover.dat" using 1:3 with linespoints title "copy (bounce)"
@@ -0,0 +1,134 @@
+/* DMA Completion Latency Benchmark
+ *
+ * Times single full duplex loopbacks (FPGA_DMA_IOC_TRANSCEIVE between two
+ * pool buffers, so no pages are pinned) from 8 bytes up to 64 KB, once
+ * with the waiter sleeping on the completion interrupt and once with
+ * FPGA_DMA_XFER_POLL, where the waiter spins on the channel status for up
+ * to the poll_us module parameter first. Each line shows the median, the
+ * 99th percentile and the minimum round trip in microseconds.
+ *
+ * gcc -O2 -o lat-bench fpga-dma-lat-bench.c
+ * ./lat-bench [-n transfers] [-s max bytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "fpga-dma.h"
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* round trip times of @count loopbacks of @size bytes, sorted */
+static int run(int dma_fd, size_t size, unsigned int flags, int count,
+	       double *lat)
+{
+	struct fpga_dma_transceive xc;
+	double t1;
+	int i;
+
+	memset(&xc, 0, sizeof(xc));
+	xc.tx.len = size;
+	xc.tx.flags = FPGA_DMA_XFER_DRVBUF | flags;
+	xc.rx = xc.tx;
+	xc.rx.handle = 1;
+
+	for (i = 0; i < count; i++) {
+		xc.tx.len = xc.rx.len = size;
+		t1 = now_us();
+		if (ioctl(dma_fd, FPGA_DMA_IOC_TRANSCEIVE, &xc) < 0) {
+			perror("transceive");
+			return -1;
+		}
+		lat[i] = now_us() - t1;
+	}
+	qsort(lat, count, sizeof(*lat), cmp_double);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct fpga_dma_status st;
+	size_t size, max_size = 64 * 1024;
+	int count = 1000, mode, dma_fd, opt;
+	char *txpool, *rxpool;
+	double *lat;
+
+	while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 's':
+			max_size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n transfers] [-s max bytes]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (count <= 0)
+		return 1;
+
+	dma_fd = open(FPGA_DMA_DEV, O_RDWR);
+	if (dma_fd < 0) {
+		perror(FPGA_DMA_DEV);
+		return 1;
+	}
+	if (ioctl(dma_fd, FPGA_DMA_IOC_STATUS, &st) < 0 || st.pool_bufs < 2 ||
+	    st.buf_size < max_size) {
+		fprintf(stderr, "need two pool buffers of %zu bytes\n",
+			max_size);
+		return 1;
+	}
+	txpool = mmap(NULL, st.buf_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		      dma_fd, 0);
+	rxpool = mmap(NULL, st.buf_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		      dma_fd, st.buf_size);
+	lat = calloc(count, sizeof(*lat));
+	if (txpool == MAP_FAILED || rxpool == MAP_FAILED || !lat) {
+		perror("setup");
+		return 1;
+	}
+	memset(txpool, 0x5a, max_size);
+
+	printf("%d loopbacks per size, round trip in us\n", count);
+	printf("    bytes  mode       p50       p99       min\n");
+	for (size = 8; size <= max_size; size *= 2) {
+		for (mode = 0; mode <= 1; mode++) {
+			memset(rxpool, 0, size);
+			if (run(dma_fd, size, mode ? FPGA_DMA_XFER_POLL : 0,
+				count, lat))
+				return 1;
+			printf("%9zu  %-5s %9.1f %9.1f %9.1f%s\n", size,
+			       mode ? "poll" : "irq", lat[count / 2],
+			       lat[count - 1 - count / 100], lat[0],
+			       memcmp(txpool, rxpool, size) ?
+			       "  mismatch" : "");
+		}
+	}
+
+	free(lat);
+	munmap(txpool, st.buf_size);
+	munmap(rxpool, st.buf_size);
+	close(dma_fd);
+	return 0;
+}
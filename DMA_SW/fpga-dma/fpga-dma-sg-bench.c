@@ -0,0 +1,221 @@
+/* DMA Scatterlist Coalescing Benchmark
+ *
+ * Runs the same loopback workload with the driver's coalesce_sg parameter
+ * off (one descriptor per page) and on (physically contiguous pages merged
+ * into one segment), once on a deliberately fragmented buffer and once on
+ * a huge page backed buffer, and reports descriptors per transfer from the
+ * driver's "segs" debugfs file together with the achieved throughput.
+ *
+ * The fragmented buffer is faulted in page by page, interleaved with a
+ * second buffer, so neighbouring virtual pages rarely end up physically
+ * adjacent. The huge page buffer uses MAP_HUGETLB (needs reserved pages,
+ * echo N > /proc/sys/vm/nr_hugepages) and falls back to a transparent huge
+ * page hint; if neither is available the run is reported as such.
+ *
+ * gcc -O2 -o sg-bench fpga-dma-sg-bench.c
+ * ./sg-bench [-s bytes] [-n transfers]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "fpga-dma.h"
+
+#define COALESCE_PARAM	"/sys/module/fpga_dma/parameters/coalesce_sg"
+#define DEPTH_PARAM	"/sys/module/fpga_dma/parameters/queue_depth"
+#define SEGS_FILE	FPGA_DMA_DBGFS "/segs"
+#define HUGE_SIZE	(2UL << 20)
+
+struct segs {
+	unsigned long long transfers;
+	unsigned long long segments;
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int write_param(const char *path, const char *val)
+{
+	FILE *f = fopen(path, "w");
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	fputs(val, f);
+	fclose(f);
+	return 0;
+}
+
+/* sum of both directions, as accounted by the driver */
+static int read_segs(struct segs *sum)
+{
+	unsigned long long transfers, segments;
+	char line[128], dir[8];
+	FILE *f = fopen(SEGS_FILE, "r");
+
+	if (!f) {
+		perror(SEGS_FILE);
+		return -1;
+	}
+	sum->transfers = sum->segments = 0;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "%7s %llu %llu", dir, &transfers,
+			   &segments) == 3) {
+			sum->transfers += transfers;
+			sum->segments += segments;
+		}
+	fclose(f);
+	return 0;
+}
+
+static char *alloc_fragmented(size_t size, char **other)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	char *buf = malloc(size);
+	size_t i;
+
+	*other = malloc(size);
+	if (!buf || !*other) {
+		free(buf);
+		free(*other);
+		return NULL;
+	}
+	for (i = 0; i < size; i += page) {
+		buf[i] = 1;
+		(*other)[i] = 1;
+	}
+	return buf;
+}
+
+static char *alloc_huge(size_t size, size_t *maplen, const char **how)
+{
+	char *buf;
+
+	*maplen = (size + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+	buf = mmap(NULL, *maplen, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (buf != MAP_FAILED) {
+		*how = "hugetlb";
+		return buf;
+	}
+#endif
+#ifdef MADV_HUGEPAGE
+	if (posix_memalign((void **)&buf, HUGE_SIZE, *maplen))
+		return NULL;
+	if (!madvise(buf, *maplen, MADV_HUGEPAGE)) {
+		*how = "thp";
+		*maplen = 0;		/* free() rather than munmap() */
+		return buf;
+	}
+	free(buf);
+#endif
+	return NULL;
+}
+
+static void run(const char *name, char *write_buf, size_t size, int count)
+{
+	char *read_buf = calloc(1, size);
+	struct segs s;
+	double t1, t2;
+	int coalesce, dma_fd, i;
+
+	if (!read_buf)
+		return;
+	for (i = 0; i < size; i++)
+		write_buf[i] = i * 7;
+
+	for (coalesce = 0; coalesce <= 1; coalesce++) {
+		if (write_param(COALESCE_PARAM, coalesce ? "1\n" : "0\n") ||
+		    write_param(SEGS_FILE, "0\n"))
+			break;
+		dma_fd = open(FPGA_DMA_DEV, O_RDWR | O_NONBLOCK);
+		if (dma_fd < 0) {
+			perror(FPGA_DMA_DEV);
+			break;
+		}
+
+		t1 = now_us();
+		for (i = 0; i < count; i++)
+			if (write(dma_fd, write_buf, size) < 0 ||
+			    read(dma_fd, read_buf, size) < 0) {
+				perror("dma transfer");
+				break;
+			}
+		if (fsync(dma_fd))
+			perror("fsync");
+		t2 = now_us();
+		close(dma_fd);
+
+		if (i != count || read_segs(&s) || !s.transfers)
+			break;
+		printf("%-12s %-9s %10.1f %9.2f%s\n", name,
+		       coalesce ? "coalesced" : "per-page",
+		       (double)s.segments / s.transfers,
+		       2.0 * size * count / (t2 - t1),
+		       memcmp(write_buf, read_buf, size) ? "  mismatch" : "");
+	}
+	free(read_buf);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t size = 1 << 20, maplen;
+	int count = 200;
+	char *buf, *other;
+	const char *how;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s bytes] [-n transfers]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!size || count <= 0)
+		return 1;
+	if (write_param(DEPTH_PARAM, "8\n"))
+		return 1;
+
+	printf("%zu bytes x %d loopback transfers\n", size, count);
+	printf("buffer       mapping   descs/xfer      MB/s\n");
+
+	buf = alloc_fragmented(size, &other);
+	if (buf) {
+		run("fragmented", buf, size, count);
+		free(buf);
+		free(other);
+	}
+
+	buf = alloc_huge(size, &maplen, &how);
+	if (buf) {
+		run(how, buf, size, count);
+		if (maplen)
+			munmap(buf, maplen);
+		else
+			free(buf);
+	} else {
+		printf("%-12s unavailable\n", "hugepage");
+	}
+
+	write_param(COALESCE_PARAM, "1\n");
+	return 0;
+}
@@ -0,0 +1,163 @@
+/* DMA Striping Benchmark
+ *
+ * Loops one logical stream back through several FIFO instances at once.
+ * The stream is cut into stripes of -s bytes and stripe i goes through
+ * /dev/fpga_dma(i % N), one thread per device, each stripe as one
+ * FPGA_DMA_IOC_TRANSCEIVE. Every run is repeated with 1 .. N devices, so
+ * the aggregate throughput can be read against the single FIFO number.
+ *
+ * gcc -O2 -pthread -o stripe-bench fpga-dma-stripe-bench.c
+ * ./stripe-bench [-d devices] [-s stripe bytes] [-t total bytes]
+ *
+ * Without -d every /dev/fpga_dmaN that opens is used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "fpga-dma.h"
+
+#define MAX_DEVS	8
+
+struct lane {
+	pthread_t thread;
+	int fd;
+	int index;		/* takes stripes index, index + ndevs, ... */
+	int ndevs;
+	char *src;
+	char *dst;
+	size_t stripe;
+	size_t total;
+	int ret;
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void *lane_run(void *arg)
+{
+	struct lane *l = arg;
+	struct fpga_dma_transceive xc;
+	size_t off, len;
+
+	for (off = l->index * l->stripe; off < l->total;
+	     off += l->ndevs * l->stripe) {
+		len = l->total - off < l->stripe ? l->total - off : l->stripe;
+		memset(&xc, 0, sizeof(xc));
+		xc.tx.addr = (unsigned long)(l->src + off);
+		xc.tx.len = len;
+		xc.rx.addr = (unsigned long)(l->dst + off);
+		xc.rx.len = len;
+		if (ioctl(l->fd, FPGA_DMA_IOC_TRANSCEIVE, &xc) < 0) {
+			perror("transceive");
+			l->ret = -1;
+			break;
+		}
+	}
+	return NULL;
+}
+
+/* microseconds for the whole stream over the first @ndevs devices */
+static double run(struct lane *lanes, int ndevs)
+{
+	double t1;
+	int i, ret = 0;
+
+	t1 = now_us();
+	for (i = 0; i < ndevs; i++) {
+		lanes[i].index = i;
+		lanes[i].ndevs = ndevs;
+		lanes[i].ret = 0;
+		if (pthread_create(&lanes[i].thread, NULL, lane_run,
+				   &lanes[i]))
+			return -1;
+	}
+	for (i = 0; i < ndevs; i++) {
+		pthread_join(lanes[i].thread, NULL);
+		ret |= lanes[i].ret;
+	}
+	return ret ? -1 : now_us() - t1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct lane lanes[MAX_DEVS];
+	size_t stripe = 256 * 1024, total = 64 * 1024 * 1024;
+	int ndevs = 0, want = MAX_DEVS, i, n, opt;
+	char name[32], *src, *dst;
+	double us, single_us = 0;
+
+	while ((opt = getopt(argc, argv, "d:s:t:")) != -1) {
+		switch (opt) {
+		case 'd':
+			want = atoi(optarg);
+			break;
+		case 's':
+			stripe = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			total = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d devices] [-s stripe bytes]"
+				" [-t total bytes]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (want < 1 || want > MAX_DEVS || !stripe || !total)
+		return 1;
+
+	src = malloc(total);
+	dst = malloc(total);
+	if (!src || !dst) {
+		perror("malloc");
+		return 1;
+	}
+	for (i = 0; i < (int)(total / sizeof(int)); i++)
+		((int *)src)[i] = i * 2654435761u;
+
+	for (ndevs = 0; ndevs < want; ndevs++) {
+		snprintf(name, sizeof(name), FPGA_DMA_DEV_FMT, ndevs);
+		lanes[ndevs].fd = open(name, O_RDWR);
+		if (lanes[ndevs].fd < 0)
+			break;
+		lanes[ndevs].src = src;
+		lanes[ndevs].dst = dst;
+		lanes[ndevs].stripe = stripe;
+		lanes[ndevs].total = total;
+	}
+	if (!ndevs) {
+		perror(FPGA_DMA_DEV);
+		return 1;
+	}
+
+	printf("%zu bytes in %zu byte stripes\n", total, stripe);
+	printf("devices   time(us)       MB/s   speedup\n");
+	for (n = 1; n <= ndevs; n++) {
+		memset(dst, 0, total);
+		us = run(lanes, n);
+		if (us < 0)
+			break;
+		if (n == 1)
+			single_us = us;
+		printf("%7d %10.0f %10.1f %8.2fx%s\n", n, us, total / us,
+		       single_us / us, memcmp(src, dst, total) ?
+		       "  mismatch" : "");
+	}
+
+	for (i = 0; i < ndevs; i++)
+		close(lanes[i].fd);
+	free(src);
+	free(dst);
+	return 0;
+}
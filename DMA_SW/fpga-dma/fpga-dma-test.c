@@ -0,0 +1,584 @@
+/* DMA Proxy Test Application
+ *
+ * This application is intended to be used with the DMA Proxy device driver. It provides
+ * an example application showing how to use the device driver to do user space DMA
+ * operations.
+ *
+ * It has been tested with an AXI DMA system with transmit looped back to receive.
+ * The device driver implements a blocking ioctl() function such that a thread is
+ * needed for the 2nd channel. Since the AXI DMA transmit is a stream without any
+ * buffering it is throttled until the receive channel is running.
+ *
+ * Data is generated and checked with the pattern and compare kernels of
+ * libfpgadma/fpgadma-verify.c, mismatches are printed as ranges:
+ * gcc -O2 -I../libfpgadma -o fpga-dma-test fpga-dma-test.c \
+ *     ../libfpgadma/fpgadma-verify.c -pthread
+ */
+
+#include <stdio.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#include <sys/types.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include "fpga-dma.h"
+#include "fpgadma-verify.h"
+
+#define MAX_RANGES	8
+
+/* print the ranges where @got differs from @expect */
+static int check_buf(const char *what, const void *expect, const void *got,
+		     size_t len){
+	struct fpgadma_range r[MAX_RANGES];
+	size_t n = fpgadma_compare(expect, got, len, r, MAX_RANGES);
+
+	if(n)
+		fpgadma_print_ranges(stdout, what, r, n, MAX_RANGES);
+	return n ? -1 : 0;
+}
+
+/* the same against the words of pattern @type from @seed */
+static int check_pattern(const char *what, int type, uint32_t seed,
+			 const void *got, size_t len){
+	struct fpgadma_range r[MAX_RANGES];
+	struct fpgadma_pattern pat;
+	size_t n;
+
+	fpgadma_pattern_init(&pat, type, seed);
+	n = fpgadma_pattern_check(&pat, got, len, r, MAX_RANGES);
+	if(n)
+		fpgadma_print_ranges(stdout, what, r, n, MAX_RANGES);
+	return n ? -1 : 0;
+}
+
+static void fill_pattern(int type, uint32_t seed, void *buf, size_t len){
+	struct fpgadma_pattern pat;
+
+	fpgadma_pattern_init(&pat, type, seed);
+	fpgadma_pattern_fill(&pat, buf, len);
+}
+
+/* loopback through the mmap()ed driver pool: TX from the first buffer,
+   RX into the last one */
+static int test_drvbuf(int dma_fd, int numofwords){
+	struct fpga_dma_status st;
+	struct fpga_dma_xfer tx, rx;
+	struct fpga_dma_wait wait;
+	size_t count = numofwords * 4;
+	int *txbuf, *rxbuf, last;
+	int ret = -1;
+
+	if(ioctl(dma_fd, FPGA_DMA_IOC_STATUS, &st) < 0 || st.pool_bufs < 2 ||
+	   st.buf_size < count){
+		printf("driver buffer pool too small\n");
+		return -1;
+	}
+	last = st.pool_bufs - 1;
+	txbuf = mmap(NULL, st.buf_size, PROT_READ | PROT_WRITE, MAP_SHARED, dma_fd, 0);
+	rxbuf = mmap(NULL, st.buf_size, PROT_READ | PROT_WRITE, MAP_SHARED, dma_fd,
+		     (off_t)last * st.buf_size);
+	if(txbuf == MAP_FAILED || rxbuf == MAP_FAILED){
+		printf("Unable to mmap driver buffers\n");
+		goto out;
+	}
+	fill_pattern(FPGADMA_PAT_COUNTER, 0, txbuf, count);
+	memset(rxbuf, 0, count);
+	memset(&tx, 0, sizeof(tx));
+	tx.addr = 0;
+	tx.len = count;
+	tx.dir = FPGA_DMA_TX;
+	tx.flags = FPGA_DMA_XFER_DRVBUF;
+	tx.handle = 0;
+	rx = tx;
+	rx.dir = FPGA_DMA_RX;
+	rx.handle = last;
+	if(ioctl(dma_fd, FPGA_DMA_IOC_SUBMIT, &tx) < 0 ||
+	   ioctl(dma_fd, FPGA_DMA_IOC_SUBMIT, &rx) < 0){
+		printf("submit failed\n");
+		goto out;
+	}
+	wait.dir = FPGA_DMA_TX;
+	wait.cookie = tx.cookie;
+	if(ioctl(dma_fd, FPGA_DMA_IOC_WAIT, &wait) < 0){
+		printf("TX wait failed\n");
+		goto out;
+	}
+	wait.dir = FPGA_DMA_RX;
+	wait.cookie = rx.cookie;
+	if(ioctl(dma_fd, FPGA_DMA_IOC_WAIT, &wait) < 0){
+		printf("RX wait failed\n");
+		goto out;
+	}
+	ret = check_pattern("mmap", FPGADMA_PAT_COUNTER, 0, rxbuf, count);
+out:
+	if(txbuf != MAP_FAILED)
+		munmap(txbuf, st.buf_size);
+	if(rxbuf != MAP_FAILED)
+		munmap(rxbuf, st.buf_size);
+	return ret;
+}
+
+/* loopback between two halves of a buffer registered once */
+static int test_regbuf(int dma_fd, int numofwords){
+	struct fpga_dma_buf reg;
+	struct fpga_dma_xfer tx, rx;
+	struct fpga_dma_wait wait;
+	size_t count = numofwords * 4;
+	char what[32];
+	int *buf, iter;
+	int ret = 0;
+
+	buf = malloc(2 * count);
+	if(!buf)
+		return -1;
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (unsigned long)buf;
+	reg.len = 2 * count;
+	reg.dir = FPGA_DMA_TXRX;
+	if(ioctl(dma_fd, FPGA_DMA_IOC_REG_BUF, &reg) < 0){
+		printf("Unable to register buffer\n");
+		free(buf);
+		return -1;
+	}
+	for(iter = 0; iter < 16; iter++){
+		fill_pattern(FPGADMA_PAT_COUNTER, iter * numofwords, buf, count);
+		memset(buf + numofwords, 0, count);
+		memset(&tx, 0, sizeof(tx));
+		tx.len = count;
+		tx.dir = FPGA_DMA_TX;
+		tx.flags = FPGA_DMA_XFER_REGBUF;
+		tx.handle = reg.handle;
+		rx = tx;
+		rx.addr = count;
+		rx.dir = FPGA_DMA_RX;
+		if(ioctl(dma_fd, FPGA_DMA_IOC_SUBMIT, &tx) < 0 ||
+		   ioctl(dma_fd, FPGA_DMA_IOC_SUBMIT, &rx) < 0){
+			printf("regbuf submit failed\n");
+			ret = -1;
+			break;
+		}
+		wait.dir = FPGA_DMA_RX;
+		wait.cookie = 0;
+		if(ioctl(dma_fd, FPGA_DMA_IOC_WAIT, &wait) < 0){
+			printf("RX wait failed\n");
+			ret = -1;
+			break;
+		}
+		snprintf(what, sizeof(what), "regbuf iter %d", iter);
+		if(check_buf(what, buf, buf + numofwords, count))
+			ret = -1;
+	}
+	if(ioctl(dma_fd, FPGA_DMA_IOC_UNREG_BUF, &reg.handle) < 0){
+		printf("Unable to unregister buffer\n");
+		ret = -1;
+	}
+	free(buf);
+	return ret;
+}
+
+/*
+ * A buffer registered for TX takes no RX, and one whose range was
+ * unmapped and mapped again takes nothing: its pinned pages are gone.
+ */
+static int test_regbuf_unmap(int dma_fd){
+	size_t len = 4096;
+	struct fpga_dma_buf reg;
+	struct fpga_dma_xfer xfer;
+	void *buf;
+	int ret = 0;
+
+	buf = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(buf == MAP_FAILED)
+		return -1;
+	memset(buf, 0, len);
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (unsigned long)buf;
+	reg.len = len;
+	reg.dir = FPGA_DMA_TX;
+	if(ioctl(dma_fd, FPGA_DMA_IOC_REG_BUF, &reg) < 0){
+		printf("regbuf unmap: unable to register buffer\n");
+		munmap(buf, len);
+		return -1;
+	}
+
+	memset(&xfer, 0, sizeof(xfer));
+	xfer.len = len;
+	xfer.dir = FPGA_DMA_RX;
+	xfer.flags = FPGA_DMA_XFER_REGBUF;
+	xfer.handle = reg.handle;
+	if(ioctl(dma_fd, FPGA_DMA_IOC_SUBMIT, &xfer) == 0){
+		printf("regbuf unmap: RX into a TX buffer was queued\n");
+		ret = -1;
+	}
+
+	munmap(buf, len);
+	if(mmap(buf, len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED){
+		ioctl(dma_fd, FPGA_DMA_IOC_UNREG_BUF, &reg.handle);
+		return -1;
+	}
+	xfer.dir = FPGA_DMA_TX;
+	if(ioctl(dma_fd, FPGA_DMA_IOC_SUBMIT, &xfer) == 0){
+		printf("regbuf unmap: TX from a remapped buffer was queued\n");
+		ret = -1;
+	}
+	ioctl(dma_fd, FPGA_DMA_IOC_UNREG_BUF, &reg.handle);
+	munmap(buf, len);
+	return ret;
+}
+
+/* submits that end in a partial word: RX stops short, TX goes whole */
+static int test_partial_word(int dma_fd, int numofwords){
+	struct fpga_dma_status st;
+	struct fpga_dma_xfer rx, tx;
+	struct fpga_dma_wait wait;
+	size_t count = numofwords * 4, guard = 64, i;
+	int write_buf[numofwords];
+	unsigned char *read_buf;
+	int ret = 0;
+
+	if(ioctl(dma_fd, FPGA_DMA_IOC_STATUS, &st) < 0 || st.data_width < 2){
+		printf("partial word: no sub-word length to test, skipped\n");
+		return 0;
+	}
+	read_buf = malloc(count + guard);
+	if(!read_buf)
+		return -1;
+	memset(read_buf, 0xa5, count + guard);
+	fill_pattern(FPGADMA_PAT_COUNTER, 7, write_buf, count);
+	if(write(dma_fd, write_buf, count) != (ssize_t)count){
+		printf("partial word: write failed\n");
+		free(read_buf);
+		return -1;
+	}
+
+	memset(&rx, 0, sizeof(rx));
+	rx.addr = (unsigned long)read_buf;
+	rx.len = count - 1;
+	rx.dir = FPGA_DMA_RX;
+	wait.dir = FPGA_DMA_RX;
+	if(ioctl(dma_fd, FPGA_DMA_IOC_SUBMIT, &rx) < 0){
+		printf("partial word: submit failed\n");
+		ret = -1;
+	} else if(wait.cookie = rx.cookie,
+		  ioctl(dma_fd, FPGA_DMA_IOC_WAIT, &wait) < 0){
+		printf("partial word: RX wait failed\n");
+		ret = -1;
+	} else if(rx.len != count - st.data_width){
+		printf("partial word: %u bytes queued, expected %zu\n",
+		       rx.len, count - st.data_width);
+		ret = -1;
+	} else {
+		ret = check_buf("partial word", write_buf, read_buf, rx.len);
+		for(i = rx.len; i < count + guard; i++){
+			if(read_buf[i] != 0xa5){
+				printf("partial word: byte %zu past the %u "
+				       "queued overwritten\n", i, rx.len);
+				ret = -1;
+				break;
+			}
+		}
+	}
+	/* the last word is still in the FIFO */
+	read(dma_fd, read_buf, st.data_width);
+
+	/* a TX ending in a partial word goes whole, zero padded */
+	memset(&tx, 0, sizeof(tx));
+	tx.addr = (unsigned long)write_buf;
+	tx.len = 2 * st.data_width - 1;
+	tx.dir = FPGA_DMA_TX;
+	wait.dir = FPGA_DMA_TX;
+	if(ioctl(dma_fd, FPGA_DMA_IOC_SUBMIT, &tx) < 0 ||
+	   (wait.cookie = tx.cookie, ioctl(dma_fd, FPGA_DMA_IOC_WAIT, &wait) < 0)){
+		printf("partial word: TX submit failed\n");
+		ret = -1;
+	} else if(read(dma_fd, read_buf, 2 * st.data_width) !=
+		  2 * st.data_width){
+		printf("partial word: read back failed\n");
+		ret = -1;
+	} else if(check_buf("partial word TX", write_buf, read_buf, tx.len)){
+		ret = -1;
+	} else if(read_buf[tx.len] != 0){
+		printf("partial word: TX pad byte not zero\n");
+		ret = -1;
+	}
+	free(read_buf);
+	return ret;
+}
+
+/* TX and RX in one call, no helper thread needed to overlap them */
+static int test_transceive(int dma_fd, int numofwords){
+	struct fpga_dma_transceive xc;
+	int write_buf[numofwords];
+	int read_buf[numofwords];
+
+	/* every data line high once, alone */
+	fill_pattern(FPGADMA_PAT_WALK1, 0, write_buf, sizeof(write_buf));
+	memset(read_buf, 0, sizeof(read_buf));
+	memset(&xc, 0, sizeof(xc));
+	xc.tx.addr = (unsigned long)write_buf;
+	xc.tx.len = numofwords * 4;
+	xc.rx.addr = (unsigned long)read_buf;
+	xc.rx.len = numofwords * 4;
+	if(ioctl(dma_fd, FPGA_DMA_IOC_TRANSCEIVE, &xc) < 0){
+		printf("transceive failed\n");
+		return -1;
+	}
+	return check_buf("transceive", write_buf, read_buf, sizeof(read_buf));
+}
+
+/* far more than the FIFO holds, split into FIFO sized pairs by the driver */
+static int test_transceive_chained(int dma_fd, int numofwords){
+	struct fpga_dma_transceive xc;
+	int *write_buf = malloc(numofwords * 4);
+	int *read_buf = calloc(numofwords, 4);
+	int ret = 0;
+
+	if(!write_buf || !read_buf){
+		free(write_buf);
+		free(read_buf);
+		return -1;
+	}
+	fill_pattern(FPGADMA_PAT_LFSR, 1, write_buf, numofwords * 4);
+	memset(&xc, 0, sizeof(xc));
+	xc.tx.addr = (unsigned long)write_buf;
+	xc.tx.len = numofwords * 4;
+	xc.rx.addr = (unsigned long)read_buf;
+	xc.rx.len = numofwords * 4;
+	if(ioctl(dma_fd, FPGA_DMA_IOC_TRANSCEIVE, &xc) < 0){
+		printf("chained transceive failed\n");
+		ret = -1;
+	} else {
+		ret = check_pattern("chained transceive", FPGADMA_PAT_LFSR, 1,
+				    read_buf, xc.rx.len);
+	}
+	free(write_buf);
+	free(read_buf);
+	return ret;
+}
+
+/* huge page backed buffer: MAP_HUGETLB if pages are reserved, else a THP hint */
+static void *alloc_huge(size_t len){
+	void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+	if(p != MAP_FAILED)
+		return p;
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED)
+		return NULL;
+	madvise(p, len, MADV_HUGEPAGE);
+	return p;
+}
+
+/* the old 50000 x 2048 word loop as one transceive from huge pages */
+static int test_transceive_huge(int dma_fd, int numofwords){
+	struct fpga_dma_transceive xc;
+	size_t len = (size_t)numofwords * 4;
+	int *write_buf = alloc_huge(len);
+	int *read_buf = alloc_huge(len);
+	struct timespec t0, t1, t2;
+	int ret = 0;
+
+	if(!write_buf || !read_buf){
+		printf("huge transceive: no memory, skipped\n");
+		if(write_buf)
+			munmap(write_buf, len);
+		if(read_buf)
+			munmap(read_buf, len);
+		return 0;
+	}
+	fill_pattern(FPGADMA_PAT_COUNTER, 0, write_buf, len);
+	memset(read_buf, 0, len);
+	memset(&xc, 0, sizeof(xc));
+	xc.tx.addr = (unsigned long)write_buf;
+	xc.tx.len = len;
+	xc.rx.addr = (unsigned long)read_buf;
+	xc.rx.len = len;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if(ioctl(dma_fd, FPGA_DMA_IOC_TRANSCEIVE, &xc) < 0){
+		printf("huge transceive failed\n");
+		ret = -1;
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ret = check_pattern("huge transceive", FPGADMA_PAT_COUNTER, 0,
+				    read_buf, len);
+		clock_gettime(CLOCK_MONOTONIC, &t2);
+		printf("huge transceive: %zu bytes in %.3f s, verified (%s) in %.3f s\n",
+		       len, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9,
+		       fpgadma_verify_impl(),
+		       (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1e9);
+	}
+	munmap(write_buf, len);
+	munmap(read_buf, len);
+	return ret;
+}
+
+/* pairs of pool buffer transfers, one eventfd wakeup per batch of them */
+static int test_notify(int dma_fd, int pairs, int numofwords){
+	struct fpga_dma_notify notify;
+	struct fpga_dma_xfer tx, rx;
+	struct pollfd pfd;
+	uint64_t count;
+	__u32 events = 0;
+	int efd, got = 0, wakeups = 0, i;
+
+	efd = eventfd(0, 0);
+	if(efd < 0){
+		printf("eventfd failed\n");
+		return -1;
+	}
+	memset(&notify, 0, sizeof(notify));
+	notify.eventfd = efd;
+	notify.batch = 2 * pairs;
+	notify.delay_us = 100000;
+	if(ioctl(dma_fd, FPGA_DMA_IOC_SET_NOTIFY, &notify) < 0){
+		printf("set notify failed\n");
+		close(efd);
+		return -1;
+	}
+
+	memset(&tx, 0, sizeof(tx));
+	tx.len = numofwords * 4;
+	tx.dir = FPGA_DMA_TX;
+	tx.flags = FPGA_DMA_XFER_DRVBUF;
+	rx = tx;
+	rx.dir = FPGA_DMA_RX;
+	rx.handle = 1;
+	for(i = 0; i < pairs; i++){
+		if(ioctl(dma_fd, FPGA_DMA_IOC_SUBMIT, &rx) < 0 ||
+		   ioctl(dma_fd, FPGA_DMA_IOC_SUBMIT, &tx) < 0){
+			printf("notify submit failed\n");
+			break;
+		}
+	}
+	pfd.fd = efd;
+	pfd.events = POLLIN;
+	while(got < 2 * i && poll(&pfd, 1, 1000) > 0){
+		if(read(efd, &count, sizeof(count)) != sizeof(count))
+			break;
+		got += count;
+		wakeups++;
+	}
+	ioctl(dma_fd, FPGA_DMA_IOC_EVENTS, &events);
+	printf("notify: %d completions in %d wakeups, %u collected\n",
+	       got, wakeups, events);
+
+	notify.eventfd = -1;
+	notify.batch = 1;
+	notify.delay_us = 0;
+	ioctl(dma_fd, FPGA_DMA_IOC_SET_NOTIFY, &notify);
+	close(efd);
+	return got == 2 * pairs ? 0 : -1;
+}
+
+static int test_ring(int dma_fd, int numofwords){
+	struct fpga_dma_ring_setup setup;
+	struct fpga_dma_ring_ctrl *ctrl;
+	size_t count = numofwords * 4;
+	int periods = 8;
+	int write_buf[numofwords];
+	int *period;
+	unsigned int seen;
+	char what[32];
+	char *map;
+	int n, ret = 0;
+
+	memset(&setup, 0, sizeof(setup));
+	setup.period_len = count;
+	setup.periods = periods;
+	if(ioctl(dma_fd, FPGA_DMA_IOC_RING_START, &setup) < 0){
+		printf("Unable to start RX ring\n");
+		return -1;
+	}
+	map = mmap(NULL, setup.mmap_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   dma_fd, setup.mmap_offset);
+	if(map == MAP_FAILED){
+		printf("Unable to mmap RX ring\n");
+		ioctl(dma_fd, FPGA_DMA_IOC_RING_STOP);
+		return -1;
+	}
+	ctrl = (struct fpga_dma_ring_ctrl *)map;
+	for(n = 0; n < 2 * periods; n++){
+		fill_pattern(FPGADMA_PAT_COUNTER, n * numofwords, write_buf, count);
+		if(write(dma_fd, write_buf, count) != (ssize_t)count){
+			printf("ring write failed\n");
+			ret = -1;
+			goto out;
+		}
+		seen = ctrl->consumed;
+		while(ctrl->produced == seen){
+			if(ioctl(dma_fd, FPGA_DMA_IOC_RING_WAIT, &seen) < 0){
+				printf("RX ring wait failed\n");
+				ret = -1;
+				goto out;
+			}
+		}
+		period = (int *)(map + ctrl->data_offset +
+				 (ctrl->consumed % ctrl->periods) * ctrl->period_len);
+		snprintf(what, sizeof(what), "ring period %d", n);
+		if(check_pattern(what, FPGADMA_PAT_COUNTER, n * numofwords,
+				 period, count))
+			ret = -1;
+		ctrl->consumed++;
+	}
+	if(ctrl->overruns)
+		printf("ring overruns: %u\n", ctrl->overruns);
+out:
+	if(ioctl(dma_fd, FPGA_DMA_IOC_RING_STOP) < 0){
+		printf("Unable to stop RX ring\n");
+		ret = -1;
+	}
+	munmap(map, setup.mmap_len);
+	return ret;
+}
+
+int main(int argc, char *argv[]){
+	int dma_fd,csr_fd,clr_fd;
+	dma_fd = open(FPGA_DMA_DEV, O_RDWR);
+	csr_fd = open(FPGA_DMA_DBGFS "/csr", O_RDWR);
+	clr_fd = open(FPGA_DMA_DBGFS "/clear", O_RDWR);
+	if(dma_fd < 1){
+		printf("Unable to open %s", FPGA_DMA_DEV);
+		return -1;
+	}
+	int numofwords = 65536;
+	int write_buf[numofwords];
+	int read_buf[numofwords];
+	size_t count = numofwords * 4;
+	int failed = 0;
+
+	fill_pattern(FPGADMA_PAT_COUNTER, 0, write_buf, count);
+	write(clr_fd, write_buf, count);
+	if(write(dma_fd, write_buf, count) != (ssize_t)count ||
+	   read(dma_fd, read_buf, count) != (ssize_t)count){
+		printf("read/write failed\n");
+		failed++;
+	} else if(check_buf("read/write", write_buf, read_buf, count)){
+		failed++;
+	}
+
+	write(clr_fd, write_buf, count);
+	failed += !!test_drvbuf(dma_fd, 2048);
+	failed += !!test_regbuf(dma_fd, 2048);
+	failed += !!test_regbuf_unmap(dma_fd);
+	failed += !!test_partial_word(dma_fd, 2048);
+	failed += !!test_transceive(dma_fd, 2048);
+	failed += !!test_transceive_chained(dma_fd, 4 * 1024 * 1024);
+	failed += !!test_transceive_huge(dma_fd, 50000 * 2048);
+	failed += !!test_notify(dma_fd, 8, 64);
+	failed += !!test_ring(dma_fd, 512);
+
+	if(failed)
+		printf("%d tests failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * FPGA DMA transfer module - tracepoints
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * A transfer goes submit -> issue -> callback -> retire; user pages are
+ * pinned and mapped (map) before submit and released (unmap) on retire.
+ * All events are off until enabled, e.g.
+ *   trace-cmd record -e fpga_dma ./bench
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM fpga_dma
+
+#if !defined(_FPGA_DMA_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _FPGA_DMA_TRACE_H
+
+#include <linux/dma-direction.h>
+#include <linux/tracepoint.h>
+
+#define show_fpga_dma_dir(dir)					\
+	__print_symbolic(dir,					\
+			 { FPGA_DMA_TX, "tx" },			\
+			 { FPGA_DMA_RX, "rx" })
+
+DECLARE_EVENT_CLASS(fpga_dma_xfer,
+
+	TP_PROTO(u32 dir, int cookie, size_t len, unsigned int nents),
+
+	TP_ARGS(dir, cookie, len, nents),
+
+	TP_STRUCT__entry(
+		__field(u32, dir)
+		__field(int, cookie)
+		__field(size_t, len)
+		__field(unsigned int, nents)
+	),
+
+	TP_fast_assign(
+		__entry->dir = dir;
+		__entry->cookie = cookie;
+		__entry->len = len;
+		__entry->nents = nents;
+	),
+
+	TP_printk("%s cookie=%d len=%zu nents=%u",
+		  show_fpga_dma_dir(__entry->dir), __entry->cookie,
+		  __entry->len, __entry->nents)
+);
+
+/* request handed to the queue, cookie not assigned yet */
+DEFINE_EVENT(fpga_dma_xfer, fpga_dma_submit,
+	TP_PROTO(u32 dir, int cookie, size_t len, unsigned int nents),
+	TP_ARGS(dir, cookie, len, nents)
+);
+
+/* descriptor prepared and dma_async_issue_pending() called */
+DEFINE_EVENT(fpga_dma_xfer, fpga_dma_issue,
+	TP_PROTO(u32 dir, int cookie, size_t len, unsigned int nents),
+	TP_ARGS(dir, cookie, len, nents)
+);
+
+/* dmaengine completion callback, tasklet context */
+DEFINE_EVENT(fpga_dma_xfer, fpga_dma_callback,
+	TP_PROTO(u32 dir, int cookie, size_t len, unsigned int nents),
+	TP_ARGS(dir, cookie, len, nents)
+);
+
+/* completed request picked up and freed in process context */
+DEFINE_EVENT(fpga_dma_xfer, fpga_dma_retire,
+	TP_PROTO(u32 dir, int cookie, size_t len, unsigned int nents),
+	TP_ARGS(dir, cookie, len, nents)
+);
+
+DECLARE_EVENT_CLASS(fpga_dma_mapping,
+
+	TP_PROTO(enum dma_data_direction dir, size_t len, unsigned int pages,
+		 unsigned int nents),
+
+	TP_ARGS(dir, len, pages, nents),
+
+	TP_STRUCT__entry(
+		__field(int, dir)
+		__field(size_t, len)
+		__field(unsigned int, pages)
+		__field(unsigned int, nents)
+	),
+
+	TP_fast_assign(
+		__entry->dir = dir;
+		__entry->len = len;
+		__entry->pages = pages;
+		__entry->nents = nents;
+	),
+
+	TP_printk("%s len=%zu pages=%u nents=%u",
+		  __entry->dir == DMA_FROM_DEVICE ? "from_device" :
+		  "to_device", __entry->len, __entry->pages, __entry->nents)
+);
+
+/* user pages pinned and mapped with dma_map_sg_attrs() */
+DEFINE_EVENT(fpga_dma_mapping, fpga_dma_map,
+	TP_PROTO(enum dma_data_direction dir, size_t len, unsigned int pages,
+		 unsigned int nents),
+	TP_ARGS(dir, len, pages, nents)
+);
+
+DEFINE_EVENT(fpga_dma_mapping, fpga_dma_unmap,
+	TP_PROTO(enum dma_data_direction dir, size_t len, unsigned int pages,
+		 unsigned int nents),
+	TP_ARGS(dir, len, pages, nents)
+);
+
+#endif /* _FPGA_DMA_TRACE_H */
+
+/* this part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE fpga-dma-trace
+#include <trace/define_trace.h>
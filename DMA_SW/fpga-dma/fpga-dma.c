@@ -0,0 +1,4629 @@
+/*
+ * FPGA DMA transfer module
+ *
+ * Copyright Altera Corporation (C) 2014. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <linux/cdev.h>
+#include <linux/scatterlist.h>
+#include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmapool.h>
+#include <linux/eventfd.h>
+#include <linux/fs.h>
+#include <linux/hrtimer.h>
+#include <linux/idr.h>
+#include <linux/interval_tree.h>
+#include <linux/io.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/mempool.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/mmu_notifier.h>
+#include <linux/module.h>
+#include <linux/of_address.h>
+#include <linux/of_device.h>
+#include <linux/of.h>
+#include <linux/of_platform.h>
+#include <linux/percpu.h>
+#include <linux/pm.h>
+#include <linux/poll.h>
+#include <linux/rwsem.h>
+#include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+#include <linux/seq_file.h>
+#include <linux/sizes.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/types.h>
+#include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
+
+#include "fpga-dma.h"
+
+/*
+ * Written against 5.8 (get_user_pages_fast_only, mmap_lock) to 5.15
+ * (three argument ki_complete, iov_iter_get_pages, iter->iov).
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 8, 0) || \
+    LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+#error "fpga-dma supports Linux 5.8 to 5.15"
+#endif
+
+#define CREATE_TRACE_POINTS
+#include "fpga-dma-trace.h"
+
+/****************************************************************************/
+
+static unsigned int max_burst_words = 16;
+module_param(max_burst_words, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(max_burst_words, "Size of a burst in words "
+		 "(in this case a word is 64 bits)");
+
+static int wr_wtrmk = -1;
+module_param(wr_wtrmk, int, S_IRUGO);
+MODULE_PARM_DESC(wr_wtrmk, "FIFO write watermark in words (default: -1, "
+		 "FIFO depth minus max_burst_words)");
+
+static int rd_wtrmk = -1;
+module_param(rd_wtrmk, int, S_IRUGO);
+MODULE_PARM_DESC(rd_wtrmk, "FIFO read watermark in words (default: -1, 0 "
+		 "so that the burst request line is always asserted)");
+
+static bool calibrate;
+module_param(calibrate, bool, S_IRUGO);
+MODULE_PARM_DESC(calibrate, "Sweep burst sizes and watermarks over the "
+		 "loopback at probe and keep the fastest (default: N)");
+
+static int timeout = 1000;
+module_param(timeout, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(timeout, "Transfer Timeout in msec (default: 1000), "
+		 "Pass -1 for infinite timeout");
+
+static unsigned int queue_depth = 8;
+module_param(queue_depth, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(queue_depth, "Transfers kept in flight per direction "
+		 "before a O_NONBLOCK submitter has to wait (default: 8)");
+
+static unsigned int pool_bufs = 4;
+module_param(pool_bufs, uint, S_IRUGO);
+MODULE_PARM_DESC(pool_bufs, "Number of mmap()able DMA buffers allocated at "
+		 "probe (default: 4)");
+
+static unsigned int buf_size = 1024 * 1024;
+module_param(buf_size, uint, S_IRUGO);
+MODULE_PARM_DESC(buf_size, "Size of each mmap()able DMA buffer in bytes "
+		 "(default: 1 MiB)");
+
+static unsigned int pin_cache;
+module_param(pin_cache, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(pin_cache, "Number of unregistered user buffers kept "
+		 "pinned for reuse by read/write (default: 0, off). Entries "
+		 "are dropped when their range is unmapped or remapped; "
+		 "needs CONFIG_MMU_NOTIFIER");
+
+static bool coalesce_sg = true;
+module_param(coalesce_sg, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(coalesce_sg, "Merge physically contiguous user pages into "
+		 "one DMA segment (default: Y), N maps page by page");
+
+static unsigned int poll_us = 50;
+module_param(poll_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(poll_us, "How long a FPGA_DMA_XFER_POLL transfer is spun "
+		 "on before its waiter goes to sleep (default: 50 us)");
+
+static int bounce_max = -1;
+module_param(bounce_max, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(bounce_max, "Transfers up to this many bytes are copied "
+		 "through a per-CPU buffer instead of pinning the user pages "
+		 "(default: -1, measured per instance at probe; 0 turns this "
+		 "off)");
+
+/* struct fpga_dma_xfer flags this driver knows */
+#define FPGA_DMA_XFER_FLAGS	(FPGA_DMA_XFER_DRVBUF | FPGA_DMA_XFER_REGBUF | \
+				 FPGA_DMA_XFER_POLL)
+
+/* requests the per device mempool keeps in reserve */
+#define FPGA_DMA_MIN_REQS		16
+/* failed cookies an opener keeps per direction for FPGA_DMA_IOC_WAIT */
+#define FPGA_DMA_FAILED			32
+
+static struct kmem_cache *fpga_dma_req_cache;
+/* instance numbers, the N of /dev/fpga_dmaN and debugfs fpga_dmaN */
+static DEFINE_IDA(fpga_dma_ida);
+
+#define ALT_FPGADMA_DATA_WRITE		0x00
+#define ALT_FPGADMA_DATA_READ		0x08
+
+#define ALT_FPGADMA_CSR_WR_WTRMK	0x00
+#define ALT_FPGADMA_CSR_RD_WTRMK	0x04
+#define ALT_FPGADMA_CSR_BURST		0x08
+#define ALT_FPGADMA_CSR_FIFO_STATUS	0x0C
+#define ALT_FPGADMA_CSR_DATA_WIDTH	0x10
+#define ALT_FPGADMA_CSR_FIFO_DEPTH	0x14
+#define ALT_FPGADMA_CSR_FIFO_CLEAR	0x18
+#define ALT_FPGADMA_CSR_ZERO		0x1C
+
+#define ALT_FPGADMA_CSR_BURST_TX_SINGLE	(1 << 0)
+#define ALT_FPGADMA_CSR_BURST_TX_BURST	(1 << 1)
+#define ALT_FPGADMA_CSR_BURST_RX_SINGLE	(1 << 2)
+#define ALT_FPGADMA_CSR_BURST_RX_BURST	(1 << 3)
+
+#define ALT_FPGADMA_FIFO_FULL		(1 << 25)
+#define ALT_FPGADMA_FIFO_EMPTY		(1 << 24)
+#define ALT_FPGADMA_FIFO_USED_MASK	((1 << 24)-1)
+
+/*
+ * One submission queue per direction. Requests are kept in submission
+ * order, which is also the order the channel completes them in.
+ */
+struct fpga_dma_queue {
+	struct dma_chan *chan;
+	struct mutex lock;
+	struct list_head inflight;
+	unsigned int depth;
+
+	/* descriptor segments per transfer, see the "segs" debugfs file */
+	u64 transfers;
+	u64 segments;
+	unsigned int last_segs;
+	unsigned int max_segs;
+};
+
+/*
+ * Latency histograms, see the "stats" debugfs file. Bucket b counts
+ * intervals of [2^(b-1), 2^b) ns, per direction, transfer size class and
+ * stage. Every CPU counts into its own copy, readers add them up.
+ */
+enum fpga_dma_stage {
+	FPGA_DMA_STAGE_MAP,	/* pinning and mapping user pages */
+	FPGA_DMA_STAGE_SUBMIT,	/* submit to issue_pending, incl. queue full */
+	FPGA_DMA_STAGE_ISSUE,	/* issue_pending to completion callback */
+	FPGA_DMA_STAGE_WAKE,	/* callback to the waiter running again */
+	FPGA_DMA_NUM_STAGES
+};
+
+#define FPGA_DMA_NUM_SIZES	4	/* < 4 KiB, < 64 KiB, < 1 MiB, larger */
+#define FPGA_DMA_HIST_BUCKETS	32
+
+struct fpga_dma_stats {
+	unsigned long hist[2][FPGA_DMA_NUM_SIZES][FPGA_DMA_NUM_STAGES]
+			  [FPGA_DMA_HIST_BUCKETS];
+};
+
+/* one burst/watermark candidate of the calibration sweep */
+struct fpga_dma_cal {
+	u32 burst;
+	u32 wr_wtrmk;
+	u32 rd_wtrmk;
+	int result;		/* 0, or why the candidate failed */
+	u64 kbps;		/* loopback throughput, KiB/s */
+};
+
+/*
+ * Small transfers are copied through one of a few buffers per CPU, kept
+ * mapped for the lifetime of the device. A slot is taken on the
+ * submitting CPU and released by whoever frees the request.
+ */
+#define FPGA_DMA_PCPU_SLOTS	4
+#define FPGA_DMA_PCPU_SIZE	SZ_16K
+
+struct fpga_dma_pcpu {
+	unsigned long busy;		/* slot bitmap */
+	void *virt[FPGA_DMA_PCPU_SLOTS];
+	dma_addr_t dma[FPGA_DMA_PCPU_SLOTS];
+};
+
+/* one physically contiguous, coherent buffer of the mmap() pool */
+struct fpga_dma_poolbuf {
+	void *virt;
+	dma_addr_t dma;
+};
+
+struct fpga_dma_pdata {
+
+	struct platform_device *pdev;
+
+	int id;
+	char name[16];		/* fpga_dma<id> */
+	struct dentry *root;
+	struct miscdevice miscdev;
+	/*
+	 * Open files, mappings and rings hold a reference, the last one
+	 * frees pdata and the pool. File operations run under remove_lock
+	 * for reading and fail once remove() set dead.
+	 */
+	struct kref ref;
+	struct rw_semaphore remove_lock;
+	bool dead;
+	/* first inode opened, every file maps through its i_mapping */
+	struct inode *inode;
+
+	unsigned int data_reg_phy;
+	void __iomem *data_reg;
+	void __iomem *csr_reg;
+
+	unsigned int fifo_size_bytes;
+	unsigned int fifo_depth;
+	unsigned int data_width;
+	unsigned int data_width_bytes;
+	/* burst of this instance when calibrated, else 0: max_burst_words */
+	unsigned int burst_words;
+	/* FIFO sized kernel buffers of the bounce engine, under bounce_lock */
+	unsigned char *read_buf;
+	unsigned char *write_buf;
+	dma_addr_t read_buf_dma;
+	dma_addr_t write_buf_dma;
+	struct mutex bounce_lock;
+	/* FIFO sized coherent blocks for the sub-burst tail of write() */
+	struct dma_pool *tail_pool;
+	struct fpga_dma_pcpu __percpu *pcpu;
+	/* copy threshold measured at probe, used while bounce_max is -1 */
+	int bounce_max;
+
+	/* driver owned buffers user space can mmap() and DMA from/to */
+	struct fpga_dma_poolbuf *pool;
+	unsigned int pool_bufs;
+	size_t buf_size;
+
+	struct dma_chan *txchan;
+	struct dma_chan *rxchan;
+	struct fpga_dma_queue txq;
+	struct fpga_dma_queue rxq;
+	mempool_t *req_pool;
+	/* retires aio requests nobody waits for */
+	struct work_struct reap_work;
+	/* poll()ers of any opener waiting for a free slot, see req_retire */
+	wait_queue_head_t room_wait;
+	struct fpga_dma_stats __percpu *stats;
+	/* sweep table of the probe time calibration, if it ran */
+	struct fpga_dma_cal *cal;
+	unsigned int cal_n;
+	/* cyclic RX, owns the RX channel while set; under rxq.lock */
+	struct fpga_dma_ring *ring;
+
+	/* registered and cached user buffers, most recently used first */
+	struct mutex ubuf_lock;
+	struct list_head ubufs;
+	struct idr ubuf_idr;
+	unsigned int ubuf_cached;
+#ifdef CONFIG_MMU_NOTIFIER
+	/* the same buffers by user address range, for fpga_dma_ubuf_lookup() */
+	struct rb_root_cached ubuf_tree;
+#endif
+};
+
+/* per open file state, file->private_data of the character device */
+struct fpga_dma_file {
+	struct fpga_dma_pdata *pdata;
+	u32 engine;		/* FPGA_DMA_ENGINE_* used by read()/write() */
+	/* first failure per direction, reported by fsync()/WAIT 0; q->lock */
+	int error[2];
+	/* the last failed cookies, each reported once by its WAIT; q->lock */
+	struct {
+		dma_cookie_t cookie;
+		int error;
+	} failed[2][FPGA_DMA_FAILED];
+	unsigned int failed_next[2];
+	/* completion notification, FPGA_DMA_IOC_SET_NOTIFY; under lock */
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	struct eventfd_ctx *eventfd;
+	unsigned int batch;
+	ktime_t delay;
+	struct hrtimer timer;
+	unsigned int unsignalled;	/* completed, not signalled yet */
+	unsigned int signalled;		/* signalled, not collected yet */
+};
+
+struct fpga_dma_req;
+struct fpga_dma_ring;
+
+static int fpga_dma_dma_start_rx(struct platform_device *pdev,
+				 struct fpga_dma_req *req, u32 burst_size);
+static int fpga_dma_dma_start_tx(struct platform_device *pdev,
+				 struct fpga_dma_req *req, u32 burst_size);
+static int fpga_dma_dma_start_cyclic(struct platform_device *pdev,
+				     struct fpga_dma_ring *ring, u32 burst_size);
+static enum hrtimer_restart fpga_dma_notify_timer(struct hrtimer *timer);
+static void fpga_dma_signal(struct fpga_dma_file *fp);
+typedef struct {
+	void __user *vaddr;
+	void *kaddr;
+	dma_addr_t daddr;
+	size_t len;
+	size_t off1st;
+	size_t llast;
+	size_t pgnum;
+	size_t sgnum;
+	struct page **pages;
+	struct sg_table sgt;
+	struct scatterlist *sgs;
+	enum dma_data_direction dir;
+} usrbuf_t;
+
+/*
+ * A user buffer that stays pinned and mapped across transfers. It is
+ * either registered explicitly (handle != 0) or an entry of the pin cache.
+ * The list holds one reference, every request using it holds another.
+ * Both kinds watch their range with an MMU notifier: once it is unmapped
+ * or remapped the pinned pages are no longer the caller's memory, so the
+ * buffer goes stale and is not used again.
+ */
+struct fpga_dma_ubuf {
+	struct list_head node;
+	struct kref ref;
+	struct fpga_dma_pdata *pdata;
+	struct file *owner;
+	struct mm_struct *mm;
+	unsigned long vaddr;
+	size_t len;
+	u32 handle;
+	usrbuf_t *usrbuf;
+#ifdef CONFIG_MMU_NOTIFIER
+	struct mmu_interval_notifier notifier;
+	struct interval_tree_node it;	/* in ubuf_tree while linked */
+	bool watched;
+#endif
+	bool stale;
+};
+
+/*
+ * One side of a chained transceive, consumed a chunk at a time: a pool
+ * buffer, or a pinned user range walked with a cursor so that slicing
+ * the next chunk does not rescan the segments already done.
+ */
+struct fpga_dma_chain {
+	enum dma_data_direction dir;
+	dma_addr_t dma;			/* next chunk of a pool buffer */
+	struct fpga_dma_ubuf *ubuf;	/* else the pinned user range */
+	struct scatterlist *sg;		/* segment the next chunk starts in */
+	int nents;			/* segments left from sg */
+	size_t skip;			/* bytes of sg already used */
+	bool poll;
+};
+
+/*
+ * A submitted transfer. It moves data from/to user pages pinned for this
+ * request only (usrbuf), a slice of a registered buffer (ubuf) or the
+ * driver buffer (dma_addr). User pages stay pinned and mapped until the
+ * request is retired, which always happens in process context.
+ */
+struct fpga_dma_req {
+	struct list_head node;
+	struct fpga_dma_pdata *pdata;
+	struct fpga_dma_file *fp;	/* submitter or NULL for the driver's own */
+	int *error;		/* deferred error slot, else fp->error[] */
+	usrbuf_t *usrbuf;
+	struct fpga_dma_ubuf *ubuf;
+	struct scatterlist *sgs;	/* owned by the request if ubuf */
+	int sgnum;
+	dma_addr_t dma_addr;
+	void *tail;		/* tail_pool block at dma_addr, if any */
+	struct fpga_dma_pcpu *pcpu;	/* or per-CPU slot pslot */
+	unsigned int pslot;
+	char __user *ucopy;	/* RX through pcpu: copied out on retire */
+	struct kiocb *iocb;	/* async read_iter/write_iter, on retire */
+	ssize_t iocb_res;
+	enum dma_data_direction dir;
+	dma_cookie_t cookie;
+	size_t len;
+	struct completion done;
+	bool poll;		/* waiter spins before sleeping */
+	bool nowait;		/* IOCB_NOWAIT: -EAGAIN rather than sleep */
+	/* for the latency histograms */
+	ktime_t submitted;
+	ktime_t issued;
+	ktime_t completed;
+};
+
+/*
+ * Cyclic RX ring: one coherent allocation holding the control page user
+ * space polls followed by the periods. The driver and every mapping hold
+ * a reference, so the memory outlives RING_STOP while still mapped.
+ */
+struct fpga_dma_ring {
+	struct kref ref;
+	struct fpga_dma_pdata *pdata;	/* held until the ring is released */
+	struct file *owner;
+	void *virt;
+	dma_addr_t dma;
+	size_t size;
+	struct fpga_dma_ring_ctrl *ctrl;
+	dma_cookie_t cookie;
+	wait_queue_head_t wait;
+	bool stopped;
+};
+/* --------------------------------------------------------------------- */
+
+static size_t
+/*
+*Function to caculate the page numer for scatter-list
+*/ 
+calc_pgs_num(usrbuf_t *usrbuf)
+{
+	size_t sz1st;
+	if (usrbuf->len) {
+		usrbuf->pgnum = 1;
+	} else {
+		return 0;
+	}
+	usrbuf->off1st = (size_t)(usrbuf->vaddr) & (PAGE_SIZE - 1);
+	sz1st = PAGE_SIZE - usrbuf->off1st;
+	if (sz1st > usrbuf->len) {
+		usrbuf->llast = 0;
+	} else {
+		usrbuf->pgnum += (usrbuf->len - sz1st) / PAGE_SIZE;
+		usrbuf->llast = (usrbuf->len - sz1st) & (PAGE_SIZE - 1);
+		if (usrbuf->llast)
+			++usrbuf->pgnum;
+	}
+	return usrbuf->pgnum;
+}
+
+/*
+ * Number of pages from @pages[0] on, at most @n, that are consecutive
+ * parts of the same huge page (THP or hugetlbfs) and so can share one
+ * DMA segment even when coalesce_sg is off. 1 for a normal page.
+ */
+static size_t fpga_dma_huge_run(struct page **pages, size_t n)
+{
+	struct page *head = compound_head(pages[0]);
+	unsigned long pfn = page_to_pfn(pages[0]);
+	size_t i;
+
+	if (!PageCompound(pages[0]))
+		return 1;
+	for (i = 1; i < n; i++)
+		if (compound_head(pages[i]) != head ||
+		    page_to_pfn(pages[i]) != pfn + i)
+			break;
+	return i;
+}
+
+static size_t fpga_dma_huge_segs(usrbuf_t *usrbuf)
+{
+	size_t i, segs = 0;
+
+	for (i = 0; i < usrbuf->pgnum;
+	     i += fpga_dma_huge_run(usrbuf->pages + i, usrbuf->pgnum - i))
+		segs++;
+	return segs;
+}
+
+static void 
+populate_sgs(usrbuf_t *usrbuf)
+{
+/*
+*Function to populate the scatter-list one page (or one huge page) per
+*entry, only used when coalesce_sg is off
+*/ 
+	struct scatterlist *sg = usrbuf->sgt.sgl;
+	size_t i, run, len = usrbuf->len;
+	size_t off = usrbuf->off1st, sglen;
+
+	for (i = 0; i < usrbuf->pgnum; i += run, sg = sg_next(sg)) {
+		run = fpga_dma_huge_run(usrbuf->pages + i, usrbuf->pgnum - i);
+		sglen = min(run * PAGE_SIZE - off, len);
+		sg_set_page(sg, usrbuf->pages[i], sglen, off);
+		len -= sglen;
+		/* only the 1st page has a nonzero off */
+		off = 0;
+	}
+}
+
+static usrbuf_t *get_usr_buf(struct platform_device *dma_dev,
+			     const char __user * buf, size_t len,
+			     enum dma_data_direction dir)
+{
+	size_t pgnum;
+	long pinned;
+	size_t i;
+	int ret = -ENOMEM;
+	struct device *dev = &dma_dev->dev;
+/* ALLOC_USR_BUF */
+	usrbuf_t *usrbuf = kzalloc(sizeof(usrbuf_t), GFP_KERNEL);
+	if (NULL == usrbuf) {
+		dev_err(dev, "kzalloc() usrbuf_t error!\n");
+		return ERR_PTR(-ENOMEM);
+	}
+	// calculate number of pages in user buf
+	usrbuf->vaddr = buf;
+	usrbuf->len = len;
+	usrbuf->dir = dir;
+	pgnum = calc_pgs_num(usrbuf);
+/* ALLOC PAGES */
+	/* 8 bytes per 4 KB page: too large for kmalloc on big buffers */
+	usrbuf->pages = kvmalloc_array(pgnum, sizeof(struct page *),
+				       GFP_KERNEL);
+	if (NULL == usrbuf->pages) {
+		dev_err(dev, "kvmalloc() pages error!\n");
+		goto FREE_USR_BUF;
+	}
+
+/* GET PAGES */
+	/*
+	 * The fast walk takes a huge PMD/PUD, THP or hugetlbfs, in one step
+	 * instead of one page table walk per 4 KB page, and only falls back
+	 * to get_user_pages() under mmap_lock for what is not faulted in.
+	 * The device only reads a TX buffer, so that may be read only and
+	 * shared pages stay shared.
+	 */
+	pinned = get_user_pages_fast((unsigned long)buf,
+				     pgnum,
+				     dir == DMA_TO_DEVICE ? 0 : FOLL_WRITE,
+				     usrbuf->pages);
+	if (pinned < (long)pgnum) {
+		dev_err(dev, "get_user_pages_fast() error %ld!\n", pinned);
+		usrbuf->pgnum = pinned > 0 ? pinned : 0;
+		ret = pinned < 0 ? pinned : -EFAULT;
+		goto PUT_PAGES;
+	}
+
+/* SG TABLE */
+	/*
+	 * merge physically contiguous pages into one entry each; a huge
+	 * page is always one entry, even page by page
+	 */
+	if (coalesce_sg) {
+		ret = sg_alloc_table_from_pages(&usrbuf->sgt, usrbuf->pages,
+						pgnum, usrbuf->off1st, len,
+						GFP_KERNEL);
+	} else {
+		ret = sg_alloc_table(&usrbuf->sgt, fpga_dma_huge_segs(usrbuf),
+				     GFP_KERNEL);
+		if (!ret)
+			populate_sgs(usrbuf);
+	}
+	if (ret) {
+		dev_err(dev, "sg table alloc error %d!\n", ret);
+		goto PUT_PAGES;
+	}
+	usrbuf->sgs = usrbuf->sgt.sgl;
+
+/* DMA MAP SG */
+	usrbuf->sgnum = dma_map_sg_attrs(&dma_dev->dev,
+					 usrbuf->sgt.sgl,
+					 usrbuf->sgt.nents,
+					 usrbuf->dir,
+					 0);
+
+	if (usrbuf->sgnum == 0) {
+		dev_err(dev, "dma_map_sg() error!\n");
+		ret = -ENOMEM;
+		goto FREE_SGS;
+	}
+	trace_fpga_dma_map(dir, len, pgnum, usrbuf->sgnum);
+	return usrbuf;
+
+FREE_SGS:			/* !SG TABLE */
+	sg_free_table(&usrbuf->sgt);
+PUT_PAGES:			/* !GET PAGES */
+	for (i = 0; i < usrbuf->pgnum; ++i)
+		put_page(usrbuf->pages[i]);
+/* FREE_PAGES:				!ALLOC PAGES */
+	kvfree(usrbuf->pages);
+FREE_USR_BUF:			/* !ALLOC_USR_BUF */
+	kfree(usrbuf);
+	return ERR_PTR(ret);
+}
+
+/*
+ * IOCB_NOWAIT: pin the next segment of a user @iter from the page tables
+ * alone, without faulting or taking mmap_lock. Returns the bytes pinned,
+ * as iov_iter_get_pages() does, or -EAGAIN if a page isn't present.
+ */
+static ssize_t fpga_dma_iter_pages_nowait(struct iov_iter *iter,
+					  struct page **pages,
+					  unsigned int maxpages, size_t *off,
+					  enum dma_data_direction dir)
+{
+	unsigned long addr;
+	size_t len;
+	int n, pinned;
+
+	if (!iter_is_iovec(iter) || iter->iov_offset >= iter->iov->iov_len)
+		return iov_iter_get_pages(iter, pages, LONG_MAX, maxpages, off);
+	addr = (unsigned long)iter->iov->iov_base + iter->iov_offset;
+	len = min(iov_iter_count(iter), iter->iov->iov_len - iter->iov_offset);
+	*off = offset_in_page(addr);
+	n = min_t(size_t, DIV_ROUND_UP(*off + len, PAGE_SIZE), maxpages);
+	pinned = get_user_pages_fast_only(addr & PAGE_MASK, n,
+					  dir == DMA_FROM_DEVICE ?
+					  FOLL_WRITE : 0, pages);
+	if (pinned < n) {
+		while (pinned > 0)
+			put_page(pages[--pinned]);
+		return -EAGAIN;
+	}
+	return min_t(size_t, len, (size_t)n * PAGE_SIZE - *off);
+}
+
+/*
+ * Pin every segment of @iter into one scatterlist, so a readv()/writev()
+ * or an io_uring vector becomes one descriptor chain. Pages that
+ * continue the previous entry physically are merged into it, always
+ * within a huge page and across pages only when coalesce_sg is set.
+ * With @nowait only pages already mapped are taken, and no allocation
+ * sleeps for memory.
+ */
+static usrbuf_t *get_iter_buf(struct platform_device *dma_dev,
+			      struct iov_iter *iter,
+			      enum dma_data_direction dir, bool nowait)
+{
+	gfp_t gfp = nowait ? GFP_NOWAIT : GFP_KERNEL;
+	struct device *dev = &dma_dev->dev;
+	struct scatterlist *sg = NULL;
+	unsigned int nents = 0;
+	usrbuf_t *usrbuf;
+	struct page *page;
+	ssize_t bytes;
+	size_t off, n, i;
+	int npages;
+
+	usrbuf = kzalloc(sizeof(*usrbuf), gfp);
+	if (!usrbuf)
+		return NULL;
+	usrbuf->len = iov_iter_count(iter);
+	usrbuf->dir = dir;
+	npages = iov_iter_npages(iter, INT_MAX);
+	usrbuf->pages = kvmalloc_array(npages, sizeof(struct page *), gfp);
+	if (!usrbuf->pages)
+		goto free_usrbuf;
+	if (sg_alloc_table(&usrbuf->sgt, npages, gfp))
+		goto free_pages;
+
+	while (iov_iter_count(iter)) {
+		if (nowait)
+			bytes = fpga_dma_iter_pages_nowait(iter,
+					usrbuf->pages + usrbuf->pgnum,
+					npages - usrbuf->pgnum, &off, dir);
+		else
+			bytes = iov_iter_get_pages(iter,
+					usrbuf->pages + usrbuf->pgnum,
+					LONG_MAX, npages - usrbuf->pgnum, &off);
+		if (bytes <= 0) {
+			if (bytes != -EAGAIN)
+				dev_err(dev, "iov_iter_get_pages() error %zd!\n",
+					bytes);
+			goto put_pages;
+		}
+		iov_iter_advance(iter, bytes);
+		for (; bytes; off = 0) {
+			page = usrbuf->pages[usrbuf->pgnum++];
+			n = min_t(size_t, bytes, PAGE_SIZE - off);
+			if (sg && page_to_phys(sg_page(sg)) + sg->offset +
+			    sg->length == page_to_phys(page) + off &&
+			    (coalesce_sg || (PageCompound(page) &&
+			     compound_head(page) ==
+			     compound_head(sg_page(sg))))) {
+				sg->length += n;
+			} else {
+				sg = sg ? sg_next(sg) : usrbuf->sgt.sgl;
+				sg_set_page(sg, page, n, off);
+				nents++;
+			}
+			bytes -= n;
+		}
+	}
+	if (!sg)
+		goto put_pages;
+	sg_mark_end(sg);
+	usrbuf->sgt.nents = nents;
+	usrbuf->sgs = usrbuf->sgt.sgl;
+
+	usrbuf->sgnum = dma_map_sg_attrs(dev, usrbuf->sgt.sgl, nents, dir, 0);
+	if (!usrbuf->sgnum) {
+		dev_err(dev, "dma_map_sg() error!\n");
+		goto put_pages;
+	}
+	trace_fpga_dma_map(dir, usrbuf->len, usrbuf->pgnum, usrbuf->sgnum);
+	return usrbuf;
+
+put_pages:
+	for (i = 0; i < usrbuf->pgnum; i++)
+		put_page(usrbuf->pages[i]);
+	sg_free_table(&usrbuf->sgt);
+free_pages:
+	kvfree(usrbuf->pages);
+free_usrbuf:
+	kfree(usrbuf);
+	return NULL;
+}
+
+static void put_usr_buf(struct platform_device *dma_dev, usrbuf_t * usrbuf)
+{
+	size_t i;
+
+	trace_fpga_dma_unmap(usrbuf->dir, usrbuf->len, usrbuf->pgnum,
+			     usrbuf->sgnum);
+/* UNMAP_SG:					 !DMA MAP SG */
+	dma_unmap_sg(&dma_dev->dev,
+		     usrbuf->sgt.sgl,
+		     usrbuf->sgt.nents,
+		     usrbuf->dir);
+/* FREE_SGS:					 !SG TABLE */
+	sg_free_table(&usrbuf->sgt);
+/* PUT_PAGES:				   !GET PAGES */
+	for (i = 0; i < usrbuf->pgnum; ++i)
+		put_page(usrbuf->pages[i]);
+/* FREE_PAGES:				!ALLOC PAGES */
+	kvfree(usrbuf->pages);
+/* FREE_USR_BUF:			!ALLOC_USR_BUF */
+	kfree(usrbuf);
+}
+
+/* --------------------------------------------------------------------- */
+
+static void fpga_dma_ubuf_release(struct kref *ref)
+{
+	struct fpga_dma_ubuf *ubuf = container_of(ref, struct fpga_dma_ubuf,
+						  ref);
+
+#ifdef CONFIG_MMU_NOTIFIER
+	if (ubuf->watched)
+		mmu_interval_notifier_remove(&ubuf->notifier);
+#endif
+	put_usr_buf(ubuf->pdata->pdev, ubuf->usrbuf);
+	mmdrop(ubuf->mm);
+	kfree(ubuf);
+}
+
+static void fpga_dma_ubuf_put(struct fpga_dma_ubuf *ubuf)
+{
+	kref_put(&ubuf->ref, fpga_dma_ubuf_release);
+}
+
+#ifdef CONFIG_MMU_NOTIFIER
+/*
+ * Any change of the range's pages leaves ours pinned behind the caller's
+ * back. Write protection alone keeps them, a later COW fault comes here
+ * again as MMU_NOTIFY_CLEAR. Never sleeps, the pages are only unpinned
+ * when the last request using them is retired.
+ */
+static bool fpga_dma_ubuf_invalidate(struct mmu_interval_notifier *mni,
+				     const struct mmu_notifier_range *range,
+				     unsigned long cur_seq)
+{
+	struct fpga_dma_ubuf *ubuf = container_of(mni, struct fpga_dma_ubuf,
+						  notifier);
+
+	mmu_interval_set_seq(mni, cur_seq);
+	if (range->event != MMU_NOTIFY_PROTECTION_VMA &&
+	    range->event != MMU_NOTIFY_PROTECTION_PAGE &&
+	    range->event != MMU_NOTIFY_SOFT_DIRTY)
+		WRITE_ONCE(ubuf->stale, true);
+	return true;
+}
+
+static const struct mmu_interval_notifier_ops fpga_dma_ubuf_mn_ops = {
+	.invalidate = fpga_dma_ubuf_invalidate,
+};
+#endif
+
+/*
+ * Pin and map a user range once, for any number of transfers in @dir;
+ * DMA_TO_DEVICE takes read only memory and leaves shared pages shared.
+ * With @watch the range is watched from before the pinning on, so an
+ * unmap racing with it already marks the buffer stale.
+ */
+static struct fpga_dma_ubuf *fpga_dma_ubuf_pin(struct fpga_dma_pdata *pdata,
+					       struct file *owner,
+					       unsigned long vaddr, size_t len,
+					       enum dma_data_direction dir,
+					       bool watch)
+{
+	struct fpga_dma_ubuf *ubuf;
+	usrbuf_t *usrbuf;
+	int ret;
+
+	ubuf = kzalloc(sizeof(*ubuf), GFP_KERNEL);
+	if (!ubuf)
+		return ERR_PTR(-ENOMEM);
+
+#ifdef CONFIG_MMU_NOTIFIER
+	if (watch) {
+		ret = mmu_interval_notifier_insert(&ubuf->notifier,
+						   current->mm, vaddr, len,
+						   &fpga_dma_ubuf_mn_ops);
+		if (ret) {
+			kfree(ubuf);
+			return ERR_PTR(ret);
+		}
+		ubuf->watched = true;
+	}
+#endif
+	usrbuf = get_usr_buf(pdata->pdev, (const char __user *)vaddr, len,
+			     dir);
+	if (IS_ERR(usrbuf)) {
+		ret = PTR_ERR(usrbuf);
+#ifdef CONFIG_MMU_NOTIFIER
+		if (ubuf->watched)
+			mmu_interval_notifier_remove(&ubuf->notifier);
+#endif
+		kfree(ubuf);
+		return ERR_PTR(ret);
+	}
+	ubuf->usrbuf = usrbuf;
+	kref_init(&ubuf->ref);
+	ubuf->pdata = pdata;
+	ubuf->owner = owner;
+	ubuf->mm = current->mm;
+	mmgrab(ubuf->mm);
+	ubuf->vaddr = vaddr;
+	ubuf->len = len;
+	return ubuf;
+}
+
+/* whether @ubuf was pinned for transfers in @dir */
+static bool fpga_dma_ubuf_dir_ok(struct fpga_dma_ubuf *ubuf,
+				 enum dma_data_direction dir)
+{
+	return ubuf->usrbuf->dir == DMA_BIDIRECTIONAL ||
+	       ubuf->usrbuf->dir == dir;
+}
+
+/* hand the caller's reference to the list; under ubuf_lock */
+static void fpga_dma_ubuf_link(struct fpga_dma_pdata *pdata,
+			       struct fpga_dma_ubuf *ubuf)
+{
+	list_add(&ubuf->node, &pdata->ubufs);
+#ifdef CONFIG_MMU_NOTIFIER
+	if (ubuf->watched) {
+		ubuf->it.start = ubuf->vaddr;
+		ubuf->it.last = ubuf->vaddr + ubuf->len - 1;
+		interval_tree_insert(&ubuf->it, &pdata->ubuf_tree);
+	}
+#endif
+}
+
+/* drop the list's reference, requests in flight keep the buffer alive */
+static void fpga_dma_ubuf_unlink(struct fpga_dma_pdata *pdata,
+				 struct fpga_dma_ubuf *ubuf)
+{
+	list_del(&ubuf->node);
+#ifdef CONFIG_MMU_NOTIFIER
+	if (ubuf->watched)
+		interval_tree_remove(&ubuf->it, &pdata->ubuf_tree);
+#endif
+	if (ubuf->handle)
+		idr_remove(&pdata->ubuf_idr, ubuf->handle);
+	else
+		pdata->ubuf_cached--;
+	fpga_dma_ubuf_put(ubuf);
+}
+
+/*
+ * A reference to registered buffer @handle of @file if it covers
+ * [off, off + len) and was registered for @dir. -EFAULT once its range
+ * was unmapped or remapped.
+ */
+static struct fpga_dma_ubuf *fpga_dma_ubuf_get(struct fpga_dma_pdata *pdata,
+					       struct file *file, u32 handle,
+					       u64 off, size_t len,
+					       enum dma_data_direction dir)
+{
+	struct fpga_dma_ubuf *ubuf;
+
+	mutex_lock(&pdata->ubuf_lock);
+	ubuf = idr_find(&pdata->ubuf_idr, handle);
+	if (!ubuf || ubuf->owner != file || off > ubuf->len ||
+	    len > ubuf->len - off || !fpga_dma_ubuf_dir_ok(ubuf, dir))
+		ubuf = ERR_PTR(-EINVAL);
+	else if (READ_ONCE(ubuf->stale))
+		ubuf = ERR_PTR(-EFAULT);
+	else
+		kref_get(&ubuf->ref);
+	mutex_unlock(&pdata->ubuf_lock);
+	return ubuf;
+}
+
+#ifdef CONFIG_MMU_NOTIFIER
+/*
+ * The registered or cached buffer of the calling process that covers
+ * [vaddr, vaddr + len) for @dir, or NULL. Stale cache entries met on the
+ * way are dropped; under ubuf_lock.
+ */
+static struct fpga_dma_ubuf *fpga_dma_ubuf_find(struct fpga_dma_pdata *pdata,
+						unsigned long vaddr,
+						size_t len,
+						enum dma_data_direction dir)
+{
+	unsigned long last = vaddr + len - 1;
+	struct interval_tree_node *it, *next;
+	struct fpga_dma_ubuf *ubuf;
+
+	for (it = interval_tree_iter_first(&pdata->ubuf_tree, vaddr, last);
+	     it; it = next) {
+		next = interval_tree_iter_next(it, vaddr, last);
+		ubuf = container_of(it, struct fpga_dma_ubuf, it);
+		if (READ_ONCE(ubuf->stale)) {
+			if (!ubuf->handle)
+				fpga_dma_ubuf_unlink(pdata, ubuf);
+			continue;
+		}
+		if (ubuf->mm == current->mm && it->start <= vaddr &&
+		    last <= it->last && fpga_dma_ubuf_dir_ok(ubuf, dir))
+			return ubuf;
+	}
+	return NULL;
+}
+
+/*
+ * Find a registered or cached buffer of the calling process that covers
+ * [vaddr, vaddr + len) for @dir. On a miss the range is pinned and added
+ * to the pin cache, evicting the least recently used entry if it is full.
+ * Returns NULL if nothing matched and the range isn't cached.
+ */
+static struct fpga_dma_ubuf *fpga_dma_ubuf_lookup(struct fpga_dma_pdata *pdata,
+						  struct file *owner,
+						  unsigned long vaddr,
+						  size_t len,
+						  enum dma_data_direction dir)
+{
+	struct fpga_dma_ubuf *ubuf, *victim;
+
+	mutex_lock(&pdata->ubuf_lock);
+	ubuf = fpga_dma_ubuf_find(pdata, vaddr, len, dir);
+	if (ubuf) {
+		list_move(&ubuf->node, &pdata->ubufs);
+		kref_get(&ubuf->ref);
+		goto out_unlock;
+	}
+	if (!pin_cache)
+		goto out_unlock;
+
+	/*
+	 * Cached pinnings serve both directions and need write access; a
+	 * range that can't be pinned for writing, a TX from read only
+	 * memory, is pinned for its request alone.
+	 */
+	ubuf = fpga_dma_ubuf_pin(pdata, owner, vaddr, len, DMA_BIDIRECTIONAL,
+				 true);
+	if (IS_ERR(ubuf)) {
+		ubuf = NULL;
+		goto out_unlock;
+	}
+	fpga_dma_ubuf_link(pdata, ubuf);
+	pdata->ubuf_cached++;
+	kref_get(&ubuf->ref);
+
+	while (pdata->ubuf_cached > pin_cache) {
+		list_for_each_entry_reverse(victim, &pdata->ubufs, node)
+			if (!victim->handle)
+				break;
+		fpga_dma_ubuf_unlink(pdata, victim);
+	}
+
+out_unlock:
+	mutex_unlock(&pdata->ubuf_lock);
+	return ubuf;
+}
+#else
+/* without MMU notifiers an unmap goes unseen, so nothing is found by address */
+static struct fpga_dma_ubuf *fpga_dma_ubuf_lookup(struct fpga_dma_pdata *pdata,
+						  struct file *owner,
+						  unsigned long vaddr,
+						  size_t len,
+						  enum dma_data_direction dir)
+{
+	return NULL;
+}
+#endif
+
+/* forget every buffer registered or cached through @owner */
+static void fpga_dma_ubuf_drop(struct fpga_dma_pdata *pdata,
+			       struct file *owner)
+{
+	struct fpga_dma_ubuf *ubuf, *tmp;
+
+	mutex_lock(&pdata->ubuf_lock);
+	list_for_each_entry_safe(ubuf, tmp, &pdata->ubufs, node)
+		if (!owner || ubuf->owner == owner)
+			fpga_dma_ubuf_unlink(pdata, ubuf);
+	mutex_unlock(&pdata->ubuf_lock);
+}
+
+/*
+ * Describe [off, off + len) of an already mapped scatterlist with a new
+ * one. Only the DMA side of the entries is filled in.
+ */
+static struct scatterlist *fpga_dma_sg_slice(struct scatterlist *sgl,
+					     int nents, size_t off,
+					     size_t len, int *slice_nents)
+{
+	struct scatterlist *sg, *slice, *out;
+	size_t pos, start, end;
+	int i, n = 0;
+
+	pos = 0;
+	for_each_sg(sgl, sg, nents, i) {
+		if (pos >= off + len)
+			break;
+		if (pos + sg_dma_len(sg) > off)
+			n++;
+		pos += sg_dma_len(sg);
+	}
+	if (!n)
+		return NULL;
+
+	slice = kmalloc_array(n, sizeof(*slice), GFP_KERNEL);
+	if (!slice)
+		return NULL;
+	sg_init_table(slice, n);
+
+	out = slice;
+	pos = 0;
+	for_each_sg(sgl, sg, nents, i) {
+		if (pos >= off + len)
+			break;
+		start = max(pos, off);
+		end = min(pos + sg_dma_len(sg), off + len);
+		if (start < end) {
+			sg_dma_address(out) = sg_dma_address(sg) + start - pos;
+			sg_dma_len(out) = end - start;
+			out->length = end - start;
+			out = sg_next(out);
+		}
+		pos += sg_dma_len(sg);
+	}
+	*slice_nents = n;
+	return slice;
+}
+
+static void dump_csr(struct fpga_dma_pdata *pdata)
+{
+	dev_info(&pdata->pdev->dev, "ALT_FPGADMA_CSR_WR_WTRMK      %08x\n",
+		 readl(pdata->csr_reg + ALT_FPGADMA_CSR_WR_WTRMK));
+	dev_info(&pdata->pdev->dev, "ALT_FPGADMA_CSR_RD_WTRMK      %08x\n",
+		 readl(pdata->csr_reg + ALT_FPGADMA_CSR_RD_WTRMK));
+	dev_info(&pdata->pdev->dev, "ALT_FPGADMA_CSR_BURST         %08x\n",
+		 readl(pdata->csr_reg + ALT_FPGADMA_CSR_BURST));
+	dev_info(&pdata->pdev->dev, "ALT_FPGADMA_CSR_FIFO_STATUS   %08x\n",
+		 readl(pdata->csr_reg + ALT_FPGADMA_CSR_FIFO_STATUS));
+	dev_info(&pdata->pdev->dev, "ALT_FPGADMA_CSR_DATA_WIDTH    %08x\n",
+		 readl(pdata->csr_reg + ALT_FPGADMA_CSR_DATA_WIDTH));
+	dev_info(&pdata->pdev->dev, "ALT_FPGADMA_CSR_FIFO_DEPTH    %08x\n",
+		 readl(pdata->csr_reg + ALT_FPGADMA_CSR_FIFO_DEPTH));
+	dev_info(&pdata->pdev->dev, "ALT_FPGADMA_CSR_ZERO          %08x\n",
+		 readl(pdata->csr_reg + ALT_FPGADMA_CSR_ZERO));
+}
+
+/* --------------------------------------------------------------------- */
+
+static void fpga_dma_queue_init(struct fpga_dma_queue *q,
+				struct dma_chan *chan)
+{
+	q->chan = chan;
+	mutex_init(&q->lock);
+	INIT_LIST_HEAD(&q->inflight);
+	q->depth = 0;
+}
+
+/* descriptor segments the request is transferred with */
+static unsigned int fpga_dma_req_nents(struct fpga_dma_req *req)
+{
+	return req->sgs ? req->sgnum : 1;
+}
+
+/*
+ * Requests come from a mempool on top of a slab cache: the reserve keeps
+ * submitters going under memory pressure, and every request carries its
+ * own completion, so concurrent openers never share a wait.
+ */
+static struct fpga_dma_req *__fpga_dma_req_alloc(struct fpga_dma_pdata *pdata,
+						 struct fpga_dma_file *fp,
+						 size_t len, gfp_t gfp)
+{
+	struct fpga_dma_req *req;
+
+	req = mempool_alloc(pdata->req_pool, gfp);
+	if (!req)
+		return NULL;
+	memset(req, 0, sizeof(*req));
+	init_completion(&req->done);
+	req->pdata = pdata;
+	req->fp = fp;
+	req->len = len;
+	return req;
+}
+
+static struct fpga_dma_req *fpga_dma_req_alloc(struct fpga_dma_pdata *pdata,
+					       struct file *file, size_t len)
+{
+	return __fpga_dma_req_alloc(pdata, file->private_data, len, GFP_KERNEL);
+}
+
+/*
+ * Registered buffers stay mapped, so the CPU caches have to be cleaned
+ * before and invalidated after every transfer through them. Only the
+ * request's slice is synced, with the direction the buffer was mapped
+ * with: the rest of the buffer may be in use by the CPU meanwhile, and
+ * invalidating it under a non-coherent CPU would throw away its writes.
+ */
+static void fpga_dma_req_sync(struct fpga_dma_pdata *pdata,
+			      struct fpga_dma_req *req, bool for_cpu)
+{
+	struct device *dev = &pdata->pdev->dev;
+	enum dma_data_direction dir;
+	struct scatterlist *sg;
+	int i;
+
+	if (!req->ubuf)
+		return;
+	dir = req->ubuf->usrbuf->dir;
+	for_each_sg(req->sgs, sg, req->sgnum, i) {
+		if (for_cpu)
+			dma_sync_single_for_cpu(dev, sg_dma_address(sg),
+						sg_dma_len(sg), dir);
+		else
+			dma_sync_single_for_device(dev, sg_dma_address(sg),
+						   sg_dma_len(sg), dir);
+	}
+}
+
+static void fpga_dma_req_free(struct fpga_dma_pdata *pdata,
+			      struct fpga_dma_req *req)
+{
+	if (req->usrbuf)
+		put_usr_buf(pdata->pdev, req->usrbuf);
+	if (req->ubuf) {
+		if (req->dir == DMA_FROM_DEVICE)
+			fpga_dma_req_sync(pdata, req, true);
+		kfree(req->sgs);
+		fpga_dma_ubuf_put(req->ubuf);
+	}
+	if (req->tail)
+		dma_pool_free(pdata->tail_pool, req->tail, req->dma_addr);
+	if (req->pcpu)
+		clear_bit_unlock(req->pslot, &req->pcpu->busy);
+	mempool_free(req, pdata->req_pool);
+}
+
+/* transfer from/to [off, off + len) of a registered buffer */
+static int fpga_dma_req_use_ubuf(struct fpga_dma_pdata *pdata,
+				 struct fpga_dma_req *req,
+				 struct fpga_dma_ubuf *ubuf, size_t off,
+				 enum dma_data_direction dir)
+{
+	req->sgs = fpga_dma_sg_slice(ubuf->usrbuf->sgs, ubuf->usrbuf->sgnum,
+				     off, req->len, &req->sgnum);
+	if (!req->sgs) {
+		fpga_dma_ubuf_put(ubuf);
+		return -ENOMEM;
+	}
+	req->ubuf = ubuf;
+	req->dir = dir;
+	fpga_dma_req_sync(pdata, req, false);
+	return 0;
+}
+
+static unsigned int fpga_dma_size_class(size_t len)
+{
+	if (len < SZ_4K)
+		return 0;
+	if (len < SZ_64K)
+		return 1;
+	if (len < SZ_1M)
+		return 2;
+	return 3;
+}
+
+/* count the time since @start; lock free, any context */
+static void fpga_dma_stat(struct fpga_dma_pdata *pdata, u32 dir, size_t len,
+			  enum fpga_dma_stage stage, ktime_t start)
+{
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	unsigned int b = ns > 0 ? min(fls64(ns), FPGA_DMA_HIST_BUCKETS - 1) : 0;
+
+	this_cpu_inc(pdata->stats->hist[dir][fpga_dma_size_class(len)][stage][b]);
+}
+
+/* bounce_max if it is set, else what probe measured for this instance */
+static int fpga_dma_bounce_max(struct fpga_dma_pdata *pdata)
+{
+	int max = READ_ONCE(bounce_max);
+
+	return max >= 0 ? max : pdata->bounce_max;
+}
+
+/*
+ * Move a small request into a per-CPU slot, copying TX data in right
+ * away. RX data is copied out when the request retires, so only callers
+ * that wait for the request themselves, in their own mm, may pass RX.
+ * Returns -EBUSY when the request is too big or no slot is free.
+ */
+static int fpga_dma_req_bounce(struct fpga_dma_pdata *pdata,
+			       struct fpga_dma_req *req,
+			       const char __user *databuf,
+			       enum dma_data_direction dir)
+{
+	int max = min(fpga_dma_bounce_max(pdata), FPGA_DMA_PCPU_SIZE);
+	struct fpga_dma_pcpu *pc;
+	ktime_t start = ktime_get();
+	unsigned int i;
+
+	if (max <= 0 || req->len > max)
+		return -EBUSY;
+
+	pc = get_cpu_ptr(pdata->pcpu);
+	for (i = 0; i < FPGA_DMA_PCPU_SLOTS; i++)
+		if (!test_and_set_bit_lock(i, &pc->busy))
+			break;
+	put_cpu_ptr(pdata->pcpu);
+	if (i == FPGA_DMA_PCPU_SLOTS)
+		return -EBUSY;
+	req->pcpu = pc;
+	req->pslot = i;
+	req->dma_addr = pc->dma[i];
+	req->dir = dir;
+
+	if (dir == DMA_FROM_DEVICE) {
+		/*
+		 * The CPU read the slot after its last transfer, hand it back
+		 * so no dirty line is written over the incoming data.
+		 */
+		dma_sync_single_for_device(&pdata->pdev->dev, req->dma_addr,
+					   req->len, DMA_BIDIRECTIONAL);
+		req->ucopy = (char __user *)databuf;
+		return 0;
+	}
+	if (copy_from_user(pc->virt[i], databuf, req->len))
+		return -EFAULT;
+	dma_sync_single_for_device(&pdata->pdev->dev, req->dma_addr, req->len,
+				   DMA_BIDIRECTIONAL);
+	fpga_dma_stat(pdata, FPGA_DMA_TX, req->len, FPGA_DMA_STAGE_MAP,
+		      start);
+	return 0;
+}
+
+/*
+ * Map the user buffer the request transfers from/to, reusing a
+ * registered or cached pinning of it if there is one. Small TX requests
+ * are copied instead.
+ */
+static int fpga_dma_req_pin(struct fpga_dma_pdata *pdata,
+			    struct fpga_dma_req *req, struct file *file,
+			    const char __user *databuf,
+			    enum dma_data_direction dir)
+{
+	struct fpga_dma_ubuf *ubuf;
+	ktime_t start;
+	int ret;
+
+	ubuf = fpga_dma_ubuf_lookup(pdata, file, (unsigned long)databuf,
+				    req->len, dir);
+	if (IS_ERR(ubuf))
+		return PTR_ERR(ubuf);
+	if (ubuf)
+		return fpga_dma_req_use_ubuf(pdata, req, ubuf,
+					     (unsigned long)databuf -
+					     ubuf->vaddr, dir);
+
+	if (dir == DMA_TO_DEVICE) {
+		ret = fpga_dma_req_bounce(pdata, req, databuf, dir);
+		if (ret != -EBUSY)
+			return ret;
+	}
+
+	start = ktime_get();
+	req->usrbuf = get_usr_buf(pdata->pdev, databuf, req->len, dir);
+	if (IS_ERR(req->usrbuf)) {
+		ret = PTR_ERR(req->usrbuf);
+		req->usrbuf = NULL;
+		return ret;
+	}
+	fpga_dma_stat(pdata, dir == DMA_FROM_DEVICE ? FPGA_DMA_RX : FPGA_DMA_TX,
+		      req->len, FPGA_DMA_STAGE_MAP, start);
+	req->sgs = req->usrbuf->sgs;
+	req->sgnum = req->usrbuf->sgnum;
+	req->dir = dir;
+	return 0;
+}
+
+static u32 fpga_dma_queue_dir(struct fpga_dma_pdata *pdata,
+			      struct fpga_dma_queue *q)
+{
+	return q == &pdata->rxq ? FPGA_DMA_RX : FPGA_DMA_TX;
+}
+
+/* remember that @cookie of @fp failed, the oldest record makes room */
+static void fpga_dma_file_fail(struct fpga_dma_file *fp, u32 dir,
+			       dma_cookie_t cookie, int error)
+{
+	unsigned int i = fp->failed_next[dir]++ % FPGA_DMA_FAILED;
+
+	fp->failed[dir][i].cookie = cookie;
+	fp->failed[dir][i].error = error;
+}
+
+/* what @cookie of @fp failed with, if it did; the record is dropped */
+static int fpga_dma_file_failed(struct fpga_dma_file *fp, u32 dir,
+				dma_cookie_t cookie)
+{
+	unsigned int i;
+	int error;
+
+	for (i = 0; i < FPGA_DMA_FAILED; i++) {
+		if (fp->failed[dir][i].cookie != cookie)
+			continue;
+		error = fp->failed[dir][i].error;
+		fp->failed[dir][i].cookie = 0;
+		return error;
+	}
+	return 0;
+}
+
+/* take @req off @q, charging @error to whoever submitted it */
+static void fpga_dma_req_retire(struct fpga_dma_pdata *pdata,
+				struct fpga_dma_queue *q,
+				struct fpga_dma_req *req, int error)
+{
+	int *fp_error = req->error;
+	struct kiocb *iocb;
+	ssize_t res;
+
+	if (!fp_error && req->fp)
+		fp_error = &req->fp->error[fpga_dma_queue_dir(pdata, q)];
+
+	trace_fpga_dma_retire(fpga_dma_queue_dir(pdata, q), req->cookie,
+			      req->len, fpga_dma_req_nents(req));
+	list_del(&req->node);
+	q->depth--;
+	/* the slot is shared, whoever polls for EPOLLOUT may take it */
+	wake_up_poll(&pdata->room_wait, EPOLLOUT | EPOLLWRNORM);
+	/* only a successful request is still retired in the reader's mm */
+	if (!error && req->ucopy) {
+		dma_sync_single_for_cpu(&pdata->pdev->dev, req->dma_addr,
+					req->len, DMA_BIDIRECTIONAL);
+		if (copy_to_user(req->ucopy, req->pcpu->virt[req->pslot],
+				 req->len))
+			error = -EFAULT;
+	}
+	if (error && fp_error && !*fp_error)
+		*fp_error = error;
+	/* a transceive reports its own errors, see transceive_wait */
+	if (error && req->fp && !req->error)
+		fpga_dma_file_fail(req->fp, fpga_dma_queue_dir(pdata, q),
+				   req->cookie, error);
+	iocb = req->iocb;
+	res = error ? error : req->iocb_res;
+	fpga_dma_req_free(pdata, req);
+	/* only now the pages are unmapped and the data visible */
+	if (iocb)
+		iocb->ki_complete(iocb, res, 0);
+}
+
+/* retire requests at the head of the queue that have already completed */
+static void fpga_dma_queue_reap(struct fpga_dma_pdata *pdata,
+				struct fpga_dma_queue *q)
+{
+	struct fpga_dma_req *req, *tmp;
+
+	list_for_each_entry_safe(req, tmp, &q->inflight, node) {
+		if (!completion_done(&req->done))
+			break;
+		fpga_dma_req_retire(pdata, q, req, 0);
+	}
+}
+
+/* retire whatever has completed on both queues */
+static void fpga_dma_reap(struct fpga_dma_pdata *pdata)
+{
+	mutex_lock(&pdata->txq.lock);
+	fpga_dma_queue_reap(pdata, &pdata->txq);
+	mutex_unlock(&pdata->txq.lock);
+	mutex_lock(&pdata->rxq.lock);
+	fpga_dma_queue_reap(pdata, &pdata->rxq);
+	mutex_unlock(&pdata->rxq.lock);
+}
+
+/* stop the channel and drop everything still queued on it */
+static void fpga_dma_queue_abort(struct fpga_dma_pdata *pdata,
+				 struct fpga_dma_queue *q, int error)
+{
+	struct fpga_dma_req *req, *tmp;
+
+	/* no callback may run once we start freeing requests */
+	dmaengine_terminate_sync(q->chan);
+	list_for_each_entry_safe(req, tmp, &q->inflight, node)
+		fpga_dma_req_retire(pdata, q, req, error);
+}
+
+/*
+ * Spin for up to poll_us on a request expected to finish soon, which for
+ * short transfers is cheaper than sleeping and being woken up again.
+ * dmaengine marks the cookie complete just before it runs the callback;
+ * the request is only finished once the callback has completed it, so
+ * that is waited for as well.
+ */
+static void fpga_dma_req_poll(struct fpga_dma_queue *q,
+			      struct fpga_dma_req *req)
+{
+	ktime_t end = ktime_add_us(ktime_get(), READ_ONCE(poll_us));
+
+	while (dmaengine_tx_status(q->chan, req->cookie, NULL) !=
+	       DMA_COMPLETE) {
+		if (ktime_after(ktime_get(), end))
+			return;
+		cpu_relax();
+	}
+	while (!completion_done(&req->done) &&
+	       ktime_before(ktime_get(), end))
+		cpu_relax();
+}
+
+/*
+ * Wait for @last (or for the whole queue when @last is NULL), retiring
+ * every request in front of it on the way.
+ */
+static int fpga_dma_queue_wait(struct fpga_dma_pdata *pdata,
+			       struct fpga_dma_queue *q,
+			       struct fpga_dma_req *last)
+{
+	struct fpga_dma_req *req;
+	bool found, waited;
+
+	while (!list_empty(&q->inflight)) {
+		req = list_first_entry(&q->inflight, struct fpga_dma_req, node);
+		found = (req == last);
+		if (req->poll && !completion_done(&req->done))
+			fpga_dma_req_poll(q, req);
+		waited = !completion_done(&req->done);
+		if (!wait_for_completion_timeout(&req->done,
+						 msecs_to_jiffies(timeout))) {
+			dev_err(&pdata->pdev->dev,
+				"Timeout waiting for %s DMA cookie %d!\n",
+				q == &pdata->txq ? "TX" : "RX", req->cookie);
+			fpga_dma_queue_abort(pdata, q, -ETIMEDOUT);
+			return -ETIMEDOUT;
+		}
+		if (waited)
+			fpga_dma_stat(pdata, fpga_dma_queue_dir(pdata, q),
+				      req->len, FPGA_DMA_STAGE_WAKE,
+				      req->completed);
+		fpga_dma_req_retire(pdata, q, req, 0);
+		if (found)
+			break;
+	}
+	return 0;
+}
+
+/*
+ * Requests a queue takes before submitting waits. queue_depth can be
+ * written at any time, everything that tests for room goes through here.
+ */
+static unsigned int fpga_dma_queue_limit(void)
+{
+	return max(READ_ONCE(queue_depth), 1U);
+}
+
+/* slots @reqs requests need at once, a queue_depth below that runs them */
+static unsigned int fpga_dma_queue_room(unsigned int reqs)
+{
+	return min(reqs, fpga_dma_queue_limit());
+}
+
+/*
+ * Make sure there are @reqs free slots before submitting that many
+ * requests, or fail with -EAGAIN if that would mean waiting and @nowait
+ * is set. The caller holds q->lock until they are all queued.
+ */
+static int fpga_dma_queue_make_room(struct fpga_dma_pdata *pdata,
+				    struct fpga_dma_queue *q,
+				    unsigned int reqs, bool nowait)
+{
+	unsigned int depth = fpga_dma_queue_limit() - fpga_dma_queue_room(reqs);
+	struct fpga_dma_req *req;
+	int ret;
+
+	fpga_dma_queue_reap(pdata, q);
+	if (nowait && q->depth > depth)
+		return -EAGAIN;
+	while (q->depth > depth) {
+		req = list_first_entry(&q->inflight, struct fpga_dma_req, node);
+		ret = fpga_dma_queue_wait(pdata, q, req);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Wait for everything @fp queued on @q and report (and clear) its deferred
+ * error, and with it the failed cookies not waited for yet. Other openers'
+ * requests are only waited for if they are ahead. A NULL @fp waits for
+ * the driver's own requests, which have no error slot.
+ */
+static int fpga_dma_queue_flush(struct fpga_dma_pdata *pdata,
+				struct fpga_dma_file *fp,
+				struct fpga_dma_queue *q)
+{
+	u32 dir = fpga_dma_queue_dir(pdata, q);
+	int *error = fp ? &fp->error[dir] : NULL;
+	struct fpga_dma_req *req, *last = NULL;
+	int ret = 0;
+
+	mutex_lock(&q->lock);
+	list_for_each_entry_reverse(req, &q->inflight, node) {
+		if (req->fp == fp) {
+			last = req;
+			break;
+		}
+	}
+	if (last)
+		ret = fpga_dma_queue_wait(pdata, q, last);
+	if (error) {
+		if (!ret)
+			ret = *error;
+		*error = 0;
+		memset(fp->failed[dir], 0, sizeof(fp->failed[dir]));
+	}
+	mutex_unlock(&q->lock);
+	return ret;
+}
+
+/* --------------------------------------------------------------------- */
+
+static unsigned int fpga_dma_burst_words(struct fpga_dma_pdata *pdata)
+{
+	return pdata->burst_words ? : READ_ONCE(max_burst_words);
+}
+
+static void recalc_burst_and_words(struct fpga_dma_pdata *pdata,
+				   unsigned int *burst_size,
+				   unsigned int *num_words)
+{
+	unsigned int burst_words = fpga_dma_burst_words(pdata);
+
+	/* adjust size and maxburst so that total bytes transferred
+	   is a multiple of burst length and width */
+	if (*num_words < burst_words) {
+		/* we have only a few words left, make it our burst size */
+		*burst_size = *num_words;
+	} else {
+		/* here we may not transfer all words to FIFO, but next
+		   call will pick them up... */
+		*num_words = burst_words * (*num_words / burst_words);
+		*burst_size = burst_words;
+	}
+}
+
+static unsigned int word_to_bytes(struct fpga_dma_pdata *pdata,
+				  unsigned int num_bytes)
+{
+	return (num_bytes + pdata->data_width_bytes - 1)
+	    / pdata->data_width_bytes;
+}
+
+/*
+ * Round a transfer to whole words and pick the burst size for it. Longer
+ * transfers are cut to a multiple of the burst, the caller picks up the
+ * rest with the next call.
+ */
+static u32 fpga_dma_calc_burst(struct fpga_dma_pdata *pdata,
+			       unsigned int *len)
+{
+	unsigned int num_words;
+	unsigned int burst_size;
+
+	num_words = word_to_bytes(pdata, *len);
+	recalc_burst_and_words(pdata, &burst_size, &num_words);
+	*len = num_words * pdata->data_width_bytes;
+	return burst_size;
+}
+
+static struct fpga_dma_queue *fpga_dma_queue_of(struct fpga_dma_pdata *pdata,
+						u32 dir)
+{
+	return dir == FPGA_DMA_RX ? &pdata->rxq : &pdata->txq;
+}
+
+static void fpga_dma_req_stamp(u32 dir, struct fpga_dma_req *req)
+{
+	trace_fpga_dma_submit(dir, 0, req->len, fpga_dma_req_nents(req));
+	req->submitted = ktime_get();
+}
+
+/* take q->lock, or only try it for a nowait request */
+static int fpga_dma_queue_lock(struct fpga_dma_queue *q, bool nowait)
+{
+	if (!nowait) {
+		mutex_lock(&q->lock);
+		return 0;
+	}
+	/* somebody may be waiting on the queue for up to timeout */
+	return mutex_trylock(&q->lock) ? 0 : -EAGAIN;
+}
+
+/* hand @req to the channel, q->lock held and room made */
+static int fpga_dma_queue_issue(struct fpga_dma_pdata *pdata, u32 dir,
+				struct fpga_dma_req *req, u32 burst_size)
+{
+	int ret;
+
+	if (dir == FPGA_DMA_RX)
+		ret = fpga_dma_dma_start_rx(pdata->pdev, req, burst_size);
+	else
+		ret = fpga_dma_dma_start_tx(pdata->pdev, req, burst_size);
+	if (ret)
+		dev_err(&pdata->pdev->dev, "Error starting %s DMA %d\n",
+			dir == FPGA_DMA_RX ? "RX" : "TX", ret);
+	return ret;
+}
+
+/*
+ * Queue @req on its channel, optionally waiting for it to complete. @req
+ * belongs to the queue afterwards, its cookie is returned in @cookie.
+ */
+static int fpga_dma_queue_start(struct fpga_dma_pdata *pdata, u32 dir,
+				struct fpga_dma_req *req, u32 burst_size,
+				bool wait, dma_cookie_t *cookie)
+{
+	struct fpga_dma_queue *q = fpga_dma_queue_of(pdata, dir);
+	int ret;
+
+	fpga_dma_req_stamp(dir, req);
+	ret = fpga_dma_queue_lock(q, req->nowait);
+	if (ret) {
+		fpga_dma_req_free(pdata, req);
+		return ret;
+	}
+	if (dir == FPGA_DMA_RX && pdata->ring) {
+		ret = -EBUSY;
+		goto out_unlock;
+	}
+	ret = fpga_dma_queue_make_room(pdata, q, 1, req->nowait);
+	if (ret)
+		goto out_unlock;
+	ret = fpga_dma_queue_issue(pdata, dir, req, burst_size);
+	if (ret)
+		goto out_unlock;
+
+	if (cookie)
+		*cookie = req->cookie;
+	if (wait)
+		ret = fpga_dma_queue_wait(pdata, q, req);
+	mutex_unlock(&q->lock);
+	return ret;
+
+out_unlock:
+	mutex_unlock(&q->lock);
+	fpga_dma_req_free(pdata, req);
+	return ret;
+}
+
+static struct fpga_dma_pdata *fpga_dma_pdata_of(struct file *file)
+{
+	struct fpga_dma_file *fp = file->private_data;
+
+	return fp->pdata;
+}
+
+static u32 fpga_dma_engine_of(struct file *file)
+{
+	struct fpga_dma_file *fp = file->private_data;
+
+	return READ_ONCE(fp->engine);
+}
+
+/*
+ * Bounce engine: move at most one FIFO worth through the driver's kernel
+ * buffers, one transfer at a time. Nothing is pinned, but every call
+ * costs a copy and waits for its transfer.
+ */
+static ssize_t fpga_dma_bounce_write(struct fpga_dma_pdata *pdata,
+				     struct file *file,
+				     const char __user *user_buf,
+				     size_t count)
+{
+	struct device *dev = &pdata->pdev->dev;
+	struct fpga_dma_req *req;
+	unsigned int len, copy;
+	u32 burst_size;
+	int ret;
+
+	copy = min_t(size_t, count, pdata->fifo_size_bytes);
+	len = copy;
+	burst_size = fpga_dma_calc_burst(pdata, &len);
+	if (!len)
+		return -EINVAL;
+	copy = min(copy, len);
+
+	req = fpga_dma_req_alloc(pdata, file, len);
+	if (!req)
+		return -ENOMEM;
+	req->dma_addr = pdata->write_buf_dma;
+
+	mutex_lock(&pdata->bounce_lock);
+	if (copy_from_user(pdata->write_buf, user_buf, copy)) {
+		mutex_unlock(&pdata->bounce_lock);
+		fpga_dma_req_free(pdata, req);
+		return -EFAULT;
+	}
+	/* a partial last word goes out padded with zeros */
+	memset(pdata->write_buf + copy, 0, len - copy);
+	dma_sync_single_for_device(dev, pdata->write_buf_dma, len,
+				   DMA_TO_DEVICE);
+	ret = fpga_dma_queue_start(pdata, FPGA_DMA_TX, req, burst_size, true,
+				   NULL);
+	mutex_unlock(&pdata->bounce_lock);
+
+	return ret ? ret : copy;
+}
+
+static ssize_t fpga_dma_bounce_read(struct fpga_dma_pdata *pdata,
+				    struct file *file, char __user *user_buf,
+				    size_t count)
+{
+	struct device *dev = &pdata->pdev->dev;
+	struct fpga_dma_req *req;
+	unsigned int len, copy;
+	u32 burst_size;
+	int ret;
+
+	len = min_t(size_t, count, pdata->fifo_size_bytes);
+	burst_size = fpga_dma_calc_burst(pdata, &len);
+	if (!len)
+		return -EINVAL;
+	copy = min_t(size_t, len, count);
+
+	req = fpga_dma_req_alloc(pdata, file, len);
+	if (!req)
+		return -ENOMEM;
+	req->dma_addr = pdata->read_buf_dma;
+
+	mutex_lock(&pdata->bounce_lock);
+	ret = fpga_dma_queue_start(pdata, FPGA_DMA_RX, req, burst_size, true,
+				   NULL);
+	if (!ret) {
+		dma_sync_single_for_cpu(dev, pdata->read_buf_dma, len,
+					DMA_FROM_DEVICE);
+		if (copy_to_user(user_buf, pdata->read_buf, copy))
+			ret = -EFAULT;
+	}
+	mutex_unlock(&pdata->bounce_lock);
+
+	return ret ? ret : copy;
+}
+
+/*
+ * The sub-burst tail of a write, or a short SUBMIT ending in a partial word,
+ * @tail bytes, goes from a block of the tail pool with the rest of its last
+ * word zeroed. The caller copies the data in.
+ */
+static struct fpga_dma_req *fpga_dma_tail_req(struct fpga_dma_pdata *pdata,
+					      struct file *file,
+					      unsigned int tail,
+					      u32 *burst_size, gfp_t gfp)
+{
+	unsigned int len = round_up(tail, pdata->data_width_bytes);
+	struct fpga_dma_req *req;
+
+	if (len > pdata->fifo_size_bytes)
+		return ERR_PTR(-EINVAL);
+	*burst_size = fpga_dma_calc_burst(pdata, &len);
+	req = __fpga_dma_req_alloc(pdata, file->private_data, len, gfp);
+	if (!req)
+		return ERR_PTR(-ENOMEM);
+	req->tail = dma_pool_alloc(pdata->tail_pool, gfp, &req->dma_addr);
+	if (!req->tail) {
+		fpga_dma_req_free(pdata, req);
+		return ERR_PTR(-ENOMEM);
+	}
+	memset(req->tail + tail, 0, len - tail);
+	return req;
+}
+
+/*
+ * Queue the bulk and the tail of a write, either may be NULL. Room for
+ * both is made under one hold of the queue lock, so a nowait write goes
+ * out whole or fails with -EAGAIN before anything is queued. @iocb, if
+ * any, is completed when the last of them retires.
+ */
+static int fpga_dma_write_start(struct fpga_dma_pdata *pdata,
+				struct fpga_dma_req *req, u32 burst_size,
+				struct fpga_dma_req *tailreq, u32 tail_burst,
+				bool wait, struct kiocb *iocb, ssize_t count)
+{
+	struct fpga_dma_queue *q = &pdata->txq;
+	struct fpga_dma_req *last = tailreq ? tailreq : req;
+	int ret;
+
+	last->iocb = iocb;
+	last->iocb_res = count;
+	if (req)
+		fpga_dma_req_stamp(FPGA_DMA_TX, req);
+	if (tailreq)
+		fpga_dma_req_stamp(FPGA_DMA_TX, tailreq);
+	ret = fpga_dma_queue_lock(q, last->nowait);
+	if (ret)
+		goto out_free;
+	ret = fpga_dma_queue_make_room(pdata, q, !!req + !!tailreq,
+				       last->nowait);
+	if (ret)
+		goto out_unlock;
+	if (req) {
+		ret = fpga_dma_queue_issue(pdata, FPGA_DMA_TX, req, burst_size);
+		if (ret)
+			goto out_unlock;
+		req = NULL;
+	}
+	if (tailreq) {
+		ret = fpga_dma_queue_issue(pdata, FPGA_DMA_TX, tailreq,
+					   tail_burst);
+		if (ret)
+			goto out_unlock;
+	}
+
+	/* the channel runs in order, waiting for the last one is enough */
+	if (wait)
+		ret = fpga_dma_queue_wait(pdata, q, last);
+	/* O_NONBLOCK callers pick up the result with fsync() */
+	mutex_unlock(&q->lock);
+	return ret;
+
+out_unlock:
+	mutex_unlock(&q->lock);
+out_free:
+	if (req)
+		fpga_dma_req_free(pdata, req);
+	if (tailreq)
+		fpga_dma_req_free(pdata, tailreq);
+	return ret;
+}
+
+/* bytes of a write of @count that go as whole bursts */
+static unsigned int fpga_dma_write_bulk(struct fpga_dma_pdata *pdata,
+					unsigned int count, u32 *burst_size)
+{
+	unsigned int burst_bytes, bulk;
+
+	burst_bytes = fpga_dma_burst_words(pdata) * pdata->data_width_bytes;
+	if (!burst_bytes)
+		return 0;
+	bulk = count - count % burst_bytes;
+	if (bulk)
+		*burst_size = fpga_dma_calc_burst(pdata, &bulk);
+	return bulk;
+}
+
+static ssize_t fpga_dma_write(struct file *file, const char __user *user_buf,
+			      size_t count, loff_t *ppos)
+{
+	struct fpga_dma_pdata *pdata = fpga_dma_pdata_of(file);
+	struct fpga_dma_req *req = NULL, *tailreq = NULL;
+	unsigned int bulk, tail;
+	u32 burst_size = 0, tail_burst = 0;
+	int ret;
+
+	if (fpga_dma_engine_of(file) == FPGA_DMA_ENGINE_BOUNCE)
+		return fpga_dma_bounce_write(pdata, file, user_buf, count);
+
+	/*
+	 * Whole bursts go straight from the user pages, only the rest is
+	 * copied, so nothing outside the caller's buffer is pinned or read.
+	 */
+	count = min_t(size_t, count, INT_MAX);
+	if (!count)
+		return 0;
+	bulk = fpga_dma_write_bulk(pdata, count, &burst_size);
+	tail = count - bulk;
+
+	if (tail) {
+		tailreq = fpga_dma_tail_req(pdata, file, tail, &tail_burst,
+					    GFP_KERNEL);
+		if (IS_ERR(tailreq))
+			return PTR_ERR(tailreq);
+		if (copy_from_user(tailreq->tail, user_buf + bulk, tail)) {
+			ret = -EFAULT;
+			goto err_tail;
+		}
+	}
+
+	if (bulk) {
+		req = fpga_dma_req_alloc(pdata, file, bulk);
+		if (!req) {
+			ret = -ENOMEM;
+			goto err_tail;
+		}
+		ret = fpga_dma_req_pin(pdata, req, file, user_buf,
+				       DMA_TO_DEVICE);
+		if (ret) {
+			fpga_dma_req_free(pdata, req);
+			goto err_tail;
+		}
+	}
+
+	ret = fpga_dma_write_start(pdata, req, burst_size, tailreq,
+				   tail_burst, !(file->f_flags & O_NONBLOCK),
+				   NULL, count);
+	return ret ? ret : count;
+
+err_tail:
+	if (tailreq)
+		fpga_dma_req_free(pdata, tailreq);
+	return ret;
+}
+
+static ssize_t fpga_dma_read(struct file *file, char __user *user_buf,
+			     size_t count, loff_t *ppos)
+{
+	struct fpga_dma_pdata *pdata = fpga_dma_pdata_of(file);
+	struct fpga_dma_req *req;
+	unsigned int num_bytes;
+	u32 burst_size;
+	int ret;
+
+	if (fpga_dma_engine_of(file) == FPGA_DMA_ENGINE_BOUNCE)
+		return fpga_dma_bounce_read(pdata, file, user_buf, count);
+
+	/* never round up, the device would write past the user buffer */
+	num_bytes = min_t(size_t, count, INT_MAX);
+	num_bytes -= num_bytes % pdata->data_width_bytes;
+	burst_size = fpga_dma_calc_burst(pdata, &num_bytes);
+	if (num_bytes > 0) {
+		req = fpga_dma_req_alloc(pdata, file, num_bytes);
+		if (!req)
+			return -ENOMEM;
+		/* a blocking read retires its own request, see req_bounce */
+		ret = -EBUSY;
+		if (!(file->f_flags & O_NONBLOCK))
+			ret = fpga_dma_req_bounce(pdata, req, user_buf,
+						  DMA_FROM_DEVICE);
+		if (ret == -EBUSY)
+			ret = fpga_dma_req_pin(pdata, req, file, user_buf,
+					       DMA_FROM_DEVICE);
+		if (ret) {
+			fpga_dma_req_free(pdata, req);
+			return ret;
+		}
+
+		ret = fpga_dma_queue_start(pdata, FPGA_DMA_RX, req,
+					   burst_size,
+					   !(file->f_flags & O_NONBLOCK), NULL);
+		if (ret)
+			return ret;
+	}
+	/* what the device actually writes, a multiple of whole bursts */
+	return num_bytes;
+}
+
+static int fpga_dma_req_pin_iter(struct fpga_dma_pdata *pdata,
+				 struct fpga_dma_req *req,
+				 struct iov_iter *iter,
+				 enum dma_data_direction dir)
+{
+	ktime_t start = ktime_get();
+
+	req->usrbuf = get_iter_buf(pdata->pdev, iter, dir, req->nowait);
+	/* a blocking retry sorts out whether the pages are really bad */
+	if (!req->usrbuf)
+		return req->nowait ? -EAGAIN : -EFAULT;
+	fpga_dma_stat(pdata, dir == DMA_FROM_DEVICE ? FPGA_DMA_RX : FPGA_DMA_TX,
+		      req->len, FPGA_DMA_STAGE_MAP, start);
+	req->sgs = req->usrbuf->sgs;
+	req->sgnum = req->usrbuf->sgnum;
+	req->dir = dir;
+	return 0;
+}
+
+/*
+ * IOCB_NOWAIT: don't even pin if @reqs more would have to wait. This is
+ * only a hint, make_room checks again under the queue lock.
+ */
+static bool fpga_dma_iocb_would_block(struct kiocb *iocb,
+				      struct fpga_dma_queue *q,
+				      unsigned int reqs)
+{
+	if (!(iocb->ki_flags & IOCB_NOWAIT))
+		return false;
+	return READ_ONCE(q->depth) + fpga_dma_queue_room(reqs) >
+	       fpga_dma_queue_limit();
+}
+
+/*
+ * A request for @iocb. IOCB_NOWAIT ones neither sleep for memory here nor
+ * for pages or queue room later; -ENOMEM becomes -EAGAIN for them, the
+ * blocking retry may well get the memory.
+ */
+static struct fpga_dma_req *fpga_dma_iocb_req(struct fpga_dma_pdata *pdata,
+					      struct kiocb *iocb, size_t len)
+{
+	bool nowait = iocb->ki_flags & IOCB_NOWAIT;
+	struct fpga_dma_req *req;
+
+	req = __fpga_dma_req_alloc(pdata, iocb->ki_filp->private_data, len,
+				   nowait ? GFP_NOWAIT : GFP_KERNEL);
+	if (!req)
+		return ERR_PTR(nowait ? -EAGAIN : -ENOMEM);
+	req->nowait = nowait;
+	return req;
+}
+
+/*
+ * Vectored and asynchronous I/O (readv/writev, aio, io_uring) always
+ * pins, whatever engine read()/write() use. An async kiocb returns at
+ * once and is completed when its request retires, from the reap worker
+ * if nobody else gets there first.
+ */
+static ssize_t fpga_dma_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file *file = iocb->ki_filp;
+	struct fpga_dma_pdata *pdata = fpga_dma_pdata_of(file);
+	struct fpga_dma_req *req = NULL, *tailreq = NULL;
+	bool nowait = iocb->ki_flags & IOCB_NOWAIT;
+	bool async = !is_sync_kiocb(iocb);
+	unsigned int bulk, tail, count;
+	u32 burst_size = 0, tail_burst = 0;
+	struct iov_iter bulk_iter, tail_iter;
+	size_t copied;
+	int ret;
+
+	count = min_t(size_t, iov_iter_count(from), INT_MAX);
+	if (!count)
+		return 0;
+	bulk = fpga_dma_write_bulk(pdata, count, &burst_size);
+	tail = count - bulk;
+	if (fpga_dma_iocb_would_block(iocb, &pdata->txq, !!bulk + !!tail))
+		return -EAGAIN;
+
+	/* @from is only consumed once the write is about to be queued */
+	bulk_iter = *from;
+	iov_iter_truncate(&bulk_iter, bulk);
+	tail_iter = *from;
+	iov_iter_advance(&tail_iter, bulk);
+	if (tail) {
+		tailreq = fpga_dma_tail_req(pdata, file, tail, &tail_burst,
+					    nowait ? GFP_NOWAIT : GFP_KERNEL);
+		if (IS_ERR(tailreq)) {
+			ret = PTR_ERR(tailreq);
+			return nowait && ret == -ENOMEM ? -EAGAIN : ret;
+		}
+		tailreq->nowait = nowait;
+		/* nowait takes the tail only if it is mapped, as the bulk */
+		if (nowait)
+			pagefault_disable();
+		copied = copy_from_iter(tailreq->tail, tail, &tail_iter);
+		if (nowait)
+			pagefault_enable();
+		if (copied != tail) {
+			ret = nowait ? -EAGAIN : -EFAULT;
+			goto err_tail;
+		}
+	}
+
+	if (bulk) {
+		req = fpga_dma_iocb_req(pdata, iocb, bulk);
+		if (IS_ERR(req)) {
+			ret = PTR_ERR(req);
+			req = NULL;
+			goto err_tail;
+		}
+		ret = fpga_dma_req_pin_iter(pdata, req, &bulk_iter,
+					    DMA_TO_DEVICE);
+		if (ret) {
+			fpga_dma_req_free(pdata, req);
+			goto err_tail;
+		}
+	}
+
+	/* an async iocb, and @from with it, may be gone once queued */
+	iov_iter_advance(from, count);
+	ret = fpga_dma_write_start(pdata, req, burst_size, tailreq,
+				   tail_burst,
+				   !async && !(file->f_flags & O_NONBLOCK),
+				   async ? iocb : NULL, count);
+	if (ret) {
+		iov_iter_revert(from, count);
+		return ret;
+	}
+	return async ? -EIOCBQUEUED : count;
+
+err_tail:
+	if (tailreq)
+		fpga_dma_req_free(pdata, tailreq);
+	return ret;
+}
+
+static ssize_t fpga_dma_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file *file = iocb->ki_filp;
+	struct fpga_dma_pdata *pdata = fpga_dma_pdata_of(file);
+	bool async = !is_sync_kiocb(iocb);
+	struct fpga_dma_req *req;
+	unsigned int len;
+	u32 burst_size;
+	int ret;
+
+	/* never round up, the device would write past the user buffer */
+	len = min_t(size_t, iov_iter_count(to), INT_MAX);
+	len -= len % pdata->data_width_bytes;
+	burst_size = fpga_dma_calc_burst(pdata, &len);
+	if (!len)
+		return 0;
+	if (fpga_dma_iocb_would_block(iocb, &pdata->rxq, 1))
+		return -EAGAIN;
+	iov_iter_truncate(to, len);
+
+	req = fpga_dma_iocb_req(pdata, iocb, len);
+	if (IS_ERR(req))
+		return PTR_ERR(req);
+	ret = fpga_dma_req_pin_iter(pdata, req, to, DMA_FROM_DEVICE);
+	if (ret) {
+		fpga_dma_req_free(pdata, req);
+		return ret;
+	}
+	if (async) {
+		req->iocb = iocb;
+		req->iocb_res = len;
+	}
+
+	ret = fpga_dma_queue_start(pdata, FPGA_DMA_RX, req, burst_size,
+				   !async && !(file->f_flags & O_NONBLOCK),
+				   NULL);
+	if (ret)
+		return ret;
+	return async ? -EIOCBQUEUED : len;
+}
+
+static int fpga_dma_fsync(struct file *file, loff_t start, loff_t end,
+			  int datasync)
+{
+	struct fpga_dma_pdata *pdata = fpga_dma_pdata_of(file);
+	int tx_ret, rx_ret;
+
+	tx_ret = fpga_dma_queue_flush(pdata, file->private_data, &pdata->txq);
+	rx_ret = fpga_dma_queue_flush(pdata, file->private_data, &pdata->rxq);
+	return tx_ret ? tx_ret : rx_ret;
+}
+
+/* a TX from user memory ending in a partial word, sent from the tail pool */
+static struct fpga_dma_req *fpga_dma_xfer_tail_req(struct file *file,
+						   struct fpga_dma_pdata *pdata,
+						   struct fpga_dma_xfer *xfer,
+						   u32 *burst_size)
+{
+	struct fpga_dma_req *req;
+
+	req = fpga_dma_tail_req(pdata, file, xfer->len, burst_size, GFP_KERNEL);
+	if (IS_ERR(req))
+		return req;
+	req->poll = !!(xfer->flags & FPGA_DMA_XFER_POLL);
+	if (copy_from_user(req->tail, u64_to_user_ptr(xfer->addr),
+			   xfer->len)) {
+		fpga_dma_req_free(pdata, req);
+		return ERR_PTR(-EFAULT);
+	}
+	return req;
+}
+
+/*
+ * Build the request for one struct fpga_dma_xfer. xfer->len is rounded to
+ * what will actually be transferred: down to whole words for RX to user
+ * memory, as read() does, since rounding up would make the device write
+ * past the caller's buffer. A TX from user memory that ends in a partial
+ * word is copied to the tail pool like the tail of write(), so all of it
+ * is sent; one too long for that is refused rather than cut short.
+ */
+static struct fpga_dma_req *fpga_dma_xfer_req(struct file *file,
+					      struct fpga_dma_pdata *pdata,
+					      struct fpga_dma_xfer *xfer,
+					      u32 *burst_size)
+{
+	struct fpga_dma_req *req;
+	struct fpga_dma_ubuf *ubuf;
+	enum dma_data_direction dir;
+	unsigned int len;
+	int ret;
+
+	if (xfer->dir != FPGA_DMA_TX && xfer->dir != FPGA_DMA_RX)
+		return ERR_PTR(-EINVAL);
+	if (xfer->flags & ~FPGA_DMA_XFER_FLAGS)
+		return ERR_PTR(-EINVAL);
+	/* as read()/write(), the burst and length arithmetic stays in range */
+	if (xfer->len > INT_MAX)
+		return ERR_PTR(-EINVAL);
+	dir = xfer->dir == FPGA_DMA_RX ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
+
+	len = xfer->len;
+	if (!(xfer->flags & FPGA_DMA_XFER_DRVBUF) &&
+	    len % pdata->data_width_bytes) {
+		if (dir == DMA_FROM_DEVICE)
+			len -= len % pdata->data_width_bytes;
+		else if (xfer->flags & FPGA_DMA_XFER_REGBUF)
+			return ERR_PTR(-EINVAL);
+		else
+			return fpga_dma_xfer_tail_req(file, pdata, xfer,
+						      burst_size);
+	}
+	*burst_size = fpga_dma_calc_burst(pdata, &len);
+	if (!len)
+		return ERR_PTR(-EINVAL);
+	xfer->len = len;
+
+	req = fpga_dma_req_alloc(pdata, file, len);
+	if (!req)
+		return ERR_PTR(-ENOMEM);
+	req->poll = !!(xfer->flags & FPGA_DMA_XFER_POLL);
+
+	if (xfer->flags & FPGA_DMA_XFER_DRVBUF) {
+		if (xfer->handle >= pdata->pool_bufs ||
+		    xfer->addr > pdata->buf_size ||
+		    len > pdata->buf_size - xfer->addr) {
+			ret = -EINVAL;
+			goto err;
+		}
+		req->dma_addr = pdata->pool[xfer->handle].dma + xfer->addr;
+	} else if (xfer->flags & FPGA_DMA_XFER_REGBUF) {
+		ubuf = fpga_dma_ubuf_get(pdata, file, xfer->handle, xfer->addr,
+					 len, dir);
+		ret = IS_ERR(ubuf) ? PTR_ERR(ubuf) :
+		      fpga_dma_req_use_ubuf(pdata, req, ubuf, xfer->addr, dir);
+		if (ret)
+			goto err;
+	} else {
+		ret = fpga_dma_req_pin(pdata, req, file,
+				       u64_to_user_ptr(xfer->addr), dir);
+		if (ret)
+			goto err;
+	}
+	return req;
+
+err:
+	fpga_dma_req_free(pdata, req);
+	return ERR_PTR(ret);
+}
+
+static int fpga_dma_ioctl_submit(struct file *file,
+				 struct fpga_dma_pdata *pdata,
+				 struct fpga_dma_xfer __user *argp)
+{
+	struct fpga_dma_xfer xfer;
+	struct fpga_dma_req *req;
+	dma_cookie_t cookie;
+	u32 burst_size;
+	int ret;
+
+	if (copy_from_user(&xfer, argp, sizeof(xfer)))
+		return -EFAULT;
+
+	req = fpga_dma_xfer_req(file, pdata, &xfer, &burst_size);
+	if (IS_ERR(req))
+		return PTR_ERR(req);
+
+	ret = fpga_dma_queue_start(pdata, xfer.dir, req, burst_size, false,
+				   &cookie);
+	if (ret)
+		return ret;
+
+	xfer.cookie = cookie;
+	if (copy_to_user(argp, &xfer, sizeof(xfer)))
+		return -EFAULT;
+	return 0;
+}
+
+static int fpga_dma_ioctl_submit_batch(struct file *file,
+				       struct fpga_dma_pdata *pdata,
+				       struct fpga_dma_batch __user *argp)
+{
+	struct fpga_dma_xfer __user *xfers;
+	struct fpga_dma_batch batch;
+	u32 i;
+	int ret = 0;
+
+	if (copy_from_user(&batch, argp, sizeof(batch)))
+		return -EFAULT;
+	xfers = u64_to_user_ptr(batch.xfers);
+
+	for (i = 0; i < batch.count; i++) {
+		/* a full queue blocks in between, let a kill through */
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+		ret = fpga_dma_ioctl_submit(file, pdata, xfers + i);
+		if (ret)
+			break;
+	}
+	if (put_user(i, &argp->queued))
+		return -EFAULT;
+	return i ? i : ret;
+}
+
+/* wait for @cookie if it is still queued on @q, q->lock held */
+static int fpga_dma_queue_wait_cookie(struct fpga_dma_pdata *pdata,
+				      struct fpga_dma_queue *q,
+				      dma_cookie_t cookie)
+{
+	struct fpga_dma_req *req;
+
+	/* a cookie that is no longer queued has already completed */
+	list_for_each_entry(req, &q->inflight, node) {
+		if (req->cookie == cookie)
+			return fpga_dma_queue_wait(pdata, q, req);
+	}
+	return 0;
+}
+
+/*
+ * Wait for @cookie and report only its own failure, or for everything @fp
+ * queued in @dir and its deferred error if it is 0.
+ */
+static int fpga_dma_wait_cookie(struct fpga_dma_pdata *pdata,
+				struct fpga_dma_file *fp, u32 dir,
+				dma_cookie_t cookie)
+{
+	struct fpga_dma_queue *q = fpga_dma_queue_of(pdata, dir);
+	int ret, error;
+
+	if (!cookie)
+		return fpga_dma_queue_flush(pdata, fp, q);
+
+	mutex_lock(&q->lock);
+	ret = fpga_dma_queue_wait_cookie(pdata, q, cookie);
+	error = fpga_dma_file_failed(fp, dir, cookie);
+	mutex_unlock(&q->lock);
+	return ret ? ret : error;
+}
+
+static int fpga_dma_ioctl_wait(struct file *file,
+			       struct fpga_dma_pdata *pdata,
+			       struct fpga_dma_wait __user *argp)
+{
+	struct fpga_dma_wait wait;
+
+	if (copy_from_user(&wait, argp, sizeof(wait)))
+		return -EFAULT;
+	if (wait.dir != FPGA_DMA_TX && wait.dir != FPGA_DMA_RX)
+		return -EINVAL;
+
+	return fpga_dma_wait_cookie(pdata, file->private_data, wait.dir,
+				    wait.cookie);
+}
+
+/* move the cursor @len bytes on */
+static void fpga_dma_chain_skip(struct fpga_dma_chain *ch, size_t len)
+{
+	size_t n;
+
+	while (len && ch->sg) {
+		n = min_t(size_t, sg_dma_len(ch->sg) - ch->skip, len);
+		ch->skip += n;
+		len -= n;
+		if (ch->skip == sg_dma_len(ch->sg)) {
+			ch->sg = sg_next(ch->sg);
+			ch->nents--;
+			ch->skip = 0;
+		}
+	}
+}
+
+static int fpga_dma_chain_init(struct file *file, struct fpga_dma_pdata *pdata,
+			       struct fpga_dma_chain *ch,
+			       struct fpga_dma_xfer *xfer, size_t len)
+{
+	struct fpga_dma_ubuf *ubuf;
+	size_t off = 0;
+
+	memset(ch, 0, sizeof(*ch));
+	ch->dir = xfer->dir == FPGA_DMA_RX ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
+	if (xfer->flags & ~FPGA_DMA_XFER_FLAGS)
+		return -EINVAL;
+	ch->poll = !!(xfer->flags & FPGA_DMA_XFER_POLL);
+
+	if (xfer->flags & FPGA_DMA_XFER_DRVBUF) {
+		if (xfer->handle >= pdata->pool_bufs ||
+		    xfer->addr > pdata->buf_size ||
+		    len > pdata->buf_size - xfer->addr)
+			return -EINVAL;
+		ch->dma = pdata->pool[xfer->handle].dma + xfer->addr;
+		return 0;
+	}
+
+	if (xfer->flags & FPGA_DMA_XFER_REGBUF) {
+		ubuf = fpga_dma_ubuf_get(pdata, file, xfer->handle, xfer->addr,
+					 len, ch->dir);
+		off = xfer->addr;
+	} else {
+		/* pinned once for the whole chain, for its side only */
+		ubuf = fpga_dma_ubuf_pin(pdata, file, xfer->addr, len,
+					 ch->dir, false);
+	}
+	if (IS_ERR(ubuf))
+		return PTR_ERR(ubuf);
+	ch->ubuf = ubuf;
+	ch->sg = ubuf->usrbuf->sgs;
+	ch->nents = ubuf->usrbuf->sgnum;
+	fpga_dma_chain_skip(ch, off);
+	return 0;
+}
+
+static void fpga_dma_chain_put(struct fpga_dma_chain *ch)
+{
+	if (ch->ubuf)
+		fpga_dma_ubuf_put(ch->ubuf);
+}
+
+/* queue the next @len bytes of @ch without waiting, errors go to @error */
+static int fpga_dma_chain_start(struct fpga_dma_pdata *pdata,
+				struct file *file, struct fpga_dma_chain *ch,
+				u32 dir, size_t len, u32 burst_size,
+				dma_cookie_t *cookie, int *error)
+{
+	struct fpga_dma_req *req;
+
+	req = fpga_dma_req_alloc(pdata, file, len);
+	if (!req)
+		return -ENOMEM;
+	req->error = error;
+	req->dir = ch->dir;
+	req->poll = ch->poll;
+	if (ch->ubuf) {
+		req->sgs = fpga_dma_sg_slice(ch->sg, ch->nents, ch->skip, len,
+					     &req->sgnum);
+		if (!req->sgs) {
+			fpga_dma_req_free(pdata, req);
+			return -ENOMEM;
+		}
+		kref_get(&ch->ubuf->ref);
+		req->ubuf = ch->ubuf;
+		fpga_dma_req_sync(pdata, req, false);
+		fpga_dma_chain_skip(ch, len);
+	} else {
+		req->dma_addr = ch->dma;
+		ch->dma += len;
+	}
+	return fpga_dma_queue_start(pdata, dir, req, burst_size, false,
+				    cookie);
+}
+
+/*
+ * Wait for the last request a transceive queued in @dir, and with it for
+ * all of its earlier ones, and report the errors they were charged in
+ * @error. Requests of other submitters only hold it up if they are ahead.
+ */
+static int fpga_dma_transceive_wait(struct fpga_dma_pdata *pdata, u32 dir,
+				    dma_cookie_t cookie, int *error)
+{
+	struct fpga_dma_queue *q = fpga_dma_queue_of(pdata, dir);
+	int ret;
+
+	mutex_lock(&q->lock);
+	ret = fpga_dma_queue_wait_cookie(pdata, q, cookie);
+	mutex_unlock(&q->lock);
+	return ret ? ret : *error;
+}
+
+/*
+ * Take back @cookie, an RX queued for a transceive whose TX could not be
+ * started: it would sit there until it timed out, or take data meant for
+ * somebody else's read. The channel runs in order, so what is ahead of it
+ * is waited for, and if it is still pending the channel is stopped, which
+ * fails whatever was queued behind it since with @error as well.
+ */
+static void fpga_dma_queue_cancel(struct fpga_dma_pdata *pdata,
+				  struct fpga_dma_queue *q,
+				  dma_cookie_t cookie, int error)
+{
+	struct fpga_dma_req *req;
+	int ret = 0;
+
+	mutex_lock(&q->lock);
+	list_for_each_entry(req, &q->inflight, node) {
+		if (req->cookie != cookie)
+			continue;
+		if (!list_is_first(&req->node, &q->inflight))
+			ret = fpga_dma_queue_wait(pdata, q,
+						  list_prev_entry(req, node));
+		/* a timeout on the way has aborted the queue already */
+		if (ret)
+			break;
+		if (completion_done(&req->done))
+			fpga_dma_queue_wait(pdata, q, req);
+		else
+			fpga_dma_queue_abort(pdata, q, error);
+		break;
+	}
+	mutex_unlock(&q->lock);
+}
+
+/*
+ * A transceive larger than the FIFO is cut into FIFO sized RX/TX pairs,
+ * so no TX burst can ever need more room than the loopback FIFO has,
+ * and the pairs are queued back to back. The queue depth bounds how far
+ * submission runs ahead; the caller only sees the end of the last pair.
+ */
+static int fpga_dma_transceive_chained(struct file *file,
+				       struct fpga_dma_pdata *pdata,
+				       struct fpga_dma_transceive *xc)
+{
+	struct fpga_dma_chain tx, rx;
+	dma_cookie_t tx_cookie = 0, rx_cookie = 0;
+	unsigned int chunk, c;
+	size_t len, done;
+	u32 burst_size;
+	int tx_err = 0, rx_err = 0;
+	int tx_ret, rx_ret, ret;
+
+	/* whole words only, rounding up would overrun the RX buffer */
+	len = xc->tx.len - xc->tx.len % pdata->data_width_bytes;
+	chunk = pdata->fifo_size_bytes;
+	fpga_dma_calc_burst(pdata, &chunk);
+	if (!len || !chunk)
+		return -EINVAL;
+
+	ret = fpga_dma_chain_init(file, pdata, &tx, &xc->tx, len);
+	if (ret)
+		return ret;
+	ret = fpga_dma_chain_init(file, pdata, &rx, &xc->rx, len);
+	if (ret) {
+		fpga_dma_chain_put(&tx);
+		return ret;
+	}
+
+	for (done = 0; done < len; done += c) {
+		c = min_t(size_t, chunk, len - done);
+		burst_size = fpga_dma_calc_burst(pdata, &c);
+		/* RX first, as in the single pair case */
+		ret = fpga_dma_chain_start(pdata, file, &rx, FPGA_DMA_RX, c,
+					   burst_size, &rx_cookie, &rx_err);
+		if (ret)
+			break;
+		ret = fpga_dma_chain_start(pdata, file, &tx, FPGA_DMA_TX, c,
+					   burst_size, &tx_cookie, &tx_err);
+		if (ret) {
+			fpga_dma_queue_cancel(pdata, &pdata->rxq, rx_cookie,
+					      -ECANCELED);
+			break;
+		}
+	}
+
+	/* only this call's pairs, earlier SUBMITs keep their errors */
+	tx_ret = fpga_dma_transceive_wait(pdata, FPGA_DMA_TX, tx_cookie,
+					  &tx_err);
+	rx_ret = fpga_dma_transceive_wait(pdata, FPGA_DMA_RX, rx_cookie,
+					  &rx_err);
+	fpga_dma_chain_put(&tx);
+	fpga_dma_chain_put(&rx);
+	if (!ret)
+		ret = tx_ret ? tx_ret : rx_ret;
+	if (ret)
+		return ret;
+
+	xc->tx.len = xc->rx.len = len;
+	xc->tx.cookie = tx_cookie;
+	xc->rx.cookie = rx_cookie;
+	return 0;
+}
+
+/*
+ * Full duplex loopback: RX is queued first so its channel is armed before
+ * the TX data reaches the FIFO, then TX, and both are waited for together
+ * instead of one after the other. An RX left without its TX is cancelled.
+ */
+static int fpga_dma_ioctl_transceive(struct file *file,
+				     struct fpga_dma_pdata *pdata,
+				     struct fpga_dma_transceive __user *argp)
+{
+	struct fpga_dma_transceive xc;
+	struct fpga_dma_req *txreq, *rxreq;
+	dma_cookie_t tx_cookie, rx_cookie;
+	u32 tx_burst, rx_burst;
+	int tx_err = 0, rx_err = 0;
+	int tx_ret, rx_ret, ret;
+
+	if (copy_from_user(&xc, argp, sizeof(xc)))
+		return -EFAULT;
+	xc.tx.dir = FPGA_DMA_TX;
+	xc.rx.dir = FPGA_DMA_RX;
+
+	if (xc.tx.len == xc.rx.len && xc.tx.len > pdata->fifo_size_bytes) {
+		ret = fpga_dma_transceive_chained(file, pdata, &xc);
+		if (ret)
+			return ret;
+		if (copy_to_user(argp, &xc, sizeof(xc)))
+			return -EFAULT;
+		return 0;
+	}
+
+	txreq = fpga_dma_xfer_req(file, pdata, &xc.tx, &tx_burst);
+	if (IS_ERR(txreq))
+		return PTR_ERR(txreq);
+	rxreq = fpga_dma_xfer_req(file, pdata, &xc.rx, &rx_burst);
+	if (IS_ERR(rxreq)) {
+		fpga_dma_req_free(pdata, txreq);
+		return PTR_ERR(rxreq);
+	}
+	txreq->error = &tx_err;
+	rxreq->error = &rx_err;
+
+	rx_ret = fpga_dma_queue_start(pdata, FPGA_DMA_RX, rxreq, rx_burst,
+				      false, &rx_cookie);
+	if (rx_ret) {
+		fpga_dma_req_free(pdata, txreq);
+		return rx_ret;
+	}
+	tx_ret = fpga_dma_queue_start(pdata, FPGA_DMA_TX, txreq, tx_burst,
+				      false, &tx_cookie);
+	if (tx_ret) {
+		fpga_dma_queue_cancel(pdata, &pdata->rxq, rx_cookie,
+				      -ECANCELED);
+		return tx_ret;
+	}
+	tx_ret = fpga_dma_transceive_wait(pdata, FPGA_DMA_TX, tx_cookie,
+					  &tx_err);
+	rx_ret = fpga_dma_transceive_wait(pdata, FPGA_DMA_RX, rx_cookie,
+					  &rx_err);
+	if (tx_ret || rx_ret)
+		return tx_ret ? tx_ret : rx_ret;
+
+	xc.tx.cookie = tx_cookie;
+	xc.rx.cookie = rx_cookie;
+	if (copy_to_user(argp, &xc, sizeof(xc)))
+		return -EFAULT;
+	return 0;
+}
+
+static int fpga_dma_ioctl_reg_buf(struct file *file,
+				  struct fpga_dma_pdata *pdata,
+				  struct fpga_dma_buf __user *argp)
+{
+	static const enum dma_data_direction dirs[] = {
+		[FPGA_DMA_TX] = DMA_TO_DEVICE,
+		[FPGA_DMA_RX] = DMA_FROM_DEVICE,
+		[FPGA_DMA_TXRX] = DMA_BIDIRECTIONAL,
+	};
+	struct fpga_dma_buf buf;
+	struct fpga_dma_ubuf *ubuf;
+	int ret;
+
+	if (copy_from_user(&buf, argp, sizeof(buf)))
+		return -EFAULT;
+	if (!buf.len || buf.len > INT_MAX || buf.dir >= ARRAY_SIZE(dirs))
+		return -EINVAL;
+
+	/* only RX needs write access, a TX buffer may be read only */
+	ubuf = fpga_dma_ubuf_pin(pdata, file, buf.addr, buf.len,
+				 dirs[buf.dir], true);
+	if (IS_ERR(ubuf))
+		return PTR_ERR(ubuf);
+
+	mutex_lock(&pdata->ubuf_lock);
+	ret = idr_alloc(&pdata->ubuf_idr, ubuf, 1, 0, GFP_KERNEL);
+	if (ret < 0) {
+		mutex_unlock(&pdata->ubuf_lock);
+		fpga_dma_ubuf_put(ubuf);
+		return ret;
+	}
+	ubuf->handle = ret;
+	fpga_dma_ubuf_link(pdata, ubuf);
+	mutex_unlock(&pdata->ubuf_lock);
+
+	/* the buffer stays registered, release() cleans it up */
+	buf.handle = ubuf->handle;
+	if (copy_to_user(argp, &buf, sizeof(buf)))
+		return -EFAULT;
+	return 0;
+}
+
+static int fpga_dma_ioctl_unreg_buf(struct file *file,
+				    struct fpga_dma_pdata *pdata,
+				    u32 __user *argp)
+{
+	struct fpga_dma_ubuf *ubuf;
+	u32 handle;
+	int ret = 0;
+
+	if (get_user(handle, argp))
+		return -EFAULT;
+
+	mutex_lock(&pdata->ubuf_lock);
+	ubuf = idr_find(&pdata->ubuf_idr, handle);
+	if (ubuf && ubuf->owner == file)
+		fpga_dma_ubuf_unlink(pdata, ubuf);
+	else
+		ret = -EINVAL;
+	mutex_unlock(&pdata->ubuf_lock);
+	return ret;
+}
+
+static dma_cookie_t fpga_dma_last_cookie(struct fpga_dma_queue *q)
+{
+	dma_cookie_t last, used;
+
+	dma_async_is_tx_complete(q->chan, q->chan->cookie, &last, &used);
+	return last;
+}
+
+static int fpga_dma_ioctl_status(struct fpga_dma_pdata *pdata,
+				 struct fpga_dma_status __user *argp)
+{
+	struct fpga_dma_status st;
+	u32 fifo_status;
+
+	fifo_status = readl(pdata->csr_reg + ALT_FPGADMA_CSR_FIFO_STATUS);
+
+	memset(&st, 0, sizeof(st));
+	st.fifo_depth = pdata->fifo_depth;
+	st.data_width = pdata->data_width_bytes;
+	st.fifo_used = fifo_status & ALT_FPGADMA_FIFO_USED_MASK;
+	st.fifo_full = !!(fifo_status & ALT_FPGADMA_FIFO_FULL);
+	st.fifo_empty = !!(fifo_status & ALT_FPGADMA_FIFO_EMPTY);
+	st.queue_depth = fpga_dma_queue_limit();
+	/* no locking, a waiter may hold the queue for a whole timeout */
+	st.tx_inflight = READ_ONCE(pdata->txq.depth);
+	st.rx_inflight = READ_ONCE(pdata->rxq.depth);
+	st.tx_last_cookie = fpga_dma_last_cookie(&pdata->txq);
+	st.rx_last_cookie = fpga_dma_last_cookie(&pdata->rxq);
+	st.buf_size = pdata->buf_size;
+	st.pool_bufs = pdata->pool_bufs;
+
+	if (copy_to_user(argp, &st, sizeof(st)))
+		return -EFAULT;
+	return 0;
+}
+
+/* --------------------------------------------------------------------- */
+
+/*
+ * The pool buffers may still be mapped after unbind, so they go with
+ * pdata rather than with the device's devres.
+ */
+static void fpga_dma_release_pdata(struct kref *ref)
+{
+	struct fpga_dma_pdata *pdata = container_of(ref, struct fpga_dma_pdata,
+						    ref);
+	struct device *dev = &pdata->pdev->dev;
+	unsigned int i;
+
+	for (i = 0; pdata->pool && i < pdata->pool_bufs; i++)
+		if (pdata->pool[i].virt)
+			dma_free_coherent(dev, pdata->buf_size,
+					  pdata->pool[i].virt,
+					  pdata->pool[i].dma);
+	kfree(pdata->pool);
+	if (pdata->inode)
+		iput(pdata->inode);
+	put_device(dev);
+	kfree(pdata);
+}
+
+/* keep pdata and the pool buffers around, see fpga_dma_remove() */
+static void fpga_dma_get(struct fpga_dma_pdata *pdata)
+{
+	kref_get(&pdata->ref);
+}
+
+static void fpga_dma_put(struct fpga_dma_pdata *pdata)
+{
+	kref_put(&pdata->ref, fpga_dma_release_pdata);
+}
+
+/* the device's own reference, dropped at unbind after all other devres */
+static void fpga_dma_put_action(void *data)
+{
+	fpga_dma_put(data);
+}
+
+/*
+ * Hold off remove() for one file operation. -ENODEV once the device is
+ * gone, -EAGAIN if @nowait and remove() is running.
+ */
+static int fpga_dma_enter(struct fpga_dma_pdata *pdata, bool nowait)
+{
+	if (!nowait)
+		down_read(&pdata->remove_lock);
+	else if (!down_read_trylock(&pdata->remove_lock))
+		return -EAGAIN;
+	if (pdata->dead) {
+		up_read(&pdata->remove_lock);
+		return -ENODEV;
+	}
+	return 0;
+}
+
+static void fpga_dma_leave(struct fpga_dma_pdata *pdata)
+{
+	up_read(&pdata->remove_lock);
+}
+
+/* --------------------------------------------------------------------- */
+
+static void fpga_dma_ring_release(struct kref *ref)
+{
+	struct fpga_dma_ring *ring = container_of(ref, struct fpga_dma_ring,
+						  ref);
+	struct fpga_dma_pdata *pdata = ring->pdata;
+
+	dma_free_coherent(&pdata->pdev->dev, ring->size, ring->virt,
+			  ring->dma);
+	kfree(ring);
+	fpga_dma_put(pdata);
+}
+
+static void fpga_dma_ring_put(struct fpga_dma_ring *ring)
+{
+	kref_put(&ring->ref, fpga_dma_ring_release);
+}
+
+static struct fpga_dma_ring *fpga_dma_ring_get(struct fpga_dma_pdata *pdata)
+{
+	struct fpga_dma_ring *ring;
+
+	mutex_lock(&pdata->rxq.lock);
+	ring = pdata->ring;
+	if (ring)
+		kref_get(&ring->ref);
+	mutex_unlock(&pdata->rxq.lock);
+	return ring;
+}
+
+static int fpga_dma_ring_start(struct file *file, struct fpga_dma_pdata *pdata,
+			       struct fpga_dma_ring_setup __user *argp)
+{
+	struct fpga_dma_queue *q = &pdata->rxq;
+	struct fpga_dma_ring_setup setup;
+	struct fpga_dma_ring *ring;
+	unsigned int len;
+	u64 size;
+	u32 burst_size;
+	int ret;
+
+	if (copy_from_user(&setup, argp, sizeof(setup)))
+		return -EFAULT;
+	len = setup.period_len;
+	burst_size = fpga_dma_calc_burst(pdata, &len);
+	if (!len || len != setup.period_len || setup.periods < 2)
+		return -EINVAL;
+	size = PAGE_SIZE + (u64)setup.period_len * setup.periods;
+	if (size > INT_MAX)
+		return -EINVAL;
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+	kref_init(&ring->ref);
+	init_waitqueue_head(&ring->wait);
+	ring->pdata = pdata;
+	ring->owner = file;
+	ring->size = PAGE_ALIGN(size);
+	ring->virt = dma_alloc_coherent(&pdata->pdev->dev, ring->size,
+					&ring->dma, GFP_KERNEL);
+	if (!ring->virt) {
+		kfree(ring);
+		return -ENOMEM;
+	}
+	/* the last mapping may go after the file, even after remove() */
+	fpga_dma_get(pdata);
+	ring->ctrl = ring->virt;
+	ring->ctrl->period_len = setup.period_len;
+	ring->ctrl->periods = setup.periods;
+	ring->ctrl->data_offset = PAGE_SIZE;
+
+	mutex_lock(&q->lock);
+	if (pdata->ring) {
+		ret = -EBUSY;
+		goto out_unlock;
+	}
+	/* the ring takes over the channel once queued reads are done */
+	ret = fpga_dma_queue_wait(pdata, q, NULL);
+	if (ret)
+		goto out_unlock;
+	ret = fpga_dma_dma_start_cyclic(pdata->pdev, ring, burst_size);
+	if (ret)
+		goto out_unlock;
+	pdata->ring = ring;
+	mutex_unlock(&q->lock);
+
+	/* pool buffers come first in the mmap() space */
+	setup.mmap_offset = (u64)pdata->pool_bufs * pdata->buf_size;
+	setup.mmap_len = ring->size;
+	if (copy_to_user(argp, &setup, sizeof(setup)))
+		return -EFAULT;
+	return 0;
+
+out_unlock:
+	mutex_unlock(&q->lock);
+	fpga_dma_ring_put(ring);
+	return ret;
+}
+
+/* stop the ring started through @file, or any ring if @file is NULL */
+static int fpga_dma_ring_stop(struct fpga_dma_pdata *pdata, struct file *file)
+{
+	struct fpga_dma_queue *q = &pdata->rxq;
+	struct fpga_dma_ring *ring;
+
+	mutex_lock(&q->lock);
+	ring = pdata->ring;
+	if (!ring || (file && ring->owner != file)) {
+		mutex_unlock(&q->lock);
+		return -EINVAL;
+	}
+	/* no period callback runs after this returns */
+	dmaengine_terminate_sync(q->chan);
+	pdata->ring = NULL;
+	mutex_unlock(&q->lock);
+
+	ring->stopped = true;
+	wake_up_interruptible(&ring->wait);
+	fpga_dma_ring_put(ring);
+	return 0;
+}
+
+static int fpga_dma_ring_wait(struct fpga_dma_pdata *pdata,
+			      u32 __user *argp)
+{
+	struct fpga_dma_ring *ring;
+	u32 seen, produced;
+	long ret;
+
+	if (get_user(seen, argp))
+		return -EFAULT;
+	ring = fpga_dma_ring_get(pdata);
+	if (!ring)
+		return -EINVAL;
+
+	ret = wait_event_interruptible_timeout(ring->wait,
+			READ_ONCE(ring->ctrl->produced) != seen ||
+			ring->stopped, msecs_to_jiffies(timeout));
+	produced = READ_ONCE(ring->ctrl->produced);
+	fpga_dma_ring_put(ring);
+
+	if (ret < 0)
+		return ret;
+	if (produced == seen)
+		return ret ? -EINVAL : -ETIMEDOUT;
+	return put_user(produced, argp);
+}
+
+/* vm_ops live in this module, every mapping holds it */
+static void fpga_dma_ring_vm_open(struct vm_area_struct *vma)
+{
+	struct fpga_dma_ring *ring = vma->vm_private_data;
+
+	__module_get(THIS_MODULE);
+	kref_get(&ring->ref);
+}
+
+static void fpga_dma_ring_vm_close(struct vm_area_struct *vma)
+{
+	fpga_dma_ring_put(vma->vm_private_data);
+	module_put(THIS_MODULE);
+}
+
+static const struct vm_operations_struct fpga_dma_ring_vm_ops = {
+	.open = fpga_dma_ring_vm_open,
+	.close = fpga_dma_ring_vm_close,
+};
+
+static int fpga_dma_ring_mmap(struct fpga_dma_pdata *pdata,
+			      struct vm_area_struct *vma)
+{
+	size_t size = vma->vm_end - vma->vm_start;
+	struct fpga_dma_ring *ring;
+	int ret;
+
+	ring = fpga_dma_ring_get(pdata);
+	if (!ring)
+		return -EINVAL;
+	if (size > ring->size) {
+		fpga_dma_ring_put(ring);
+		return -EINVAL;
+	}
+
+	vma->vm_pgoff = 0;
+	ret = dma_mmap_coherent(&pdata->pdev->dev, vma, ring->virt, ring->dma,
+				size);
+	if (ret) {
+		fpga_dma_ring_put(ring);
+		return ret;
+	}
+	/* the reference taken above now belongs to the mapping */
+	vma->vm_private_data = ring;
+	vma->vm_ops = &fpga_dma_ring_vm_ops;
+	__module_get(THIS_MODULE);
+	return 0;
+}
+
+/* --------------------------------------------------------------------- */
+
+static int fpga_dma_ioctl_set_notify(struct file *file,
+				     struct fpga_dma_notify __user *argp)
+{
+	struct fpga_dma_file *fp = file->private_data;
+	struct eventfd_ctx *eventfd = NULL, *old;
+	struct fpga_dma_notify n;
+	unsigned long flags;
+
+	if (copy_from_user(&n, argp, sizeof(n)))
+		return -EFAULT;
+	if (n.reserved)
+		return -EINVAL;
+	if (n.eventfd >= 0) {
+		eventfd = eventfd_ctx_fdget(n.eventfd);
+		if (IS_ERR(eventfd))
+			return PTR_ERR(eventfd);
+	}
+
+	hrtimer_cancel(&fp->timer);
+	spin_lock_irqsave(&fp->lock, flags);
+	old = fp->eventfd;
+	fp->eventfd = eventfd;
+	fp->batch = max(n.batch, 1U);
+	fp->delay = us_to_ktime(n.delay_us);
+	/* nothing held back under the old setting gets lost */
+	if (fp->unsignalled)
+		fpga_dma_signal(fp);
+	spin_unlock_irqrestore(&fp->lock, flags);
+
+	if (old)
+		eventfd_ctx_put(old);
+	return 0;
+}
+
+/* retire what has completed and collect the signalled count */
+static int fpga_dma_ioctl_events(struct file *file,
+				 struct fpga_dma_pdata *pdata,
+				 __u32 __user *argp)
+{
+	struct fpga_dma_file *fp = file->private_data;
+	unsigned long flags;
+	u32 n;
+
+	fpga_dma_reap(pdata);
+
+	spin_lock_irqsave(&fp->lock, flags);
+	n = fp->signalled;
+	fp->signalled = 0;
+	spin_unlock_irqrestore(&fp->lock, flags);
+	return put_user(n, argp);
+}
+
+/*
+ * Readable once completions were signalled and not yet collected with
+ * FPGA_DMA_IOC_EVENTS, writable while both queues have room.
+ */
+static __poll_t fpga_dma_poll(struct file *file, poll_table *wait)
+{
+	struct fpga_dma_pdata *pdata = fpga_dma_pdata_of(file);
+	struct fpga_dma_file *fp = file->private_data;
+	unsigned int depth = fpga_dma_queue_limit();
+	__poll_t mask = 0;
+
+	poll_wait(file, &fp->wait, wait);
+	poll_wait(file, &pdata->room_wait, wait);
+	if (READ_ONCE(fp->signalled))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	/* unreaped completions still count, as make_room sees them at worst */
+	if (READ_ONCE(pdata->txq.depth) < depth &&
+	    READ_ONCE(pdata->rxq.depth) < depth) {
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	} else {
+		/* what completed before we were on room_wait is retired too */
+		schedule_work(&pdata->reap_work);
+	}
+	return mask;
+}
+
+static long fpga_dma_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	struct fpga_dma_pdata *pdata = fpga_dma_pdata_of(file);
+	struct fpga_dma_file *fp = file->private_data;
+	void __user *argp = (void __user *)arg;
+	u32 engine;
+
+	switch (cmd) {
+	case FPGA_DMA_IOC_SUBMIT:
+		return fpga_dma_ioctl_submit(file, pdata, argp);
+	case FPGA_DMA_IOC_SUBMIT_BATCH:
+		return fpga_dma_ioctl_submit_batch(file, pdata, argp);
+	case FPGA_DMA_IOC_WAIT:
+		return fpga_dma_ioctl_wait(file, pdata, argp);
+	case FPGA_DMA_IOC_TRANSCEIVE:
+		return fpga_dma_ioctl_transceive(file, pdata, argp);
+	case FPGA_DMA_IOC_STATUS:
+		return fpga_dma_ioctl_status(pdata, argp);
+	case FPGA_DMA_IOC_REG_BUF:
+		return fpga_dma_ioctl_reg_buf(file, pdata, argp);
+	case FPGA_DMA_IOC_UNREG_BUF:
+		return fpga_dma_ioctl_unreg_buf(file, pdata, argp);
+	case FPGA_DMA_IOC_RING_START:
+		return fpga_dma_ring_start(file, pdata, argp);
+	case FPGA_DMA_IOC_RING_STOP:
+		return fpga_dma_ring_stop(pdata, file);
+	case FPGA_DMA_IOC_RING_WAIT:
+		return fpga_dma_ring_wait(pdata, argp);
+	case FPGA_DMA_IOC_SET_NOTIFY:
+		return fpga_dma_ioctl_set_notify(file, argp);
+	case FPGA_DMA_IOC_EVENTS:
+		return fpga_dma_ioctl_events(file, pdata, argp);
+	case FPGA_DMA_IOC_SET_ENGINE:
+		if (get_user(engine, (u32 __user *)argp))
+			return -EFAULT;
+		if (engine != FPGA_DMA_ENGINE_SG &&
+		    engine != FPGA_DMA_ENGINE_BOUNCE)
+			return -EINVAL;
+		WRITE_ONCE(fp->engine, engine);
+		return 0;
+	default:
+		return -ENOTTY;
+	}
+}
+
+/*
+ * Pool buffer n lives at file offset n * buf_size, one buffer per mmap(),
+ * the RX ring (if running) right after the last pool buffer.
+ */
+/* a mapping outlives its file and maybe the device, see remove() */
+static void fpga_dma_pool_vm_open(struct vm_area_struct *vma)
+{
+	__module_get(THIS_MODULE);
+	fpga_dma_get(vma->vm_private_data);
+}
+
+static void fpga_dma_pool_vm_close(struct vm_area_struct *vma)
+{
+	fpga_dma_put(vma->vm_private_data);
+	module_put(THIS_MODULE);
+}
+
+static const struct vm_operations_struct fpga_dma_pool_vm_ops = {
+	.open = fpga_dma_pool_vm_open,
+	.close = fpga_dma_pool_vm_close,
+};
+
+static int fpga_dma_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fpga_dma_pdata *pdata = fpga_dma_pdata_of(file);
+	size_t size = vma->vm_end - vma->vm_start;
+	unsigned long buf_pages = pdata->buf_size >> PAGE_SHIFT;
+	unsigned long idx = vma->vm_pgoff / buf_pages;
+	int ret;
+
+	if (vma->vm_pgoff == pdata->pool_bufs * buf_pages)
+		return fpga_dma_ring_mmap(pdata, vma);
+	if (vma->vm_pgoff % buf_pages || idx >= pdata->pool_bufs ||
+	    size > pdata->buf_size)
+		return -EINVAL;
+
+	/* dma_mmap_coherent() takes vm_pgoff as offset into the buffer */
+	vma->vm_pgoff = 0;
+	ret = dma_mmap_coherent(&pdata->pdev->dev, vma, pdata->pool[idx].virt,
+				pdata->pool[idx].dma, size);
+	if (ret)
+		return ret;
+	vma->vm_private_data = pdata;
+	vma->vm_ops = &fpga_dma_pool_vm_ops;
+	__module_get(THIS_MODULE);
+	fpga_dma_get(pdata);
+	return 0;
+}
+
+static int fpga_dma_open(struct inode *inode, struct file *file)
+{
+	struct fpga_dma_file *fp;
+
+	fp = kzalloc(sizeof(*fp), GFP_KERNEL);
+	if (!fp)
+		return -ENOMEM;
+	/* misc_open() left our miscdevice in private_data */
+	fp->pdata = container_of(file->private_data, struct fpga_dma_pdata,
+				 miscdev);
+	fp->engine = FPGA_DMA_ENGINE_SG;
+	spin_lock_init(&fp->lock);
+	init_waitqueue_head(&fp->wait);
+	fp->batch = 1;
+	hrtimer_init(&fp->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	fp->timer.function = fpga_dma_notify_timer;
+	file->private_data = fp;
+	/* misc_open() holds misc_mtx, so remove() can't be past deregister */
+	fpga_dma_get(fp->pdata);
+	/*
+	 * Every file maps through one inode, whichever node it was opened
+	 * by, so remove() finds all mappings of the device in one place.
+	 */
+	if (!fp->pdata->inode) {
+		ihold(inode);
+		fp->pdata->inode = inode;
+	}
+	file->f_mapping = fp->pdata->inode->i_mapping;
+	/* read_iter/write_iter honour IOCB_NOWAIT */
+	file->f_mode |= FMODE_NOWAIT;
+	return nonseekable_open(inode, file);
+}
+
+static int fpga_dma_release(struct inode *inode, struct file *file)
+{
+	struct fpga_dma_pdata *pdata = fpga_dma_pdata_of(file);
+	struct fpga_dma_file *fp = file->private_data;
+
+	/*
+	 * don't leave user pages pinned behind a closed file; after
+	 * remove() there is nothing left to flush or drop
+	 */
+	if (!fpga_dma_enter(pdata, false)) {
+		fpga_dma_fsync(file, 0, LLONG_MAX, 0);
+		fpga_dma_ubuf_drop(pdata, file);
+		fpga_dma_ring_stop(pdata, file);
+		fpga_dma_leave(pdata);
+	}
+	hrtimer_cancel(&fp->timer);
+	if (fp->eventfd)
+		eventfd_ctx_put(fp->eventfd);
+	kfree(fp);
+	fpga_dma_put(pdata);
+	return 0;
+}
+
+/*
+ * The entry points below run the file operations above between
+ * fpga_dma_enter() and fpga_dma_leave(), so remove() can tear the device
+ * down under open files.
+ */
+static ssize_t fpga_dma_fop_write(struct file *file, const char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct fpga_dma_pdata *pdata = fpga_dma_pdata_of(file);
+	ssize_t ret;
+
+	ret = fpga_dma_enter(pdata, false);
+	if (ret)
+		return ret;
+	ret = fpga_dma_write(file, buf, count, ppos);
+	fpga_dma_leave(pdata);
+	return ret;
+}
+
+static ssize_t fpga_dma_fop_read(struct file *file, char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	struct fpga_dma_pdata *pdata = fpga_dma_pdata_of(file);
+	ssize_t ret;
+
+	ret = fpga_dma_enter(pdata, false);
+	if (ret)
+		return ret;
+	ret = fpga_dma_read(file, buf, count, ppos);
+	fpga_dma_leave(pdata);
+	return ret;
+}
+
+static ssize_t fpga_dma_fop_write_iter(struct kiocb *iocb,
+				       struct iov_iter *from)
+{
+	struct fpga_dma_pdata *pdata = fpga_dma_pdata_of(iocb->ki_filp);
+	ssize_t ret;
+
+	ret = fpga_dma_enter(pdata, iocb->ki_flags & IOCB_NOWAIT);
+	if (ret)
+		return ret;
+	ret = fpga_dma_write_iter(iocb, from);
+	fpga_dma_leave(pdata);
+	return ret;
+}
+
+static ssize_t fpga_dma_fop_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct fpga_dma_pdata *pdata = fpga_dma_pdata_of(iocb->ki_filp);
+	ssize_t ret;
+
+	ret = fpga_dma_enter(pdata, iocb->ki_flags & IOCB_NOWAIT);
+	if (ret)
+		return ret;
+	ret = fpga_dma_read_iter(iocb, to);
+	fpga_dma_leave(pdata);
+	return ret;
+}
+
+static int fpga_dma_fop_fsync(struct file *file, loff_t start, loff_t end,
+			      int datasync)
+{
+	struct fpga_dma_pdata *pdata = fpga_dma_pdata_of(file);
+	int ret;
+
+	ret = fpga_dma_enter(pdata, false);
+	if (ret)
+		return ret;
+	ret = fpga_dma_fsync(file, start, end, datasync);
+	fpga_dma_leave(pdata);
+	return ret;
+}
+
+static __poll_t fpga_dma_fop_poll(struct file *file, poll_table *wait)
+{
+	struct fpga_dma_pdata *pdata = fpga_dma_pdata_of(file);
+	__poll_t mask;
+
+	if (fpga_dma_enter(pdata, false))
+		return EPOLLERR | EPOLLHUP;
+	mask = fpga_dma_poll(file, wait);
+	fpga_dma_leave(pdata);
+	return mask;
+}
+
+static long fpga_dma_fop_ioctl(struct file *file, unsigned int cmd,
+			       unsigned long arg)
+{
+	struct fpga_dma_pdata *pdata = fpga_dma_pdata_of(file);
+	long ret;
+
+	ret = fpga_dma_enter(pdata, false);
+	if (ret)
+		return ret;
+	ret = fpga_dma_ioctl(file, cmd, arg);
+	fpga_dma_leave(pdata);
+	return ret;
+}
+
+static int fpga_dma_fop_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fpga_dma_pdata *pdata = fpga_dma_pdata_of(file);
+	int ret;
+
+	ret = fpga_dma_enter(pdata, false);
+	if (ret)
+		return ret;
+	ret = fpga_dma_mmap(file, vma);
+	fpga_dma_leave(pdata);
+	return ret;
+}
+
+static const struct file_operations fpga_dma_fops = {
+	.owner = THIS_MODULE,
+	.open = fpga_dma_open,
+	.release = fpga_dma_release,
+	.write = fpga_dma_fop_write,
+	.read = fpga_dma_fop_read,
+	.write_iter = fpga_dma_fop_write_iter,
+	.read_iter = fpga_dma_fop_read_iter,
+	.fsync = fpga_dma_fop_fsync,
+	.poll = fpga_dma_fop_poll,
+	.unlocked_ioctl = fpga_dma_fop_ioctl,
+	.mmap = fpga_dma_fop_mmap,
+	.llseek = no_llseek,
+};
+
+static int fpga_dma_register_chrdev(struct fpga_dma_pdata *pdata)
+{
+	int ret;
+
+	pdata->miscdev.minor = MISC_DYNAMIC_MINOR;
+	pdata->miscdev.name = pdata->name;
+	pdata->miscdev.fops = &fpga_dma_fops;
+	pdata->miscdev.parent = &pdata->pdev->dev;
+
+	ret = misc_register(&pdata->miscdev);
+	if (ret) {
+		dev_err(&pdata->pdev->dev, "misc_register failed %d\n", ret);
+		pdata->miscdev.this_device = NULL;
+	}
+	return ret;
+}
+
+/* --------------------------------------------------------------------- */
+
+static ssize_t dbgfs_read_csr(struct file *file, char __user *user_buf,
+			      size_t count, loff_t *ppos)
+{
+	struct fpga_dma_pdata *pdata = file->private_data;
+	dump_csr(pdata);
+	return 0;
+}
+
+static const struct file_operations dbgfs_csr_fops = {
+	.read = dbgfs_read_csr,
+	.open = simple_open,
+	.llseek = no_llseek,
+};
+
+/* --------------------------------------------------------------------- */
+
+static ssize_t dbgfs_write_clear(struct file *file,
+				 const char __user *user_buf, size_t count,
+				 loff_t *ppos)
+{
+	struct fpga_dma_pdata *pdata = file->private_data;
+	writel(1, pdata->csr_reg + ALT_FPGADMA_CSR_FIFO_CLEAR);
+	return count;
+}
+
+static const struct file_operations dbgfs_clear_fops = {
+	.write = dbgfs_write_clear,
+	.open = simple_open,
+	.llseek = no_llseek,
+};
+
+/* --------------------------------------------------------------------- */
+
+static ssize_t dbgfs_write_wrwtrmk(struct file *file,
+				   const char __user *user_buf,
+				   size_t count, loff_t *ppos)
+{
+	struct fpga_dma_pdata *pdata = file->private_data;
+	char buf[32];
+	unsigned long val;
+	int ret;
+
+	memset(buf, 0, sizeof(buf));
+
+	if (copy_from_user(buf, user_buf, min(count, (sizeof(buf) - 1))))
+		return -EFAULT;
+
+	ret = kstrtoul(buf, 16, &val);
+	if (ret)
+		return ret;
+
+	writel(val, pdata->csr_reg + ALT_FPGADMA_CSR_WR_WTRMK);
+	return count;
+}
+
+static const struct file_operations dbgfs_wrwtrmk_fops = {
+	.write = dbgfs_write_wrwtrmk,
+	.open = simple_open,
+	.llseek = no_llseek,
+};
+
+/* --------------------------------------------------------------------- */
+
+static ssize_t dbgfs_write_rdwtrmk(struct file *file,
+				   const char __user *user_buf,
+				   size_t count, loff_t *ppos)
+{
+	struct fpga_dma_pdata *pdata = file->private_data;
+	char buf[32];
+	int ret;
+	unsigned long val;
+
+	memset(buf, 0, sizeof(buf));
+
+	if (copy_from_user(buf, user_buf, min(count, (sizeof(buf) - 1))))
+		return -EFAULT;
+
+	ret = kstrtoul(buf, 16, &val);
+	if (ret)
+		return ret;
+
+	writel(val, pdata->csr_reg + ALT_FPGADMA_CSR_RD_WTRMK);
+	return count;
+}
+
+static const struct file_operations dbgfs_rdwtrmk_fops = {
+	.write = dbgfs_write_rdwtrmk,
+	.open = simple_open,
+	.llseek = no_llseek,
+};
+
+static ssize_t dbgfs_fifo_write(struct file *file, const char __user *user_buf, 
+	size_t count, loff_t *ppos){
+	struct fpga_dma_pdata *pdata = file->private_data;
+	char buf[32];
+	unsigned long val;
+	int ret;
+
+	memset(buf, 0, sizeof(buf));
+
+	if (copy_from_user(buf, user_buf, min(count, (sizeof(buf) - 1))))
+		return -EFAULT;
+
+	ret = kstrtoul(buf, 16, &val);
+	if (ret)
+		return ret;
+
+	writel(val, pdata->csr_reg + ALT_FPGADMA_CSR_ZERO);
+	return count;
+}
+/*
+static ssize_t dbgfs_fifo_read(struct file *file, char __user *user_buf,
+	size_t count, loff_t *ppos){
+	return 0;
+}
+*/
+static const struct file_operations dbgfs_fifo_fops = {
+	.write = dbgfs_fifo_write,
+	//.read = dbgfs_fifo_read,
+	.open = simple_open,
+	.llseek = no_llseek,
+};
+/* --------------------------------------------------------------------- */
+
+static void dbgfs_show_segs(struct seq_file *s, const char *name,
+			    struct fpga_dma_queue *q)
+{
+	seq_printf(s, "%s %12llu %12llu %6llu %6u %6u\n", name,
+		   q->transfers, q->segments,
+		   q->transfers ? div64_u64(q->segments, q->transfers) : 0,
+		   q->last_segs, q->max_segs);
+}
+
+static int dbgfs_segs_show(struct seq_file *s, void *unused)
+{
+	struct fpga_dma_pdata *pdata = s->private;
+
+	seq_puts(s, "dir    transfers     segments    avg   last    max\n");
+	dbgfs_show_segs(s, "tx ", &pdata->txq);
+	dbgfs_show_segs(s, "rx ", &pdata->rxq);
+	return 0;
+}
+
+static int dbgfs_segs_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dbgfs_segs_show, inode->i_private);
+}
+
+static void fpga_dma_reset_segs(struct fpga_dma_queue *q)
+{
+	q->transfers = 0;
+	q->segments = 0;
+	q->last_segs = 0;
+	q->max_segs = 0;
+}
+
+/* any write resets the counters */
+static ssize_t dbgfs_write_segs(struct file *file,
+				const char __user *user_buf, size_t count,
+				loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct fpga_dma_pdata *pdata = s->private;
+
+	fpga_dma_reset_segs(&pdata->txq);
+	fpga_dma_reset_segs(&pdata->rxq);
+	return count;
+}
+
+static const struct file_operations dbgfs_segs_fops = {
+	.open = dbgfs_segs_open,
+	.read = seq_read,
+	.write = dbgfs_write_segs,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* --------------------------------------------------------------------- */
+
+static const char *const fpga_dma_stage_names[FPGA_DMA_NUM_STAGES] = {
+	"map", "submit", "issue", "wake",
+};
+
+static const char *const fpga_dma_size_names[FPGA_DMA_NUM_SIZES] = {
+	"<4K", "<64K", "<1M", ">=1M",
+};
+
+/* upper bound in ns of the bucket holding the @pct percentile */
+static u64 dbgfs_stats_pct(const unsigned long *hist, unsigned long total,
+			   unsigned int pct)
+{
+	u64 sum = 0;	/* times 100 would wrap a 32-bit long */
+	unsigned int b;
+
+	for (b = 0; b < FPGA_DMA_HIST_BUCKETS; b++) {
+		sum += hist[b];
+		if (sum * 100 >= (u64)total * pct)
+			break;
+	}
+	return 1ULL << b;
+}
+
+static int dbgfs_stats_show(struct seq_file *s, void *unused)
+{
+	struct fpga_dma_pdata *pdata = s->private;
+	unsigned long hist[FPGA_DMA_HIST_BUCKETS], total;
+	unsigned int dir, size, stage, b;
+	int cpu;
+
+	seq_puts(s, "# latency in ns, bucket b counts [2^(b-1), 2^b)\n");
+	seq_puts(s, "# dir size  stage       count     p50<     p99<     max<"
+		 "  buckets\n");
+	for (dir = 0; dir < 2; dir++)
+	for (size = 0; size < FPGA_DMA_NUM_SIZES; size++)
+	for (stage = 0; stage < FPGA_DMA_NUM_STAGES; stage++) {
+		memset(hist, 0, sizeof(hist));
+		for_each_possible_cpu(cpu) {
+			struct fpga_dma_stats *st = per_cpu_ptr(pdata->stats,
+								cpu);
+
+			for (b = 0; b < FPGA_DMA_HIST_BUCKETS; b++)
+				hist[b] += READ_ONCE(st->hist[dir][size][stage][b]);
+		}
+		total = 0;
+		for (b = 0; b < FPGA_DMA_HIST_BUCKETS; b++)
+			total += hist[b];
+		if (!total)
+			continue;
+
+		seq_printf(s, "%s  %-5s %-6s %10lu %8llu %8llu %8llu ",
+			   dir == FPGA_DMA_RX ? "rx" : "tx",
+			   fpga_dma_size_names[size],
+			   fpga_dma_stage_names[stage], total,
+			   dbgfs_stats_pct(hist, total, 50),
+			   dbgfs_stats_pct(hist, total, 99),
+			   dbgfs_stats_pct(hist, total, 100));
+		for (b = 0; b < FPGA_DMA_HIST_BUCKETS; b++)
+			if (hist[b])
+				seq_printf(s, " %u:%lu", b, hist[b]);
+		seq_putc(s, '\n');
+	}
+	return 0;
+}
+
+static int dbgfs_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dbgfs_stats_show, inode->i_private);
+}
+
+/* any write resets the histograms */
+static ssize_t dbgfs_write_stats(struct file *file,
+				 const char __user *user_buf, size_t count,
+				 loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct fpga_dma_pdata *pdata = s->private;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(pdata->stats, cpu), 0,
+		       sizeof(struct fpga_dma_stats));
+	return count;
+}
+
+static const struct file_operations dbgfs_stats_fops = {
+	.open = dbgfs_stats_open,
+	.read = seq_read,
+	.write = dbgfs_write_stats,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* --------------------------------------------------------------------- */
+
+static int dbgfs_calibration_show(struct seq_file *s, void *unused)
+{
+	struct fpga_dma_pdata *pdata = s->private;
+	struct fpga_dma_cal *cal;
+
+	seq_printf(s, "# fifo_depth %u words, data_width %u bytes\n",
+		   pdata->fifo_depth, pdata->data_width_bytes);
+	seq_printf(s, "# current burst %u wr_wtrmk %u rd_wtrmk %u\n",
+		   fpga_dma_burst_words(pdata),
+		   readl(pdata->csr_reg + ALT_FPGADMA_CSR_WR_WTRMK),
+		   readl(pdata->csr_reg + ALT_FPGADMA_CSR_RD_WTRMK));
+	seq_puts(s, "# burst wr_wtrmk rd_wtrmk     KiB/s result\n");
+	for (cal = pdata->cal; cal < pdata->cal + pdata->cal_n; cal++)
+		seq_printf(s, "%7u %8u %8u %9llu %d\n", cal->burst,
+			   cal->wr_wtrmk, cal->rd_wtrmk, cal->kbps,
+			   cal->result);
+	return 0;
+}
+
+static int dbgfs_calibration_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dbgfs_calibration_show, inode->i_private);
+}
+
+static const struct file_operations dbgfs_calibration_fops = {
+	.open = dbgfs_calibration_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* --------------------------------------------------------------------- */
+
+static int fpga_dma_register_dbgfs(struct fpga_dma_pdata *pdata)
+{
+	struct dentry *d;
+
+	d = debugfs_create_dir(pdata->name, NULL);
+	if (IS_ERR(d))
+		return PTR_ERR(d);
+	if (!d) {
+		dev_err(&pdata->pdev->dev, "Failed to initialize debugfs\n");
+		return -ENOMEM;
+	}
+
+	pdata->root = d;
+
+	debugfs_create_file("csr", S_IRUGO, pdata->root, pdata,
+			    &dbgfs_csr_fops);
+
+	debugfs_create_file("clear", S_IWUSR, pdata->root, pdata,
+			    &dbgfs_clear_fops);
+
+	debugfs_create_file("wrwtrmk", S_IWUSR, pdata->root, pdata,
+			    &dbgfs_wrwtrmk_fops);
+
+	debugfs_create_file("rdwtrmk", S_IWUSR, pdata->root, pdata,
+			    &dbgfs_rdwtrmk_fops);
+
+	debugfs_create_file("fifo", S_IWUSR, pdata->root, pdata,
+			     &dbgfs_fifo_fops);
+
+	debugfs_create_file("segs", S_IWUSR | S_IRUGO, pdata->root, pdata,
+			    &dbgfs_segs_fops);
+
+	debugfs_create_file("stats", S_IWUSR | S_IRUGO, pdata->root, pdata,
+			    &dbgfs_stats_fops);
+
+	debugfs_create_file("calibration", S_IRUGO, pdata->root, pdata,
+			    &dbgfs_calibration_fops);
+
+	return 0;
+}
+
+/* --------------------------------------------------------------------- */
+
+/* hand this file's unsignalled completions to poll() and the eventfd */
+static void fpga_dma_signal(struct fpga_dma_file *fp)
+{
+	fp->signalled += fp->unsignalled;
+	if (fp->eventfd)
+		eventfd_signal(fp->eventfd, fp->unsignalled);
+	fp->unsignalled = 0;
+	wake_up_interruptible(&fp->wait);
+}
+
+static enum hrtimer_restart fpga_dma_notify_timer(struct hrtimer *timer)
+{
+	struct fpga_dma_file *fp = container_of(timer, struct fpga_dma_file,
+						timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&fp->lock, flags);
+	if (fp->unsignalled)
+		fpga_dma_signal(fp);
+	spin_unlock_irqrestore(&fp->lock, flags);
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * A request of @fp completed. Signal once batch completions have piled
+ * up, or delay after the first of them, whatever comes first. Called
+ * before complete(), so @fp still exists.
+ */
+static void fpga_dma_notify(struct fpga_dma_file *fp)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&fp->lock, flags);
+	if (++fp->unsignalled >= fp->batch) {
+		hrtimer_try_to_cancel(&fp->timer);
+		fpga_dma_signal(fp);
+	} else if (fp->unsignalled == 1 && fp->delay) {
+		hrtimer_start(&fp->timer, fp->delay, HRTIMER_MODE_REL);
+	}
+	spin_unlock_irqrestore(&fp->lock, flags);
+}
+
+/* completion callback, tasklet context */
+static void fpga_dma_req_done(struct fpga_dma_req *req, u32 dir)
+{
+	struct fpga_dma_pdata *pdata = req->pdata;
+	bool async = req->iocb;
+
+	trace_fpga_dma_callback(dir, req->cookie, req->len,
+				fpga_dma_req_nents(req));
+	fpga_dma_stat(pdata, dir, req->len, FPGA_DMA_STAGE_ISSUE,
+		      req->issued);
+	req->completed = ktime_get();
+	if (req->fp)
+		fpga_dma_notify(req->fp);
+	/* a waiter may free the request from here on */
+	complete(&req->done);
+	/*
+	 * nobody waits for an aio request, retire it in process context;
+	 * the same frees the slot of a poll()er waiting for room
+	 */
+	if (async || wq_has_sleeper(&pdata->room_wait))
+		schedule_work(&pdata->reap_work);
+}
+
+static void fpga_dma_dma_rx_done(void *arg)
+{
+	fpga_dma_req_done(arg, FPGA_DMA_RX);
+}
+
+static void fpga_dma_dma_tx_done(void *arg)
+{
+	fpga_dma_req_done(arg, FPGA_DMA_TX);
+}
+
+/* a ring period is full; the consumer index is only read, never trusted */
+static void fpga_dma_ring_period(void *arg)
+{
+	struct fpga_dma_ring *ring = arg;
+	struct fpga_dma_ring_ctrl *ctrl = ring->ctrl;
+	u32 produced = ctrl->produced + 1;
+
+	if (produced - READ_ONCE(ctrl->consumed) > ctrl->periods)
+		ctrl->overruns++;
+	/* period data is visible before the index that publishes it */
+	smp_wmb();
+	WRITE_ONCE(ctrl->produced, produced);
+	trace_fpga_dma_callback(FPGA_DMA_RX, ring->cookie, ctrl->period_len, 1);
+	wake_up_interruptible(&ring->wait);
+}
+
+/*
+ * Prepare a descriptor for @req and put it on @q. The caller holds
+ * q->lock and has made room in the queue.
+ */
+static int fpga_dma_dma_submit(struct platform_device *pdev,
+			       struct fpga_dma_queue *q,
+			       struct dma_slave_config *dmaconf,
+			       struct fpga_dma_req *req,
+			       dma_async_tx_callback callback)
+{
+	struct fpga_dma_pdata *pdata = platform_get_drvdata(pdev);
+	struct dma_async_tx_descriptor *dmadesc = NULL;
+
+	/* set up slave config */
+	if (dmaengine_slave_config(q->chan, dmaconf) < 0) {
+		dev_err(&pdev->dev, "dmaengine_slave_config() failure");
+		return -EINVAL;
+	}
+
+	/* get dmadesc */
+	if (req->sgs)
+		dmadesc = dmaengine_prep_slave_sg(q->chan,
+						  req->sgs,
+						  req->sgnum,
+						  dmaconf->direction,
+						  DMA_PREP_INTERRUPT);
+	else
+		dmadesc = dmaengine_prep_slave_single(q->chan,
+						      req->dma_addr,
+						      req->len,
+						      dmaconf->direction,
+						      DMA_PREP_INTERRUPT);
+	if (!dmadesc)
+		return -ENOMEM;
+	dmadesc->callback = callback;
+	dmadesc->callback_param = req;
+
+	/* start DMA */
+	req->cookie = dmaengine_submit(dmadesc);
+	if (dma_submit_error(req->cookie)) {
+		dev_err(&pdev->dev, "cookie error on dmaengine_submit\n");
+		return -EIO;
+	}
+	list_add_tail(&req->node, &q->inflight);
+	q->depth++;
+	q->transfers++;
+	q->last_segs = fpga_dma_req_nents(req);
+	q->segments += q->last_segs;
+	q->max_segs = max(q->max_segs, q->last_segs);
+	trace_fpga_dma_issue(q == &pdata->rxq ? FPGA_DMA_RX : FPGA_DMA_TX,
+			     req->cookie, req->len, q->last_segs);
+	fpga_dma_stat(pdata, q == &pdata->rxq ? FPGA_DMA_RX : FPGA_DMA_TX,
+		      req->len, FPGA_DMA_STAGE_SUBMIT, req->submitted);
+	req->issued = ktime_get();
+	dma_async_issue_pending(q->chan);
+
+	return 0;
+}
+
+static int fpga_dma_dma_start_rx(struct platform_device *pdev,
+				 struct fpga_dma_req *req, u32 burst_size)
+{
+	struct fpga_dma_pdata *pdata = platform_get_drvdata(pdev);
+	struct dma_slave_config dmaconf;
+
+	memset(&dmaconf, 0, sizeof(dmaconf));
+	dmaconf.direction = DMA_DEV_TO_MEM;
+	dmaconf.src_addr = pdata->data_reg_phy + ALT_FPGADMA_DATA_READ;
+	dmaconf.src_addr_width = 8;
+	dmaconf.src_maxburst = burst_size;
+
+	return fpga_dma_dma_submit(pdev, &pdata->rxq, &dmaconf, req,
+				   fpga_dma_dma_rx_done);
+}
+
+static int fpga_dma_dma_start_tx(struct platform_device *pdev,
+				 struct fpga_dma_req *req, u32 burst_size)
+{
+	struct fpga_dma_pdata *pdata = platform_get_drvdata(pdev);
+	struct dma_slave_config dmaconf;
+
+	memset(&dmaconf, 0, sizeof(dmaconf));
+	dmaconf.direction = DMA_MEM_TO_DEV;
+	dmaconf.dst_addr = pdata->data_reg_phy + ALT_FPGADMA_DATA_WRITE;
+	dmaconf.dst_addr_width = 8;
+	dmaconf.dst_maxburst = burst_size;
+
+	return fpga_dma_dma_submit(pdev, &pdata->txq, &dmaconf, req,
+				   fpga_dma_dma_tx_done);
+}
+
+static int fpga_dma_dma_start_cyclic(struct platform_device *pdev,
+				     struct fpga_dma_ring *ring, u32 burst_size)
+{
+	struct fpga_dma_pdata *pdata = platform_get_drvdata(pdev);
+	struct fpga_dma_ring_ctrl *ctrl = ring->ctrl;
+	struct dma_async_tx_descriptor *dmadesc;
+	struct dma_slave_config dmaconf;
+
+	memset(&dmaconf, 0, sizeof(dmaconf));
+	dmaconf.direction = DMA_DEV_TO_MEM;
+	dmaconf.src_addr = pdata->data_reg_phy + ALT_FPGADMA_DATA_READ;
+	dmaconf.src_addr_width = 8;
+	dmaconf.src_maxburst = burst_size;
+	if (dmaengine_slave_config(pdata->rxchan, &dmaconf) < 0) {
+		dev_err(&pdev->dev, "dmaengine_slave_config() failure");
+		return -EINVAL;
+	}
+
+	dmadesc = dmaengine_prep_dma_cyclic(pdata->rxchan,
+					    ring->dma + ctrl->data_offset,
+					    ctrl->period_len * ctrl->periods,
+					    ctrl->period_len, DMA_DEV_TO_MEM,
+					    DMA_PREP_INTERRUPT);
+	if (!dmadesc)
+		return -ENOMEM;
+	dmadesc->callback = fpga_dma_ring_period;
+	dmadesc->callback_param = ring;
+
+	ring->cookie = dmaengine_submit(dmadesc);
+	if (dma_submit_error(ring->cookie)) {
+		dev_err(&pdev->dev, "cookie error on dmaengine_submit\n");
+		return -EIO;
+	}
+	dma_async_issue_pending(pdata->rxchan);
+	return 0;
+}
+
+static void fpga_dma_reap_work(struct work_struct *work)
+{
+	fpga_dma_reap(container_of(work, struct fpga_dma_pdata, reap_work));
+}
+
+static void fpga_dma_dma_shutdown(struct fpga_dma_pdata *pdata)
+{
+	/* queues only exist once both channels were acquired */
+	if (pdata->rxq.chan)
+		fpga_dma_ring_stop(pdata, NULL);
+	if (pdata->txq.chan) {
+		mutex_lock(&pdata->txq.lock);
+		fpga_dma_queue_abort(pdata, &pdata->txq, -ESHUTDOWN);
+		mutex_unlock(&pdata->txq.lock);
+	}
+	if (pdata->rxq.chan) {
+		mutex_lock(&pdata->rxq.lock);
+		fpga_dma_queue_abort(pdata, &pdata->rxq, -ESHUTDOWN);
+		mutex_unlock(&pdata->rxq.lock);
+	}
+	pdata->txq.chan = pdata->rxq.chan = NULL;
+
+	if (pdata->txchan) {
+		dmaengine_terminate_all(pdata->txchan);
+		dma_release_channel(pdata->txchan);
+	}
+	if (pdata->rxchan) {
+		dmaengine_terminate_all(pdata->rxchan);
+		dma_release_channel(pdata->rxchan);
+	}
+	pdata->rxchan = pdata->txchan = NULL;
+}
+
+static int fpga_dma_dma_init(struct fpga_dma_pdata *pdata)
+{
+	struct platform_device *pdev = pdata->pdev;
+
+	pdata->txchan = dma_request_slave_channel(&pdev->dev, "tx");
+	if (pdata->txchan)
+		dev_dbg(&pdev->dev, "TX channel %s %d selected\n",
+			dma_chan_name(pdata->txchan), pdata->txchan->chan_id);
+	else
+		dev_err(&pdev->dev, "could not get TX dma channel\n");
+
+	pdata->rxchan = dma_request_slave_channel(&pdev->dev, "rx");
+	if (pdata->rxchan)
+		dev_dbg(&pdev->dev, "RX channel %s %d selected\n",
+			dma_chan_name(pdata->rxchan), pdata->rxchan->chan_id);
+	else
+		dev_err(&pdev->dev, "could not get RX dma channel\n");
+
+	if (!pdata->rxchan && !pdata->txchan)
+		/* both channels not there, maybe it's
+		   bcs dma isn't loaded... */
+		return -EPROBE_DEFER;
+
+	if (!pdata->rxchan || !pdata->txchan)
+		return -ENOMEM;
+
+	fpga_dma_queue_init(&pdata->txq, pdata->txchan);
+	fpga_dma_queue_init(&pdata->rxq, pdata->rxchan);
+
+	return 0;
+}
+
+/* --------------------------------------------------------------------- */
+
+static void __iomem *request_and_map(struct platform_device *pdev,
+				     const struct resource *res)
+{
+	void __iomem *ptr;
+
+	if (!devm_request_mem_region(&pdev->dev, res->start, resource_size(res),
+				     pdev->name)) {
+		dev_err(&pdev->dev, "unable to request %s\n", res->name);
+		return NULL;
+	}
+
+	ptr = devm_ioremap(&pdev->dev, res->start, resource_size(res));
+	if (!ptr)
+		dev_err(&pdev->dev, "ioremap of %s failed!", res->name);
+
+	return ptr;
+}
+
+static void fpga_dma_destroy_req_pool(void *data)
+{
+	mempool_destroy(data);
+}
+
+static void fpga_dma_unmap_bounce(void *data)
+{
+	struct fpga_dma_pdata *pdata = data;
+	struct device *dev = &pdata->pdev->dev;
+
+	dma_unmap_single(dev, pdata->read_buf_dma, pdata->fifo_size_bytes,
+			 DMA_FROM_DEVICE);
+	dma_unmap_single(dev, pdata->write_buf_dma, pdata->fifo_size_bytes,
+			 DMA_TO_DEVICE);
+}
+
+static int fpga_dma_map_bounce(struct fpga_dma_pdata *pdata)
+{
+	struct device *dev = &pdata->pdev->dev;
+
+	pdata->read_buf_dma = dma_map_single(dev, pdata->read_buf,
+					     pdata->fifo_size_bytes,
+					     DMA_FROM_DEVICE);
+	if (dma_mapping_error(dev, pdata->read_buf_dma))
+		return -ENOMEM;
+	pdata->write_buf_dma = dma_map_single(dev, pdata->write_buf,
+					      pdata->fifo_size_bytes,
+					      DMA_TO_DEVICE);
+	if (dma_mapping_error(dev, pdata->write_buf_dma)) {
+		dma_unmap_single(dev, pdata->read_buf_dma,
+				 pdata->fifo_size_bytes, DMA_FROM_DEVICE);
+		return -ENOMEM;
+	}
+	return devm_add_action_or_reset(dev, fpga_dma_unmap_bounce, pdata);
+}
+
+/* --------------------------------------------------------------------- */
+
+/* loopback bytes per candidate and pass, a multiple of any burst */
+#define FPGA_DMA_CAL_LEN		SZ_64K
+#define FPGA_DMA_CAL_PASSES		8
+
+static void fpga_dma_set_watermarks(struct fpga_dma_pdata *pdata, u32 wr,
+				    u32 rd)
+{
+	writel(wr, pdata->csr_reg + ALT_FPGADMA_CSR_WR_WTRMK);
+	writel(rd, pdata->csr_reg + ALT_FPGADMA_CSR_RD_WTRMK);
+}
+
+/* FPGA_DMA_CAL_PASSES full duplex loopbacks of @buf into @buf + len */
+static int fpga_dma_cal_run(struct fpga_dma_pdata *pdata,
+			    struct fpga_dma_cal *cal, u8 *buf, dma_addr_t dma)
+{
+	struct fpga_dma_req *txreq, *rxreq;
+	unsigned int len = FPGA_DMA_CAL_LEN;
+	u32 burst_size;
+	ktime_t start;
+	s64 ns;
+	int i, rx_ret, ret = 0;
+
+	pdata->burst_words = cal->burst;
+	burst_size = fpga_dma_calc_burst(pdata, &len);
+	fpga_dma_set_watermarks(pdata, cal->wr_wtrmk, cal->rd_wtrmk);
+	writel(1, pdata->csr_reg + ALT_FPGADMA_CSR_FIFO_CLEAR);
+
+	start = ktime_get();
+	for (i = 0; i < FPGA_DMA_CAL_PASSES && !ret; i++) {
+		txreq = __fpga_dma_req_alloc(pdata, NULL, len, GFP_KERNEL);
+		rxreq = __fpga_dma_req_alloc(pdata, NULL, len, GFP_KERNEL);
+		if (!txreq || !rxreq) {
+			if (txreq)
+				fpga_dma_req_free(pdata, txreq);
+			if (rxreq)
+				fpga_dma_req_free(pdata, rxreq);
+			return -ENOMEM;
+		}
+		txreq->dma_addr = dma;
+		rxreq->dma_addr = dma + len;
+
+		ret = fpga_dma_queue_start(pdata, FPGA_DMA_RX, rxreq,
+					   burst_size, false, NULL);
+		if (ret) {
+			fpga_dma_req_free(pdata, txreq);
+			break;
+		}
+		ret = fpga_dma_queue_start(pdata, FPGA_DMA_TX, txreq,
+					   burst_size, false, NULL);
+		if (!ret)
+			ret = fpga_dma_queue_flush(pdata, NULL, &pdata->txq);
+		rx_ret = fpga_dma_queue_flush(pdata, NULL, &pdata->rxq);
+		if (!ret)
+			ret = rx_ret;
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (!ret && memcmp(buf, buf + len, len))
+		ret = -EILSEQ;
+	if (!ret)
+		cal->kbps = div64_u64((u64)len * FPGA_DMA_CAL_PASSES *
+				      NSEC_PER_SEC, max_t(s64, ns, 1) * 1024);
+	return ret;
+}
+
+/*
+ * Sweep power of two bursts up to half the FIFO, each with two write and
+ * two read watermarks, over the loopback and keep the fastest candidate
+ * that moved the data intact and program it. The result belongs to this
+ * instance alone, the burst in pdata and the watermarks in its CSR; the
+ * module parameters stay the defaults of instances that aren't calibrated
+ * or whose sweep fails. The table is kept for debugfs "calibration".
+ */
+static int fpga_dma_calibrate(struct fpga_dma_pdata *pdata)
+{
+	struct device *dev = &pdata->pdev->dev;
+	struct fpga_dma_cal *cal, *best = NULL;
+	unsigned int n = 0, burst, w, r, i;
+	dma_addr_t dma;
+	u8 *buf;
+
+	if (pdata->fifo_depth < 2)
+		return -EINVAL;
+
+	for (burst = 1; burst <= pdata->fifo_depth / 2; burst <<= 1)
+		n += 4;
+	pdata->cal = devm_kcalloc(dev, n, sizeof(*pdata->cal), GFP_KERNEL);
+	if (!pdata->cal)
+		return -ENOMEM;
+	buf = dma_alloc_coherent(dev, 2 * FPGA_DMA_CAL_LEN, &dma, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	for (i = 0; i < FPGA_DMA_CAL_LEN; i++)
+		buf[i] = i ^ (i >> 8);
+
+	cal = pdata->cal;
+	for (burst = 1; burst <= pdata->fifo_depth / 2; burst <<= 1) {
+		for (w = 1; w <= 2; w++) {
+			for (r = 0; r < 2; r++) {
+				/* a 1 word burst has one sensible rd_wtrmk */
+				if (r && burst == 1)
+					continue;
+				cal->burst = burst;
+				cal->wr_wtrmk = pdata->fifo_depth - w * burst;
+				cal->rd_wtrmk = r ? burst - 1 : 0;
+				memset(buf + FPGA_DMA_CAL_LEN, 0,
+				       FPGA_DMA_CAL_LEN);
+				cal->result = fpga_dma_cal_run(pdata, cal, buf,
+							       dma);
+				if (!cal->result &&
+				    (!best || cal->kbps > best->kbps))
+					best = cal;
+				cal++;
+			}
+		}
+	}
+	pdata->cal_n = cal - pdata->cal;
+	dma_free_coherent(dev, 2 * FPGA_DMA_CAL_LEN, buf, dma);
+	writel(1, pdata->csr_reg + ALT_FPGADMA_CSR_FIFO_CLEAR);
+
+	if (!best) {
+		pdata->burst_words = 0;
+		dev_warn(dev, "calibration found no working burst size\n");
+		return -EIO;
+	}
+	pdata->burst_words = best->burst;
+	fpga_dma_set_watermarks(pdata, best->wr_wtrmk, best->rd_wtrmk);
+	dev_info(dev, "calibrated burst %u words, watermarks wr %u rd %u, "
+		 "%llu KiB/s\n", best->burst, best->wr_wtrmk, best->rd_wtrmk,
+		 best->kbps);
+	return 0;
+}
+
+/* --------------------------------------------------------------------- */
+
+static void fpga_dma_free_pcpu(void *data)
+{
+	struct fpga_dma_pdata *pdata = data;
+	struct fpga_dma_pcpu *pc;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		pc = per_cpu_ptr(pdata->pcpu, cpu);
+		for (i = 0; i < FPGA_DMA_PCPU_SLOTS; i++) {
+			if (!pc->virt[i])
+				continue;
+			dma_unmap_single(&pdata->pdev->dev, pc->dma[i],
+					 FPGA_DMA_PCPU_SIZE, DMA_BIDIRECTIONAL);
+			kfree(pc->virt[i]);
+		}
+	}
+}
+
+static int fpga_dma_alloc_pcpu(struct fpga_dma_pdata *pdata)
+{
+	struct device *dev = &pdata->pdev->dev;
+	struct fpga_dma_pcpu *pc;
+	dma_addr_t dma;
+	void *virt;
+	int cpu, i, ret;
+
+	pdata->pcpu = devm_alloc_percpu(dev, struct fpga_dma_pcpu);
+	if (!pdata->pcpu)
+		return -ENOMEM;
+	ret = devm_add_action_or_reset(dev, fpga_dma_free_pcpu, pdata);
+	if (ret)
+		return ret;
+
+	for_each_possible_cpu(cpu) {
+		pc = per_cpu_ptr(pdata->pcpu, cpu);
+		for (i = 0; i < FPGA_DMA_PCPU_SLOTS; i++) {
+			virt = kmalloc_node(FPGA_DMA_PCPU_SIZE, GFP_KERNEL,
+					    cpu_to_node(cpu));
+			if (!virt)
+				return -ENOMEM;
+			dma = dma_map_single(dev, virt, FPGA_DMA_PCPU_SIZE,
+					     DMA_BIDIRECTIONAL);
+			if (dma_mapping_error(dev, dma)) {
+				kfree(virt);
+				return -ENOMEM;
+			}
+			pc->virt[i] = virt;
+			pc->dma[i] = dma;
+		}
+	}
+	return 0;
+}
+
+#define FPGA_DMA_TUNE_LOOPS	32
+
+/*
+ * Pick this instance's copy threshold: the largest power of two for which
+ * copying into a slot and syncing it beats building and mapping a
+ * scatterlist over the same number of pages. The get_user_pages() part of
+ * pinning can't be timed without a user mm, so the threshold errs on the
+ * low side.
+ */
+static void fpga_dma_tune_bounce(struct fpga_dma_pdata *pdata)
+{
+	struct device *dev = &pdata->pdev->dev;
+	/* nothing is queued yet, any CPU's slots will do */
+	struct fpga_dma_pcpu *pc = raw_cpu_ptr(pdata->pcpu);
+	struct page *pages[FPGA_DMA_PCPU_SIZE / PAGE_SIZE + 1];
+	struct sg_table sgt;
+	unsigned int size, n, i, best = 0;
+	s64 copy_ns, map_ns;
+	ktime_t start;
+	void *src;
+
+	src = kzalloc(FPGA_DMA_PCPU_SIZE, GFP_KERNEL);
+	if (!src)
+		return;
+
+	for (size = 64; size <= FPGA_DMA_PCPU_SIZE; size <<= 1) {
+		start = ktime_get();
+		for (i = 0; i < FPGA_DMA_TUNE_LOOPS; i++) {
+			memcpy(pc->virt[0], src, size);
+			dma_sync_single_for_device(dev, pc->dma[0], size,
+						   DMA_BIDIRECTIONAL);
+		}
+		copy_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		n = DIV_ROUND_UP(size, PAGE_SIZE);
+		for (i = 0; i < n; i++)
+			pages[i] = virt_to_page(src + i * PAGE_SIZE);
+		start = ktime_get();
+		for (i = 0; i < FPGA_DMA_TUNE_LOOPS; i++) {
+			if (sg_alloc_table_from_pages(&sgt, pages, n, 0, size,
+						      GFP_KERNEL))
+				goto out;
+			if (!dma_map_sg(dev, sgt.sgl, sgt.nents,
+					DMA_TO_DEVICE)) {
+				sg_free_table(&sgt);
+				goto out;
+			}
+			dma_unmap_sg(dev, sgt.sgl, sgt.nents, DMA_TO_DEVICE);
+			sg_free_table(&sgt);
+		}
+		map_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		dev_dbg(dev, "bounce %u bytes: copy %lld ns, map %lld ns\n",
+			size, copy_ns / FPGA_DMA_TUNE_LOOPS,
+			map_ns / FPGA_DMA_TUNE_LOOPS);
+		if (copy_ns >= map_ns)
+			break;
+		best = size;
+	}
+out:
+	kfree(src);
+	pdata->bounce_max = best;
+	dev_info(dev, "copying transfers up to %u bytes\n", best);
+}
+
+static void fpga_dma_put_id(void *data)
+{
+	struct fpga_dma_pdata *pdata = data;
+
+	ida_simple_remove(&fpga_dma_ida, pdata->id);
+}
+
+/*
+ * Number this instance: the "fpga-dma" alias of its node if the device
+ * tree has one, so the names stay put when nodes are added, else the
+ * lowest free number.
+ */
+static int fpga_dma_get_id(struct fpga_dma_pdata *pdata)
+{
+	struct device *dev = &pdata->pdev->dev;
+	int id;
+
+	id = of_alias_get_id(dev->of_node, "fpga-dma");
+	if (id >= 0)
+		id = ida_simple_get(&fpga_dma_ida, id, id + 1, GFP_KERNEL);
+	else
+		id = ida_simple_get(&fpga_dma_ida, 0, 0, GFP_KERNEL);
+	if (id < 0) {
+		dev_err(dev, "no instance number: %d\n", id);
+		return id;
+	}
+	pdata->id = id;
+	snprintf(pdata->name, sizeof(pdata->name), "fpga_dma%d", id);
+	return devm_add_action_or_reset(dev, fpga_dma_put_id, pdata);
+}
+
+static int fpga_dma_remove(struct platform_device *pdev)
+{
+	struct fpga_dma_pdata *pdata = platform_get_drvdata(pdev);
+	dev_dbg(&pdev->dev, "fpga_dma_remove\n");
+	if (pdata->miscdev.this_device)
+		misc_deregister(&pdata->miscdev);
+	/*
+	 * Files and mappings may stay open after unbind. Wait for the file
+	 * operations in progress, each bounded by the DMA timeout, and fail
+	 * any later one; release() then only frees the file's own state.
+	 */
+	down_write(&pdata->remove_lock);
+	pdata->dead = true;
+	up_write(&pdata->remove_lock);
+	/* poll()ers see EPOLLERR now */
+	wake_up_all(&pdata->room_wait);
+
+	debugfs_remove_recursive(pdata->root);
+	fpga_dma_dma_shutdown(pdata);
+	/*
+	 * The channels are terminated, no callback can schedule the reap
+	 * work again, and the queues are empty: what it would retire is gone.
+	 */
+	cancel_work_sync(&pdata->reap_work);
+	fpga_dma_ubuf_drop(pdata, NULL);
+	idr_destroy(&pdata->ubuf_idr);
+	/*
+	 * Touching a pool buffer or ring mapping now raises SIGBUS. Their
+	 * memory is freed with the last mapping, see fpga_dma_put().
+	 */
+	if (pdata->inode)
+		unmap_mapping_range(pdata->inode->i_mapping, 0, 0, 1);
+	return 0;
+}
+
+static int fpga_dma_probe(struct platform_device *pdev)
+{
+	struct resource *csr_reg, *data_reg;
+	struct fpga_dma_pdata *pdata;
+	unsigned int i;
+	int ret;
+
+	pdata = kzalloc(sizeof(struct fpga_dma_pdata), GFP_KERNEL);
+	if (!pdata)
+		return -ENOMEM;
+	kref_init(&pdata->ref);
+	init_rwsem(&pdata->remove_lock);
+	pdata->pdev = pdev;
+	get_device(&pdev->dev);
+	ret = devm_add_action_or_reset(&pdev->dev, fpga_dma_put_action, pdata);
+	if (ret)
+		return ret;
+
+	csr_reg = platform_get_resource_byname(pdev, IORESOURCE_MEM, "csr");
+	data_reg = platform_get_resource_byname(pdev, IORESOURCE_MEM, "data");
+	if (!csr_reg || !data_reg) {
+		dev_err(&pdev->dev, "registers not completely defined\n");
+		return -EINVAL;
+	}
+
+	pdata->csr_reg = request_and_map(pdev, csr_reg);
+	if (!pdata->csr_reg)
+		return -ENOMEM;
+
+	pdata->data_reg = request_and_map(pdev, data_reg);
+	if (!pdata->data_reg)
+		return -ENOMEM;
+	pdata->data_reg_phy = data_reg->start;
+
+	/* read HW and calculate fifo size in bytes */
+	pdata->fifo_depth = readl(pdata->csr_reg + ALT_FPGADMA_CSR_FIFO_DEPTH);
+	pdata->data_width = readl(pdata->csr_reg + ALT_FPGADMA_CSR_DATA_WIDTH);
+	/* 64-bit bus to FIFO */
+	pdata->data_width_bytes = pdata->data_width / sizeof(u64);
+	pdata->fifo_size_bytes = pdata->fifo_depth * pdata->data_width_bytes;
+
+	pdata->read_buf = devm_kzalloc(&pdev->dev, pdata->fifo_size_bytes,
+				       GFP_KERNEL);
+	if (!pdata->read_buf)
+		return -ENOMEM;
+
+	pdata->write_buf = devm_kzalloc(&pdev->dev, pdata->fifo_size_bytes,
+					GFP_KERNEL);
+	if (!pdata->write_buf)
+		return -ENOMEM;
+
+	pdata->stats = devm_alloc_percpu(&pdev->dev, struct fpga_dma_stats);
+	if (!pdata->stats)
+		return -ENOMEM;
+
+	pdata->req_pool = mempool_create_slab_pool(FPGA_DMA_MIN_REQS,
+						   fpga_dma_req_cache);
+	if (!pdata->req_pool)
+		return -ENOMEM;
+	ret = devm_add_action_or_reset(&pdev->dev, fpga_dma_destroy_req_pool,
+				       pdata->req_pool);
+	if (ret)
+		return ret;
+
+	ret = fpga_dma_get_id(pdata);
+	if (ret)
+		return ret;
+
+	/* the bounce buffers stay mapped, transfers only sync them */
+	ret = fpga_dma_map_bounce(pdata);
+	if (ret)
+		return ret;
+	mutex_init(&pdata->bounce_lock);
+
+	pdata->tail_pool = dmam_pool_create("fpga_dma_tail", &pdev->dev,
+					    pdata->fifo_size_bytes,
+					    L1_CACHE_BYTES, 0);
+	if (!pdata->tail_pool)
+		return -ENOMEM;
+
+	ret = fpga_dma_alloc_pcpu(pdata);
+	if (ret)
+		return ret;
+	if (bounce_max < 0)
+		fpga_dma_tune_bounce(pdata);
+
+	/*
+	 * Large coherent allocations come from CMA when the kernel has it,
+	 * so each buffer is one contiguous range and needs one descriptor.
+	 */
+	pdata->buf_size = PAGE_ALIGN(buf_size ? buf_size : PAGE_SIZE);
+	pdata->pool_bufs = pool_bufs;
+	pdata->pool = kcalloc(pool_bufs, sizeof(*pdata->pool), GFP_KERNEL);
+	if (pool_bufs && !pdata->pool)
+		return -ENOMEM;
+	/* freed with pdata, a mapping may outlive the device */
+	for (i = 0; i < pool_bufs; i++) {
+		pdata->pool[i].virt = dma_alloc_coherent(&pdev->dev,
+							 pdata->buf_size,
+							 &pdata->pool[i].dma,
+							 GFP_KERNEL);
+		if (!pdata->pool[i].virt) {
+			dev_err(&pdev->dev, "can't allocate DMA buffer %u "
+				"of %zu bytes\n", i, pdata->buf_size);
+			return -ENOMEM;
+		}
+	}
+
+	ret = fpga_dma_register_dbgfs(pdata);
+	if (ret)
+		return ret;
+
+	platform_set_drvdata(pdev, pdata);
+
+	mutex_init(&pdata->ubuf_lock);
+	INIT_LIST_HEAD(&pdata->ubufs);
+#ifdef CONFIG_MMU_NOTIFIER
+	pdata->ubuf_tree = RB_ROOT_CACHED;
+#endif
+	INIT_WORK(&pdata->reap_work, fpga_dma_reap_work);
+	init_waitqueue_head(&pdata->room_wait);
+	idr_init(&pdata->ubuf_idr);
+
+	ret = fpga_dma_dma_init(pdata);
+	if (ret) {
+		fpga_dma_remove(pdev);
+		return ret;
+	}
+
+	/* OK almost ready, set up the watermarks */
+	/* we may need to tweak this for single/burst, etc */
+	/* a failed sweep falls back to the parameters */
+	/* by default we use read watermark of 0 so that rx_burst line
+	   is always asserted, i.e. no single-only requests */
+	if (!calibrate || fpga_dma_calibrate(pdata))
+		fpga_dma_set_watermarks(pdata,
+					wr_wtrmk >= 0 ? wr_wtrmk :
+					pdata->fifo_depth - max_burst_words,
+					rd_wtrmk >= 0 ? rd_wtrmk : 0);
+
+	ret = fpga_dma_register_chrdev(pdata);
+	if (ret) {
+		fpga_dma_remove(pdev);
+		return ret;
+	}
+
+	return 0;
+}
+
+#ifdef CONFIG_OF
+static const struct of_device_id fpga_dma_of_match[] = {
+	{.compatible = "altr,fpga-dma",},
+	{},
+};
+
+MODULE_DEVICE_TABLE(of, fpga_dma_of_match);
+#endif
+
+static struct platform_driver fpga_dma_driver = {
+	.probe = fpga_dma_probe,
+	.remove = fpga_dma_remove,
+	.driver = {
+		   .name = "fpga_dma",
+		   .owner = THIS_MODULE,
+		   .of_match_table = of_match_ptr(fpga_dma_of_match),
+		   },
+};
+
+static int __init fpga_dma_init(void)
+{
+	int ret;
+
+	fpga_dma_req_cache = KMEM_CACHE(fpga_dma_req, 0);
+	if (!fpga_dma_req_cache)
+		return -ENOMEM;
+
+	ret = platform_driver_probe(&fpga_dma_driver, fpga_dma_probe);
+	if (ret)
+		kmem_cache_destroy(fpga_dma_req_cache);
+	return ret;
+}
+
+static void __exit fpga_dma_exit(void)
+{
+	platform_driver_unregister(&fpga_dma_driver);
+	kmem_cache_destroy(fpga_dma_req_cache);
+	ida_destroy(&fpga_dma_ida);
+}
+
+late_initcall(fpga_dma_init);
+module_exit(fpga_dma_exit);
+
+MODULE_AUTHOR("Graham Moore (Altera)");
+MODULE_DESCRIPTION("Altera FPGA DMA Example Driver");
+MODULE_LICENSE("GPL v2");
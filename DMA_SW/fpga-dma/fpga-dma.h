@@ -0,0 +1,160 @@
+/*
+ * FPGA DMA transfer module - user space interface
+ *
+ * Shared between the driver and the test applications.
+ */
+#ifndef _FPGA_DMA_H
+#define _FPGA_DMA_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/*
+ * One device and one debugfs directory per FIFO instance, numbered from 0
+ * in probe order or by the fpga-dmaN device tree aliases
+ */
+#define FPGA_DMA_DEV		"/dev/fpga_dma0"
+#define FPGA_DMA_DEV_FMT	"/dev/fpga_dma%d"
+#define FPGA_DMA_DBGFS		"/sys/kernel/debug/fpga_dma0"
+
+/*
+ * Transfer engines. read()/write() use the one selected per open file with
+ * FPGA_DMA_IOC_SET_ENGINE; the others are picked per request:
+ * FPGA_DMA_IOC_SUBMIT pins the caller's pages (sg), FPGA_DMA_XFER_DRVBUF
+ * uses the coherent pool and FPGA_DMA_IOC_RING_START the cyclic RX ring.
+ */
+#define FPGA_DMA_ENGINE_SG	0	/* pin user pages, default */
+#define FPGA_DMA_ENGINE_BOUNCE	1	/* copy through a FIFO sized buffer */
+
+/* transfer directions */
+#define FPGA_DMA_TX		0	/* memory to FIFO */
+#define FPGA_DMA_RX		1	/* FIFO to memory */
+#define FPGA_DMA_TXRX		2	/* both, FPGA_DMA_IOC_REG_BUF only */
+
+/*
+ * addr is an offset into the mmap()ed driver buffer selected by handle
+ * (0 .. pool_bufs - 1), not a user pointer
+ */
+#define FPGA_DMA_XFER_DRVBUF	(1 << 0)
+/* addr is an offset into the registered buffer handle */
+#define FPGA_DMA_XFER_REGBUF	(1 << 1)
+/*
+ * whoever waits for this transfer busy-polls the channel for up to the
+ * poll_us module parameter before sleeping; for transfers of a few KB
+ */
+#define FPGA_DMA_XFER_POLL	(1 << 2)
+
+struct fpga_dma_xfer {
+	__u64 addr;		/* user address, or offset with DRVBUF/REGBUF */
+	__u32 len;		/* in: bytes requested, out: bytes queued */
+	__u32 dir;		/* FPGA_DMA_TX or FPGA_DMA_RX */
+	__u32 flags;		/* FPGA_DMA_XFER_* */
+	__s32 cookie;		/* out: handle for FPGA_DMA_IOC_WAIT */
+	__u32 handle;		/* pool index or registered buffer handle */
+	__u32 reserved;
+};
+
+/*
+ * TX and RX queued together, returns once both are done. Equal lengths
+ * above the FIFO size are split by the driver into FIFO sized pairs.
+ */
+struct fpga_dma_transceive {
+	struct fpga_dma_xfer tx;	/* dir is ignored */
+	struct fpga_dma_xfer rx;
+};
+
+/*
+ * A user buffer pinned once and used by many transfers in dir. It stops
+ * working, transfers fail with EFAULT, once its range is unmapped or
+ * remapped, or written after a fork() made it copy on write.
+ */
+struct fpga_dma_buf {
+	__u64 addr;
+	__u64 len;
+	__u32 handle;		/* out */
+	__u32 dir;		/* FPGA_DMA_TX, FPGA_DMA_RX or FPGA_DMA_TXRX */
+};
+
+struct fpga_dma_wait {
+	__u32 dir;
+	__s32 cookie;		/* 0 waits for everything queued in dir */
+};
+
+struct fpga_dma_status {
+	__u32 fifo_depth;	/* in words */
+	__u32 data_width;	/* bytes per word */
+	__u32 fifo_used;	/* words currently in the FIFO */
+	__u32 fifo_full;
+	__u32 fifo_empty;
+	__u32 queue_depth;
+	__u32 tx_inflight;
+	__u32 rx_inflight;
+	__s32 tx_last_cookie;	/* last completed transfer per direction */
+	__s32 rx_last_cookie;
+	__u32 buf_size;		/* bytes per pool buffer */
+	__u32 pool_bufs;	/* buffer n is mmap()ed at offset n * buf_size */
+};
+
+/*
+ * Continuous RX: the RX channel loops over a ring of periods. The ring is
+ * mmap()ed at mmap_offset and starts with struct fpga_dma_ring_ctrl;
+ * period n (free running) is at data_offset + (n % periods) * period_len.
+ */
+struct fpga_dma_ring_setup {
+	__u32 period_len;	/* in: bytes, multiple of the data width */
+	__u32 periods;		/* in: at least 2 */
+	__u64 mmap_offset;	/* out */
+	__u64 mmap_len;		/* out */
+};
+
+struct fpga_dma_ring_ctrl {
+	__u32 produced;		/* periods filled so far, free running */
+	__u32 consumed;		/* written by the consumer, free running */
+	__u32 overruns;		/* periods overwritten before consumed */
+	__u32 period_len;
+	__u32 periods;
+	__u32 data_offset;
+};
+
+/*
+ * Completion notification per open file: poll() reports POLLIN and the
+ * eventfd, if one is given, is signalled once batch transfers of this
+ * file completed, or delay_us after the first of them (0: no limit).
+ * FPGA_DMA_IOC_EVENTS collects the count and retires finished transfers.
+ */
+struct fpga_dma_notify {
+	__s32 eventfd;		/* -1 for none */
+	__u32 batch;		/* 0 or 1: every completion */
+	__u32 delay_us;
+	__u32 reserved;
+};
+
+/*
+ * Many FPGA_DMA_IOC_SUBMITs in one call: count transfers read from and
+ * written back to the array at xfers, queued in order. Returns how many
+ * were queued, or the error if not even the first one was.
+ */
+struct fpga_dma_batch {
+	__u64 xfers;		/* struct fpga_dma_xfer[count] */
+	__u32 count;
+	__u32 queued;		/* out */
+};
+
+#define FPGA_DMA_IOC_MAGIC	'F'
+#define FPGA_DMA_IOC_SUBMIT	_IOWR(FPGA_DMA_IOC_MAGIC, 0, struct fpga_dma_xfer)
+#define FPGA_DMA_IOC_WAIT	_IOW(FPGA_DMA_IOC_MAGIC, 1, struct fpga_dma_wait)
+#define FPGA_DMA_IOC_STATUS	_IOR(FPGA_DMA_IOC_MAGIC, 2, struct fpga_dma_status)
+#define FPGA_DMA_IOC_REG_BUF	_IOWR(FPGA_DMA_IOC_MAGIC, 3, struct fpga_dma_buf)
+#define FPGA_DMA_IOC_UNREG_BUF	_IOW(FPGA_DMA_IOC_MAGIC, 4, __u32)
+#define FPGA_DMA_IOC_RING_START	_IOWR(FPGA_DMA_IOC_MAGIC, 5, struct fpga_dma_ring_setup)
+#define FPGA_DMA_IOC_RING_STOP	_IO(FPGA_DMA_IOC_MAGIC, 6)
+/* in: last produced count seen, out: current produced count */
+#define FPGA_DMA_IOC_RING_WAIT	_IOWR(FPGA_DMA_IOC_MAGIC, 7, __u32)
+#define FPGA_DMA_IOC_SET_ENGINE	_IOW(FPGA_DMA_IOC_MAGIC, 8, __u32)
+#define FPGA_DMA_IOC_TRANSCEIVE	_IOWR(FPGA_DMA_IOC_MAGIC, 9, struct fpga_dma_transceive)
+#define FPGA_DMA_IOC_SET_NOTIFY	_IOW(FPGA_DMA_IOC_MAGIC, 10, struct fpga_dma_notify)
+/* out: completions signalled since the last call */
+#define FPGA_DMA_IOC_EVENTS	_IOR(FPGA_DMA_IOC_MAGIC, 11, __u32)
+#define FPGA_DMA_IOC_SUBMIT_BATCH _IOWR(FPGA_DMA_IOC_MAGIC, 12, struct fpga_dma_batch)
+
+#endif /* _FPGA_DMA_H */
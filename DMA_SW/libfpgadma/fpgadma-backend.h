@@ -0,0 +1,42 @@
+/*
+ * libfpgadma - backends, private to the library
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * A handle talks either to /dev/fpga_dmaN or to the software loopback in
+ * fpgadma-loopback.c. Everything above goes through ioctl() with the
+ * driver's commands and structures and through rw() for read()/write(),
+ * so a backend only has to implement the driver's interface.
+ */
+#ifndef _FPGADMA_BACKEND_H
+#define _FPGADMA_BACKEND_H
+
+#include <sys/types.h>
+#include "fpgadma.h"
+
+struct fpgadma_ops {
+	/* FPGA_DMA_IOC_*, returns >= 0 or a negative errno */
+	int (*ioctl)(struct fpgadma_dev *dma, unsigned long cmd, void *arg);
+	/* write() for FPGA_DMA_TX, read() for FPGA_DMA_RX */
+	ssize_t (*rw)(struct fpgadma_dev *dma, uint32_t dir, void *buf,
+		      size_t len);
+	/* FPGADMA_CSR_* words, NULL where the registers aren't reachable */
+	int (*csr_read)(struct fpgadma_dev *dma, unsigned int reg,
+			uint32_t *val);
+	int (*csr_write)(struct fpgadma_dev *dma, unsigned int reg,
+			 uint32_t val);
+	void (*release)(struct fpgadma_dev *dma);
+};
+
+struct fpgadma_dev {
+	const struct fpgadma_ops *ops;
+	int fd;			/* what fpgadma_poll() polls for POLLIN */
+	uint32_t data_width;
+	void *priv;		/* backend state */
+};
+
+int fpgadma_setup(struct fpgadma_dev *dma, struct fpgadma_dev **dmap);
+
+#endif /* _FPGADMA_BACKEND_H */
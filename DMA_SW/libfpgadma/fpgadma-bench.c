@@ -0,0 +1,536 @@
+/* libfpgadma Benchmark Suite
+ *
+ * Sweeps transfer size, queue depth, engine, burst size and TX/RX overlap
+ * over the loopback and prints one record per combination with the
+ * throughput and the p50/p99/p99.9 loopback latency, as CSV or JSON, for
+ * regression tracking. Runs against /dev/fpga_dmaN or, with -L, against
+ * the library's software loopback on any Linux host.
+ *
+ *   engine   sg      FPGA_DMA_IOC_SUBMIT on plain user memory (pinned per
+ *                    transfer)
+ *            regbuf  the same from a registered libfpgadma pool
+ *            bounce  write()/read() through the driver's FIFO sized buffer,
+ *                    always one transfer at a time
+ *   overlap  0       TX waited for before its RX is queued; sizes above
+ *                    the FIFO can't work this way and are skipped
+ *            1       RX and TX of a loopback queued in one batch, up to
+ *                    depth loopbacks in flight
+ *
+ * A loopback's latency runs from queueing it to its RX being complete,
+ * so with overlap it includes the time spent behind earlier ones. The
+ * first -w loopbacks of every run are warmup and not counted. Times come
+ * from CLOCK_MONOTONIC_RAW and -c pins the benchmark to one CPU. On the
+ * hardware depth and burst are set through the queue_depth and
+ * max_burst_words module parameters, which are restored at the end.
+ *
+ * make && ./fpgadma-bench -L -f json > lb.json
+ * ./fpgadma-bench [-L] [-i instance] [-e engines] [-s sizes] [-d depths]
+ *                 [-b bursts] [-o overlaps] [-n count] [-w warmup]
+ *                 [-c cpu] [-f csv|json]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "fpgadma.h"
+
+#define PARAM_DIR	"/sys/module/fpga_dma/parameters/"
+#define MAX_LIST	16
+
+enum engine { SG, REGBUF, BOUNCE, NUM_ENGINES };
+
+static const char *const engine_names[NUM_ENGINES] = {
+	"sg", "regbuf", "bounce",
+};
+
+struct list {
+	unsigned long v[MAX_LIST];
+	int n;
+};
+
+struct config {
+	int loopback;
+	int instance;
+	enum engine engine;
+	size_t size;
+	unsigned int depth;
+	unsigned int burst;	/* words, 0: leave as it is */
+	int overlap;
+	int count;
+	int warmup;
+};
+
+struct result {
+	double seconds;
+	double mbps;
+	double p50, p99, p999;	/* us */
+	int errors;
+};
+
+/* the buffers of one run: depth TX slots followed by depth RX slots */
+struct slots {
+	struct fpgadma_pool *pool;
+	struct fpgadma_buf *bufs;
+	char *mem;
+	unsigned int n;
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, int n, double q)
+{
+	int i = q * n;
+
+	return sorted[i < n ? i : n - 1];
+}
+
+/* ------------------------------------------------------------------------ */
+
+static int param_read(const char *name, char *val, size_t len)
+{
+	char path[128];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), PARAM_DIR "%s", name);
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+	ret = fgets(val, len, f) ? 0 : -EIO;
+	fclose(f);
+	return ret;
+}
+
+static int param_write(const char *name, const char *val)
+{
+	char path[128];
+	FILE *f;
+
+	snprintf(path, sizeof(path), PARAM_DIR "%s", name);
+	f = fopen(path, "w");
+	if (!f)
+		return -errno;
+	fputs(val, f);
+	return fclose(f) ? -errno : 0;
+}
+
+static int param_set(const char *name, unsigned long v)
+{
+	char val[32];
+
+	snprintf(val, sizeof(val), "%lu\n", v);
+	return param_write(name, val);
+}
+
+static int open_backend(const struct config *c, struct fpgadma_dev **dma)
+{
+	struct fpgadma_loopback_config lc;
+	int ret;
+
+	if (c->loopback) {
+		memset(&lc, 0, sizeof(lc));
+		lc.queue_depth = c->depth;
+		lc.burst_words = c->burst;
+		return fpgadma_open_loopback(&lc, dma);
+	}
+	ret = param_set("queue_depth", c->depth);
+	if (!ret && c->burst)
+		ret = param_set("max_burst_words", c->burst);
+	if (ret)
+		return ret;
+	return fpgadma_open(c->instance, dma);
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void *slot_ptr(const struct slots *s, const struct config *c,
+		      unsigned int i)
+{
+	return s->pool ? s->bufs[i].ptr : s->mem + (size_t)i * c->size;
+}
+
+static int slots_alloc(struct fpgadma_dev *dma, const struct config *c,
+		       struct slots *s)
+{
+	unsigned int i, w;
+	int ret;
+
+	memset(s, 0, sizeof(*s));
+	s->n = 2 * c->depth;
+	if (c->engine == REGBUF) {
+		s->bufs = calloc(s->n, sizeof(*s->bufs));
+		if (!s->bufs)
+			return -ENOMEM;
+		ret = fpgadma_pool_create(dma, c->size, s->n, &s->pool);
+		for (i = 0; !ret && i < s->n; i++)
+			ret = fpgadma_buf_get(s->pool, &s->bufs[i]);
+		if (ret)
+			return ret;
+	} else if (posix_memalign((void **)&s->mem, 4096, s->n * c->size)) {
+		return -ENOMEM;
+	}
+	for (i = 0; i < c->depth; i++) {
+		for (w = 0; w < c->size / 4; w++)
+			((uint32_t *)slot_ptr(s, c, i))[w] = i << 24 ^ w;
+		memset(slot_ptr(s, c, c->depth + i), 0xff, c->size);
+	}
+	return 0;
+}
+
+static void slots_free(struct slots *s)
+{
+	unsigned int i;
+
+	if (s->pool) {
+		for (i = 0; i < s->n && s->bufs[i].ptr; i++)
+			fpgadma_buf_put(&s->bufs[i]);
+		fpgadma_pool_destroy(s->pool);
+	}
+	free(s->bufs);
+	free(s->mem);
+}
+
+static int add(struct fpgadma_batch *b, const struct slots *s,
+	       const struct config *c, unsigned int i, uint32_t dir)
+{
+	if (s->pool)
+		return fpgadma_batch_add(b, &s->bufs[i], 0, c->size, dir, 0);
+	return fpgadma_batch_add_user(b, slot_ptr(s, c, i), c->size, dir, 0);
+}
+
+/* the bounce engine moves at most one FIFO worth per call */
+static int bounce_loop(struct fpgadma_dev *dma, char *tx, char *rx,
+		       size_t size)
+{
+	ssize_t n;
+	size_t done;
+
+	for (done = 0; done < size; done += n) {
+		n = fpgadma_write(dma, tx + done, size - done);
+		if (n <= 0)
+			return n ? (int)n : -EIO;
+		if (fpgadma_read(dma, rx + done, n) != n)
+			return -EIO;
+	}
+	return 0;
+}
+
+/* one loopback, TX complete before RX is queued */
+static int serial_loop(struct fpgadma_dev *dma, const struct slots *s,
+		       const struct config *c, unsigned int slot)
+{
+	struct fpga_dma_xfer x;
+	struct fpgadma_batch b;
+	uint32_t dir;
+	int ret;
+
+	for (dir = FPGA_DMA_TX; dir <= FPGA_DMA_RX; dir++) {
+		fpgadma_batch_init(&b, &x, 1);
+		add(&b, s, c, dir == FPGA_DMA_TX ? slot : c->depth + slot,
+		    dir);
+		ret = fpgadma_batch_submit(dma, &b);
+		if (ret < 0)
+			return ret;
+		ret = fpgadma_wait(dma, dir, x.cookie);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int run(const struct config *c, struct result *r, double *lat)
+{
+	struct fpga_dma_xfer x[2];
+	struct fpgadma_batch b;
+	struct fpgadma_dev *dma;
+	struct slots s;
+	int total = c->warmup + c->count, head = 0, i, ret;
+	int32_t *cookie;
+	double *start, t0 = 0;
+	unsigned int slot;
+
+	memset(r, 0, sizeof(*r));
+	memset(&s, 0, sizeof(s));
+	ret = open_backend(c, &dma);
+	if (ret)
+		return ret;
+	cookie = calloc(total, sizeof(*cookie));
+	start = calloc(total, sizeof(*start));
+	ret = cookie && start ? slots_alloc(dma, c, &s) : -ENOMEM;
+	if (!ret && c->engine == BOUNCE)
+		ret = fpgadma_set_engine(dma, FPGA_DMA_ENGINE_BOUNCE);
+
+	for (i = 0; !ret && i < total; i++) {
+		slot = i % c->depth;
+		if (i == c->warmup)
+			t0 = now_us();
+		start[i] = now_us();
+		if (c->engine == BOUNCE) {
+			ret = bounce_loop(dma, slot_ptr(&s, c, slot),
+					  slot_ptr(&s, c, c->depth + slot),
+					  c->size);
+		} else if (!c->overlap) {
+			ret = serial_loop(dma, &s, c, slot);
+		} else {
+			/* the slot's previous loopback has to be back */
+			if (i - head == (int)c->depth) {
+				ret = fpgadma_wait(dma, FPGA_DMA_RX,
+						   cookie[head]);
+				lat[head] = now_us() - start[head];
+				head++;
+				if (ret)
+					break;
+			}
+			fpgadma_batch_init(&b, x, 2);
+			add(&b, &s, c, c->depth + slot, FPGA_DMA_RX);
+			add(&b, &s, c, slot, FPGA_DMA_TX);
+			ret = fpgadma_batch_submit(dma, &b);
+			ret = ret == 2 ? 0 : ret < 0 ? ret : -EIO;
+			cookie[i] = x[0].cookie;
+			continue;
+		}
+		lat[i] = now_us() - start[i];
+	}
+	/* drain whatever is still in flight */
+	for (; !ret && c->overlap && head < i; head++) {
+		ret = fpgadma_wait(dma, FPGA_DMA_RX, cookie[head]);
+		lat[head] = now_us() - start[head];
+	}
+
+	if (!ret) {
+		r->seconds = (now_us() - t0) / 1e6;
+		r->mbps = (double)c->size * c->count / r->seconds / 1e6;
+		qsort(lat + c->warmup, c->count, sizeof(*lat), cmp_double);
+		r->p50 = percentile(lat + c->warmup, c->count, 0.5);
+		r->p99 = percentile(lat + c->warmup, c->count, 0.99);
+		r->p999 = percentile(lat + c->warmup, c->count, 0.999);
+		for (slot = 0; slot < c->depth && slot < (unsigned)total;
+		     slot++)
+			if (memcmp(slot_ptr(&s, c, slot),
+				   slot_ptr(&s, c, c->depth + slot), c->size))
+				r->errors++;
+	}
+	slots_free(&s);
+	free(cookie);
+	free(start);
+	fpgadma_close(dma);
+	return ret;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void print_record(const struct config *c, const struct result *r,
+			 int json, int first)
+{
+	const char *backend = c->loopback ? "loopback" : "device";
+
+	if (json)
+		printf("%s  {\"backend\": \"%s\", \"engine\": \"%s\", "
+		       "\"size\": %zu, \"depth\": %u, \"burst\": %u, "
+		       "\"overlap\": %d, \"count\": %d, \"seconds\": %.6f, "
+		       "\"mbps\": %.2f, \"p50_us\": %.2f, \"p99_us\": %.2f, "
+		       "\"p999_us\": %.2f, \"errors\": %d}",
+		       first ? "" : ",\n", backend, engine_names[c->engine],
+		       c->size, c->depth, c->burst, c->overlap, c->count,
+		       r->seconds, r->mbps, r->p50, r->p99, r->p999,
+		       r->errors);
+	else
+		printf("%s,%s,%zu,%u,%u,%d,%d,%.6f,%.2f,%.2f,%.2f,%.2f,%d\n",
+		       backend, engine_names[c->engine], c->size, c->depth,
+		       c->burst, c->overlap, c->count, r->seconds, r->mbps,
+		       r->p50, r->p99, r->p999, r->errors);
+	fflush(stdout);
+}
+
+static int parse_list(char *arg, struct list *l)
+{
+	char *tok;
+
+	l->n = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (l->n == MAX_LIST)
+			return -1;
+		l->v[l->n++] = strtoul(tok, NULL, 0);
+	}
+	return l->n ? 0 : -1;
+}
+
+static int parse_engines(char *arg, struct list *l)
+{
+	char *tok;
+	int e;
+
+	l->n = 0;
+	for (tok = strtok(arg, ","); tok && l->n < MAX_LIST;
+	     tok = strtok(NULL, ",")) {
+		for (e = 0; e < NUM_ENGINES; e++)
+			if (!strcmp(tok, engine_names[e]))
+				break;
+		if (e == NUM_ENGINES) {
+			fprintf(stderr, "unknown engine %s\n", tok);
+			return -1;
+		}
+		l->v[l->n++] = e;
+	}
+	return l->n ? 0 : -1;
+}
+
+static int pin_cpu(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set);
+}
+
+int main(int argc, char *argv[])
+{
+	struct list engines = { { SG, REGBUF }, 2 };
+	struct list sizes = { { 256, 4096, 65536 }, 3 };
+	struct list depths = { { 1, 8 }, 2 };
+	struct list bursts = { { 0 }, 1 };
+	struct list overlaps = { { 1 }, 1 };
+	struct config c = { .count = 2000, .warmup = 100 };
+	char saved_depth[32] = "", saved_burst[32] = "";
+	int json = 0, cpu = -1, first = 1, opt, ret;
+	int e, si, d, bi, o;
+	struct fpga_dma_status st;
+	struct fpgadma_dev *dma;
+	struct result r;
+	double *lat;
+	size_t fifo;
+
+	while ((opt = getopt(argc, argv, "Li:e:s:d:b:o:n:w:c:f:")) != -1) {
+		switch (opt) {
+		case 'L':
+			c.loopback = 1;
+			break;
+		case 'i':
+			c.instance = atoi(optarg);
+			break;
+		case 'e':
+			if (parse_engines(optarg, &engines))
+				return 1;
+			break;
+		case 's':
+		case 'd':
+		case 'b':
+		case 'o':
+			if (parse_list(optarg, opt == 's' ? &sizes :
+				       opt == 'd' ? &depths :
+				       opt == 'b' ? &bursts : &overlaps))
+				return 1;
+			break;
+		case 'n':
+			c.count = atoi(optarg);
+			break;
+		case 'w':
+			c.warmup = atoi(optarg);
+			break;
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'f':
+			json = !strcmp(optarg, "json");
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-L] [-i instance] "
+				"[-e sg,regbuf,bounce] [-s sizes] [-d depths] "
+				"[-b bursts] [-o 0,1] [-n count] [-w warmup] "
+				"[-c cpu] [-f csv|json]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (c.count <= 0 || c.warmup < 0)
+		return 1;
+	if (cpu >= 0 && pin_cpu(cpu)) {
+		perror("sched_setaffinity");
+		return 1;
+	}
+	lat = calloc(c.count + c.warmup, sizeof(*lat));
+	if (!lat)
+		return 1;
+
+	/* the FIFO size decides which serial runs can work at all */
+	ret = c.loopback ? fpgadma_open_loopback(NULL, &dma) :
+	      fpgadma_open(c.instance, &dma);
+	if (!ret) {
+		ret = fpgadma_status(dma, &st);
+		fpgadma_close(dma);
+	}
+	if (ret) {
+		fprintf(stderr, "open: %s\n", strerror(-ret));
+		return 1;
+	}
+	fifo = (size_t)st.fifo_depth * st.data_width;
+	if (!c.loopback) {
+		param_read("queue_depth", saved_depth, sizeof(saved_depth));
+		param_read("max_burst_words", saved_burst,
+			   sizeof(saved_burst));
+	}
+
+	if (json)
+		printf("[\n");
+	else
+		printf("backend,engine,size,depth,burst,overlap,count,seconds,"
+		       "mbps,p50_us,p99_us,p999_us,errors\n");
+	for (e = 0; e < engines.n; e++)
+	for (si = 0; si < sizes.n; si++)
+	for (d = 0; d < depths.n; d++)
+	for (bi = 0; bi < bursts.n; bi++)
+	for (o = 0; o < overlaps.n; o++) {
+		c.engine = engines.v[e];
+		c.size = sizes.v[si];
+		c.depth = depths.v[d];
+		c.burst = bursts.v[bi];
+		/* bounce always waits for each transfer */
+		c.overlap = c.engine == BOUNCE ? 0 : !!overlaps.v[o];
+		if (c.engine == BOUNCE && o)
+			continue;
+		if (!c.size || !c.depth)
+			continue;
+		if (!c.overlap && c.engine != BOUNCE && c.size > fifo) {
+			fprintf(stderr, "%s size %zu: serial TX needs the "
+				"FIFO to hold it, skipped\n",
+				engine_names[c.engine], c.size);
+			continue;
+		}
+		ret = run(&c, &r, lat);
+		if (ret) {
+			fprintf(stderr, "%s size %zu depth %u: %s\n",
+				engine_names[c.engine], c.size, c.depth,
+				strerror(-ret));
+			continue;
+		}
+		print_record(&c, &r, json, first);
+		first = 0;
+	}
+	if (json)
+		printf("\n]\n");
+
+	if (saved_depth[0])
+		param_write("queue_depth", saved_depth);
+	if (saved_burst[0])
+		param_write("max_burst_words", saved_burst);
+	free(lat);
+	return 0;
+}
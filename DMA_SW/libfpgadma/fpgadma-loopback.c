@@ -0,0 +1,833 @@
+/*
+ * libfpgadma - software loopback backend
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * Stands in for the driver, the two PL330 channels and the loopback FIFO
+ * of flow_control_fifo_tx_ack.v. The FIFO is modelled at its CSR port:
+ * the TX and RX watermarks, the request lines derived from them and the
+ * fill level, full and empty flags, data width, depth and clear, with the
+ * reset values of the design, programmed at open the way the driver's
+ * probe does. A thread per direction plays the DMA channel: it takes the
+ * transfers queued like the driver queues them, waits for its burst
+ * request line and copies one burst of up to burst_words words through
+ * the data port per request, so TX and RX run concurrently and complete
+ * asynchronously. Watermarks that keep a request line low stall the
+ * channel until the driver's timeout, as on the board.
+ */
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "fpgadma-backend.h"
+
+#define LB_MAX_QUEUE	1024
+#define LB_MAX_BUFS	64
+
+struct lb_xfer {
+	char *ptr;
+	char *tail;	/* FIFO sized block of this slot, the tail pool's */
+	size_t len;
+	size_t done;
+	int32_t cookie;
+};
+
+struct lb_queue {
+	struct lb_xfer x[LB_MAX_QUEUE];
+	unsigned int first;
+	unsigned int count;
+	int32_t next_cookie;
+	int32_t last_cookie;	/* last completed or dropped */
+	/* the cookies the last abort dropped and what waits on them return */
+	int32_t abort_first;
+	int32_t abort_last;
+	int abort_error;	/* -ETIMEDOUT or -ECANCELED */
+	int error;		/* of an abort, reported by the next wait */
+};
+
+struct lb_buf {
+	char *base;
+	size_t len;
+	uint32_t dir;		/* FPGA_DMA_TX, FPGA_DMA_RX or FPGA_DMA_TXRX */
+};
+
+struct lb_chan {
+	struct fpgadma_dev *dma;
+	uint32_t dir;
+	pthread_t thread;
+	int started;
+};
+
+struct fpgadma_loopback {
+	struct fpgadma_loopback_config cfg;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;	/* any change of FIFO, queues or registers */
+	/* flow_control_fifo_tx_ack */
+	uint32_t tx_water_mark;
+	uint32_t rx_water_mark;
+	char *fifo;
+	uint32_t fifo_head;	/* next word to read */
+	uint32_t fifo_used;	/* words */
+	/* DMA channels and driver */
+	struct lb_chan chan[2];
+	int stop;
+	struct lb_queue q[2];
+	struct lb_buf bufs[LB_MAX_BUFS];	/* handle n is bufs[n - 1] */
+	uint32_t engine;
+	unsigned int batch;
+	unsigned int unsignalled;
+};
+
+static struct fpgadma_loopback *lb_of(struct fpgadma_dev *dma)
+{
+	return dma->priv;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* CSR word 2, the request lines as the DMA sees them */
+static uint32_t lb_req_lines(struct fpgadma_loopback *lb)
+{
+	uint32_t lines = 0;
+
+	if (lb->fifo_used < lb->cfg.fifo_depth)
+		lines |= FPGADMA_CSR_TX_SINGLE;
+	if (lb->fifo_used <= lb->tx_water_mark)
+		lines |= FPGADMA_CSR_TX_BURST;
+	if (lb->fifo_used)
+		lines |= FPGADMA_CSR_RX_SINGLE;
+	if (lb->fifo_used >= lb->rx_water_mark)
+		lines |= FPGADMA_CSR_RX_BURST;
+	return lines;
+}
+
+/* CSR words 3 and 7, the design's second FIFO only mirrors the first */
+static uint32_t lb_fifo_status(struct fpgadma_loopback *lb)
+{
+	uint32_t st = lb->fifo_used;
+
+	if (lb->fifo_used == lb->cfg.fifo_depth)
+		st |= FPGADMA_CSR_FIFO_FULL;
+	if (!lb->fifo_used)
+		st |= FPGADMA_CSR_FIFO_EMPTY;
+	return st;
+}
+
+static int lb_csr_read(struct fpgadma_dev *dma, unsigned int reg,
+		       uint32_t *val)
+{
+	struct fpgadma_loopback *lb = lb_of(dma);
+
+	pthread_mutex_lock(&lb->lock);
+	switch (reg) {
+	case FPGADMA_CSR_WR_WTRMK:
+		*val = lb->tx_water_mark;
+		break;
+	case FPGADMA_CSR_RD_WTRMK:
+		*val = lb->rx_water_mark;
+		break;
+	case FPGADMA_CSR_BURST:
+		*val = lb_req_lines(lb);
+		break;
+	case FPGADMA_CSR_FIFO_STATUS:
+	case FPGADMA_CSR_FIFO2_STATUS:
+		*val = lb_fifo_status(lb);
+		break;
+	case FPGADMA_CSR_DATA_WIDTH:
+		*val = lb->cfg.data_width * 8;
+		break;
+	case FPGADMA_CSR_FIFO_DEPTH:
+		*val = lb->cfg.fifo_depth;
+		break;
+	default:
+		*val = 0;
+		break;
+	}
+	pthread_mutex_unlock(&lb->lock);
+	return reg < FPGADMA_CSR_WORDS ? 0 : -EINVAL;
+}
+
+static void lb_csr_write_locked(struct fpgadma_loopback *lb, unsigned int reg,
+				uint32_t val)
+{
+	switch (reg) {
+	case FPGADMA_CSR_WR_WTRMK:
+		lb->tx_water_mark = val;
+		break;
+	case FPGADMA_CSR_RD_WTRMK:
+		lb->rx_water_mark = val;
+		break;
+	case FPGADMA_CSR_FIFO_CLEAR:
+		if (val & 1)
+			lb->fifo_head = lb->fifo_used = 0;
+		break;
+	}
+	/* everything else is read only */
+	pthread_cond_broadcast(&lb->cond);
+}
+
+static int lb_csr_write(struct fpgadma_dev *dma, unsigned int reg,
+			uint32_t val)
+{
+	struct fpgadma_loopback *lb = lb_of(dma);
+
+	if (reg >= FPGADMA_CSR_WORDS)
+		return -EINVAL;
+	pthread_mutex_lock(&lb->lock);
+	lb_csr_write_locked(lb, reg, val);
+	pthread_mutex_unlock(&lb->lock);
+	return 0;
+}
+
+/* data port, @n words in or out of the FIFO ring */
+static void lb_fifo_push(struct fpgadma_loopback *lb, const char *src,
+			 uint32_t n)
+{
+	uint32_t w = lb->cfg.data_width;
+	uint32_t tail = (lb->fifo_head + lb->fifo_used) % lb->cfg.fifo_depth;
+	uint32_t first = n < lb->cfg.fifo_depth - tail ?
+			 n : lb->cfg.fifo_depth - tail;
+
+	memcpy(lb->fifo + (size_t)tail * w, src, (size_t)first * w);
+	memcpy(lb->fifo, src + (size_t)first * w, (size_t)(n - first) * w);
+	lb->fifo_used += n;
+}
+
+static void lb_fifo_pop(struct fpgadma_loopback *lb, char *dst, uint32_t n)
+{
+	uint32_t w = lb->cfg.data_width;
+	uint32_t head = lb->fifo_head;
+	uint32_t first = n < lb->cfg.fifo_depth - head ?
+			 n : lb->cfg.fifo_depth - head;
+
+	memcpy(dst, lb->fifo + (size_t)head * w, (size_t)first * w);
+	memcpy(dst + (size_t)first * w, lb->fifo, (size_t)(n - first) * w);
+	lb->fifo_head = (head + n) % lb->cfg.fifo_depth;
+	lb->fifo_used -= n;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void lb_complete(struct fpgadma_dev *dma, struct lb_queue *q)
+{
+	struct fpgadma_loopback *lb = lb_of(dma);
+	uint64_t n;
+
+	q->last_cookie = q->x[q->first].cookie;
+	q->first = (q->first + 1) % LB_MAX_QUEUE;
+	q->count--;
+	if (++lb->unsignalled >= lb->batch) {
+		n = lb->unsignalled;
+		lb->unsignalled = 0;
+		if (write(dma->fd, &n, sizeof(n)) != sizeof(n))
+			return;
+	}
+}
+
+/*
+ * One burst request of the channel for @x: the driver's burst size, or
+ * what is left of the transfer, once the burst line is up. The data port
+ * has no wait state, the hardware would overflow or read stale words when
+ * the watermarks let a burst through without room or data for it; the
+ * model holds the burst back instead. Returns the words moved.
+ */
+static uint32_t lb_chan_burst(struct fpgadma_loopback *lb, uint32_t dir,
+			      struct lb_xfer *x)
+{
+	uint32_t width = lb->cfg.data_width;
+	uint32_t n = (x->len - x->done) / width;
+	uint32_t lines = lb_req_lines(lb);
+
+	if (n > lb->cfg.burst_words)
+		n = lb->cfg.burst_words;
+	if (dir == FPGA_DMA_TX) {
+		if (!(lines & FPGADMA_CSR_TX_BURST) ||
+		    lb->fifo_used + n > lb->cfg.fifo_depth)
+			return 0;
+		lb_fifo_push(lb, x->ptr + x->done, n);
+	} else {
+		if (!(lines & FPGADMA_CSR_RX_BURST) || lb->fifo_used < n)
+			return 0;
+		lb_fifo_pop(lb, x->ptr + x->done, n);
+	}
+	x->done += (size_t)n * width;
+	return n;
+}
+
+/* the DMA channel of one direction, a memcpy per burst request */
+static void *lb_chan_thread(void *arg)
+{
+	struct lb_chan *chan = arg;
+	struct fpgadma_loopback *lb = lb_of(chan->dma);
+	struct lb_queue *q = &lb->q[chan->dir];
+	struct lb_xfer *x;
+	int moved;
+
+	pthread_mutex_lock(&lb->lock);
+	while (!lb->stop) {
+		moved = 0;
+		while (q->count) {
+			x = &q->x[q->first];
+			if (!lb_chan_burst(lb, chan->dir, x))
+				break;
+			moved = 1;
+			if (x->done == x->len)
+				lb_complete(chan->dma, q);
+		}
+		if (moved)
+			pthread_cond_broadcast(&lb->cond);
+		else
+			pthread_cond_wait(&lb->cond, &lb->lock);
+	}
+	pthread_mutex_unlock(&lb->lock);
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void lb_deadline(struct fpgadma_loopback *lb, struct timespec *ts)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ts->tv_sec += lb->cfg.timeout_ms / 1000;
+	ts->tv_nsec += (lb->cfg.timeout_ms % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+/* sleep for the next change, -ETIMEDOUT once @ts has passed */
+static int lb_sleep(struct fpgadma_loopback *lb, const struct timespec *ts)
+{
+	return pthread_cond_timedwait(&lb->cond, &lb->lock, ts) ==
+	       ETIMEDOUT ? -ETIMEDOUT : 0;
+}
+
+/* cookies grow and wrap, compare them as the distance between them */
+static int32_t lb_cookie_diff(int32_t a, int32_t b)
+{
+	return (int32_t)((uint32_t)a - (uint32_t)b);
+}
+
+/*
+ * The driver terminates the channel of a transfer that timed out, or of
+ * a cancelled one, and retires everything queued on it with @error.
+ */
+static void lb_abort(struct fpgadma_loopback *lb, struct lb_queue *q,
+		     int error)
+{
+	if (q->count) {
+		q->abort_first = q->x[q->first].cookie;
+		q->abort_last = q->x[(q->first + q->count - 1) %
+				     LB_MAX_QUEUE].cookie;
+		q->abort_error = error;
+		q->last_cookie = q->abort_last;
+		q->error = error;
+	}
+	q->first = (q->first + q->count) % LB_MAX_QUEUE;
+	q->count = 0;
+	pthread_cond_broadcast(&lb->cond);
+}
+
+/* @copy bytes at @ptr, if any, go from the slot's tail block, zero padded */
+static int lb_queue_xfer(struct fpgadma_dev *dma, uint32_t dir, char *ptr,
+			 size_t len, size_t copy, int32_t *cookie)
+{
+	struct fpgadma_loopback *lb = lb_of(dma);
+	struct lb_queue *q = &lb->q[dir];
+	struct lb_xfer *x;
+	struct timespec ts;
+
+	/* the driver blocks for a free slot as well */
+	lb_deadline(lb, &ts);
+	while (q->count >= lb->cfg.queue_depth) {
+		if (lb_sleep(lb, &ts) && q->count >= lb->cfg.queue_depth) {
+			lb_abort(lb, q, -ETIMEDOUT);
+			return -ETIMEDOUT;
+		}
+	}
+
+	x = &q->x[(q->first + q->count) % LB_MAX_QUEUE];
+	if (copy) {
+		if (!x->tail)
+			x->tail = malloc((size_t)lb->cfg.fifo_depth *
+					 lb->cfg.data_width);
+		if (!x->tail)
+			return -ENOMEM;
+		memcpy(x->tail, ptr, copy);
+		memset(x->tail + copy, 0, len - copy);
+		ptr = x->tail;
+	}
+	x->ptr = ptr;
+	x->len = len;
+	x->done = 0;
+	if (++q->next_cookie <= 0)
+		q->next_cookie = 1;
+	x->cookie = q->next_cookie;
+	q->count++;
+	*cookie = x->cookie;
+	pthread_cond_broadcast(&lb->cond);
+	return 0;
+}
+
+/*
+ * fpga_dma_calc_burst(): @len rounded up to whole words and, from one
+ * burst up, cut to whole bursts
+ */
+static size_t lb_calc_burst(struct fpgadma_loopback *lb, size_t len)
+{
+	size_t width = lb->cfg.data_width;
+	size_t words = (len + width - 1) / width;
+
+	if (words >= lb->cfg.burst_words)
+		words -= words % lb->cfg.burst_words;
+	return words * width;
+}
+
+/*
+ * fpga_dma_xfer_req(): in user memory RX is cut to whole words and a TX
+ * ending in a partial word goes from a tail block if it fits the FIFO
+ */
+static int lb_submit(struct fpgadma_dev *dma, struct fpga_dma_xfer *xfer)
+{
+	struct fpgadma_loopback *lb = lb_of(dma);
+	size_t width = lb->cfg.data_width;
+	size_t len = xfer->len, copy = 0;
+	struct lb_buf *b;
+	char *ptr;
+
+	if (xfer->dir > FPGA_DMA_RX || (xfer->flags & FPGA_DMA_XFER_DRVBUF) ||
+	    xfer->len > INT_MAX)
+		return -EINVAL;
+	if (len % width) {
+		if (xfer->dir == FPGA_DMA_RX)
+			len -= len % width;
+		else if ((xfer->flags & FPGA_DMA_XFER_REGBUF) ||
+			 len > (size_t)lb->cfg.fifo_depth * width)
+			return -EINVAL;
+		else
+			copy = len;
+	}
+	len = lb_calc_burst(lb, len);
+	if (!len)
+		return -EINVAL;
+	if (xfer->flags & FPGA_DMA_XFER_REGBUF) {
+		if (!xfer->handle || xfer->handle > LB_MAX_BUFS)
+			return -EINVAL;
+		b = &lb->bufs[xfer->handle - 1];
+		if (!b->base || xfer->addr > b->len ||
+		    len > b->len - xfer->addr ||
+		    (b->dir != FPGA_DMA_TXRX && b->dir != xfer->dir))
+			return -EINVAL;
+		ptr = b->base + xfer->addr;
+	} else {
+		ptr = (char *)(uintptr_t)xfer->addr;
+	}
+	if (!copy)
+		xfer->len = len;
+	return lb_queue_xfer(dma, xfer->dir, ptr, len, copy, &xfer->cookie);
+}
+
+static int lb_done(struct lb_queue *q, int32_t cookie)
+{
+	return cookie ? lb_cookie_diff(q->last_cookie, cookie) >= 0 :
+			!q->count;
+}
+
+static int lb_aborted(struct lb_queue *q, int32_t cookie)
+{
+	return q->abort_first && cookie &&
+	       lb_cookie_diff(cookie, q->abort_first) >= 0 &&
+	       lb_cookie_diff(q->abort_last, cookie) >= 0;
+}
+
+/* wait for @cookie alone, leaving the error of earlier aborts pending */
+static int lb_wait_cookie(struct fpgadma_dev *dma, struct lb_queue *q,
+			  int32_t cookie)
+{
+	struct fpgadma_loopback *lb = lb_of(dma);
+	struct timespec ts;
+
+	lb_deadline(lb, &ts);
+	while (!lb_done(q, cookie)) {
+		if (lb_sleep(lb, &ts) && !lb_done(q, cookie)) {
+			lb_abort(lb, q, -ETIMEDOUT);
+			return -ETIMEDOUT;
+		}
+	}
+	return lb_aborted(q, cookie) ? q->abort_error : 0;
+}
+
+static int lb_wait(struct fpgadma_dev *dma, uint32_t dir, int32_t cookie)
+{
+	struct lb_queue *q;
+	int ret;
+
+	if (dir > FPGA_DMA_RX)
+		return -EINVAL;
+	q = &lb_of(dma)->q[dir];
+	ret = lb_wait_cookie(dma, q, cookie);
+	/* like the driver's per-file error, reported once by cookie 0 */
+	if (!cookie) {
+		if (!ret)
+			ret = q->error;
+		q->error = 0;
+	}
+	return ret;
+}
+
+/*
+ * fpga_dma_queue_cancel(): wait for what is ahead of @cookie, then drop
+ * it, and whatever was queued behind it, if it is still pending
+ */
+static void lb_cancel(struct fpgadma_dev *dma, struct lb_queue *q,
+		      int32_t cookie)
+{
+	struct fpgadma_loopback *lb = lb_of(dma);
+	struct timespec ts;
+
+	lb_deadline(lb, &ts);
+	while (!lb_done(q, cookie) && q->x[q->first].cookie != cookie) {
+		if (lb_sleep(lb, &ts) && !lb_done(q, cookie) &&
+		    q->x[q->first].cookie != cookie) {
+			lb_abort(lb, q, -ETIMEDOUT);
+			return;
+		}
+	}
+	if (!lb_done(q, cookie))
+		lb_abort(lb, q, -ECANCELED);
+}
+
+static int lb_status(struct fpgadma_dev *dma, struct fpga_dma_status *st)
+{
+	struct fpgadma_loopback *lb = lb_of(dma);
+
+	memset(st, 0, sizeof(*st));
+	st->fifo_depth = lb->cfg.fifo_depth;
+	st->data_width = lb->cfg.data_width;
+	st->fifo_used = lb->fifo_used;
+	st->fifo_full = lb->fifo_used == lb->cfg.fifo_depth;
+	st->fifo_empty = !lb->fifo_used;
+	st->queue_depth = lb->cfg.queue_depth;
+	st->tx_inflight = lb->q[FPGA_DMA_TX].count;
+	st->rx_inflight = lb->q[FPGA_DMA_RX].count;
+	st->tx_last_cookie = lb->q[FPGA_DMA_TX].last_cookie;
+	st->rx_last_cookie = lb->q[FPGA_DMA_RX].last_cookie;
+	return 0;
+}
+
+static int lb_reg_buf(struct fpgadma_dev *dma, struct fpga_dma_buf *buf)
+{
+	struct fpgadma_loopback *lb = lb_of(dma);
+	unsigned int i;
+
+	if (!buf->len || buf->dir > FPGA_DMA_TXRX)
+		return -EINVAL;
+	for (i = 0; i < LB_MAX_BUFS; i++) {
+		if (!lb->bufs[i].base) {
+			lb->bufs[i].base = (char *)(uintptr_t)buf->addr;
+			lb->bufs[i].len = buf->len;
+			lb->bufs[i].dir = buf->dir;
+			buf->handle = i + 1;
+			return 0;
+		}
+	}
+	return -ENOSPC;
+}
+
+static int lb_events(struct fpgadma_dev *dma, __u32 *count)
+{
+	uint64_t n = 0;
+
+	/* nonblocking eventfd: nothing signalled reads as EAGAIN */
+	if (read(dma->fd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+		return -errno;
+	*count = n;
+	return 0;
+}
+
+static int lb_ioctl_locked(struct fpgadma_dev *dma, unsigned long cmd,
+			   void *arg)
+{
+	struct fpgadma_loopback *lb = lb_of(dma);
+	struct fpga_dma_transceive *xc;
+	struct fpga_dma_batch *batch;
+	struct fpga_dma_notify *nt;
+	struct fpga_dma_wait *w;
+	__u32 handle, i;
+	int ret, rx_ret;
+
+	switch (cmd) {
+	case FPGA_DMA_IOC_SUBMIT:
+		return lb_submit(dma, arg);
+	case FPGA_DMA_IOC_SUBMIT_BATCH:
+		batch = arg;
+		for (i = 0, ret = 0; i < batch->count; i++) {
+			ret = lb_submit(dma, (struct fpga_dma_xfer *)
+					(uintptr_t)batch->xfers + i);
+			if (ret)
+				break;
+		}
+		batch->queued = i;
+		return i ? (int)i : ret;
+	case FPGA_DMA_IOC_WAIT:
+		w = arg;
+		return lb_wait(dma, w->dir, w->cookie);
+	case FPGA_DMA_IOC_TRANSCEIVE:
+		xc = arg;
+		xc->tx.dir = FPGA_DMA_TX;
+		xc->rx.dir = FPGA_DMA_RX;
+		ret = lb_submit(dma, &xc->rx);
+		if (ret)
+			return ret;
+		ret = lb_submit(dma, &xc->tx);
+		if (ret) {
+			lb_cancel(dma, &lb->q[FPGA_DMA_RX], xc->rx.cookie);
+			return ret;
+		}
+		/* only its own cookies, earlier SUBMITs keep their errors */
+		ret = lb_wait_cookie(dma, &lb->q[FPGA_DMA_TX], xc->tx.cookie);
+		rx_ret = lb_wait_cookie(dma, &lb->q[FPGA_DMA_RX],
+					xc->rx.cookie);
+		return ret ? ret : rx_ret;
+	case FPGA_DMA_IOC_STATUS:
+		return lb_status(dma, arg);
+	case FPGA_DMA_IOC_REG_BUF:
+		return lb_reg_buf(dma, arg);
+	case FPGA_DMA_IOC_UNREG_BUF:
+		handle = *(__u32 *)arg;
+		if (!handle || handle > LB_MAX_BUFS ||
+		    !lb->bufs[handle - 1].base)
+			return -EINVAL;
+		lb->bufs[handle - 1].base = NULL;
+		return 0;
+	case FPGA_DMA_IOC_SET_ENGINE:
+		lb->engine = *(__u32 *)arg;
+		return lb->engine <= FPGA_DMA_ENGINE_BOUNCE ? 0 : -EINVAL;
+	case FPGA_DMA_IOC_SET_NOTIFY:
+		nt = arg;
+		/* completions are signalled as they happen, no delay needed */
+		lb->batch = nt->batch ? nt->batch : 1;
+		return 0;
+	case FPGA_DMA_IOC_EVENTS:
+		return lb_events(dma, arg);
+	default:
+		/* no driver pool and no cyclic ring in the model */
+		return -ENOTTY;
+	}
+}
+
+static int lb_ioctl(struct fpgadma_dev *dma, unsigned long cmd, void *arg)
+{
+	struct fpgadma_loopback *lb = lb_of(dma);
+	int ret;
+
+	pthread_mutex_lock(&lb->lock);
+	ret = lb_ioctl_locked(dma, cmd, arg);
+	pthread_mutex_unlock(&lb->lock);
+	return ret;
+}
+
+/* queue @len bytes at @ptr and wait for them, under lb->lock */
+static int lb_rw_xfer(struct fpgadma_dev *dma, uint32_t dir, void *ptr,
+		      size_t len)
+{
+	struct fpga_dma_xfer xfer;
+	int ret;
+
+	memset(&xfer, 0, sizeof(xfer));
+	xfer.addr = (uintptr_t)ptr;
+	xfer.len = len;
+	xfer.dir = dir;
+	ret = lb_submit(dma, &xfer);
+	return ret ? ret : lb_wait(dma, dir, xfer.cookie);
+}
+
+/*
+ * read()/write() as the driver has them: the bounce engine moves at most
+ * a FIFO through a buffer of whole words and bursts, sg reads whole
+ * bursts and returns that many bytes and sg writes the whole bursts from
+ * the caller's buffer and the rest from a block padded with zeros. Both
+ * wait for their transfers.
+ */
+static ssize_t lb_rw(struct fpgadma_dev *dma, uint32_t dir, void *buf,
+		     size_t len)
+{
+	struct fpgadma_loopback *lb = lb_of(dma);
+	size_t width = lb->cfg.data_width;
+	size_t fifo_size = (size_t)lb->cfg.fifo_depth * width;
+	size_t n = len, words, tail;
+	char *bounce = NULL;
+	int ret = 0;
+
+	if (lb->engine == FPGA_DMA_ENGINE_BOUNCE) {
+		n = len < fifo_size ? len : fifo_size;
+		words = lb_calc_burst(lb, n);
+		if (!words)
+			return -EINVAL;
+		if (n > words)
+			n = words;
+		bounce = calloc(1, words);
+		if (!bounce)
+			return -ENOMEM;
+		if (dir == FPGA_DMA_TX)
+			memcpy(bounce, buf, n);
+		pthread_mutex_lock(&lb->lock);
+		ret = lb_rw_xfer(dma, dir, bounce, words);
+		pthread_mutex_unlock(&lb->lock);
+		if (!ret && dir == FPGA_DMA_RX)
+			memcpy(buf, bounce, n);
+		free(bounce);
+		return ret ? ret : (ssize_t)n;
+	}
+
+	if (dir == FPGA_DMA_RX) {
+		/* never rounded up, that would write past the buffer */
+		n = lb_calc_burst(lb, len - len % width);
+		if (!n)
+			return 0;
+		pthread_mutex_lock(&lb->lock);
+		ret = lb_rw_xfer(dma, dir, buf, n);
+		pthread_mutex_unlock(&lb->lock);
+		return ret ? ret : (ssize_t)n;
+	}
+
+	/* a partial word in the tail makes lb_submit() copy it to a block */
+	tail = len % (width * lb->cfg.burst_words);
+	words = len - tail;
+	pthread_mutex_lock(&lb->lock);
+	if (words)
+		ret = lb_rw_xfer(dma, dir, buf, words);
+	if (!ret && tail)
+		ret = lb_rw_xfer(dma, dir, (char *)buf + words, tail);
+	pthread_mutex_unlock(&lb->lock);
+	return ret ? ret : (ssize_t)len;
+}
+
+static void lb_free(struct fpgadma_loopback *lb)
+{
+	unsigned int i;
+
+	for (i = 0; i < LB_MAX_QUEUE; i++) {
+		free(lb->q[FPGA_DMA_TX].x[i].tail);
+		free(lb->q[FPGA_DMA_RX].x[i].tail);
+	}
+	pthread_cond_destroy(&lb->cond);
+	pthread_mutex_destroy(&lb->lock);
+	free(lb->fifo);
+	free(lb);
+}
+
+static void lb_release(struct fpgadma_dev *dma)
+{
+	struct fpgadma_loopback *lb = lb_of(dma);
+	int i;
+
+	pthread_mutex_lock(&lb->lock);
+	lb->stop = 1;
+	pthread_cond_broadcast(&lb->cond);
+	pthread_mutex_unlock(&lb->lock);
+	for (i = 0; i < 2; i++)
+		if (lb->chan[i].started)
+			pthread_join(lb->chan[i].thread, NULL);
+	close(dma->fd);
+	lb_free(lb);
+}
+
+static const struct fpgadma_ops fpgadma_loopback_ops = {
+	.ioctl = lb_ioctl,
+	.rw = lb_rw,
+	.csr_read = lb_csr_read,
+	.csr_write = lb_csr_write,
+	.release = lb_release,
+};
+
+static int lb_init(struct fpgadma_loopback *lb,
+		   const struct fpgadma_loopback_config *cfg)
+{
+	pthread_condattr_t attr;
+
+	if (cfg)
+		lb->cfg = *cfg;
+	if (!lb->cfg.fifo_depth)
+		lb->cfg.fifo_depth = 1024;
+	if (!lb->cfg.data_width)
+		lb->cfg.data_width = 8;
+	if (!lb->cfg.queue_depth)
+		lb->cfg.queue_depth = 8;
+	if (lb->cfg.queue_depth > LB_MAX_QUEUE)
+		lb->cfg.queue_depth = LB_MAX_QUEUE;
+	if (!lb->cfg.burst_words)
+		lb->cfg.burst_words = 16;
+	if (lb->cfg.burst_words > lb->cfg.fifo_depth)
+		lb->cfg.burst_words = lb->cfg.fifo_depth;
+	if (!lb->cfg.timeout_ms)
+		lb->cfg.timeout_ms = 1000;
+	lb->fifo = malloc((size_t)lb->cfg.fifo_depth * lb->cfg.data_width);
+	if (!lb->fifo)
+		return -ENOMEM;
+
+	pthread_mutex_init(&lb->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&lb->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	/* reset values of the design, then what the driver's probe writes */
+	lb->tx_water_mark = lb->cfg.fifo_depth;
+	lb->rx_water_mark = 1;
+	lb_csr_write_locked(lb, FPGADMA_CSR_WR_WTRMK,
+			    lb->cfg.fifo_depth - lb->cfg.burst_words);
+	lb_csr_write_locked(lb, FPGADMA_CSR_RD_WTRMK, 0);
+	lb->batch = 1;
+	return 0;
+}
+
+int fpgadma_open_loopback(const struct fpgadma_loopback_config *cfg,
+			  struct fpgadma_dev **dmap)
+{
+	struct fpgadma_loopback *lb;
+	struct fpgadma_dev *dma;
+	int i, ret;
+
+	dma = calloc(1, sizeof(*dma));
+	lb = calloc(1, sizeof(*lb));
+	if (!dma || !lb) {
+		free(lb);
+		free(dma);
+		return -ENOMEM;
+	}
+	ret = lb_init(lb, cfg);
+	if (ret) {
+		free(lb);
+		free(dma);
+		return ret;
+	}
+	dma->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (dma->fd < 0) {
+		ret = -errno;
+		lb_free(lb);
+		free(dma);
+		return ret;
+	}
+	dma->priv = lb;
+	dma->ops = &fpgadma_loopback_ops;
+	for (i = 0; i < 2; i++) {
+		lb->chan[i].dma = dma;
+		lb->chan[i].dir = i;
+		ret = -pthread_create(&lb->chan[i].thread, NULL,
+				      lb_chan_thread, &lb->chan[i]);
+		if (ret) {
+			fpgadma_close(dma);
+			return ret;
+		}
+		lb->chan[i].started = 1;
+	}
+	return fpgadma_setup(dma, dmap);
+}
@@ -0,0 +1,581 @@
+/* libfpgadma Streaming Pipeline Test
+ *
+ * Streams a pattern through the loopback with one thread per stage, the
+ * stages connected by lock-free single-producer/single-consumer rings:
+ *
+ *   generator --filled--> TX --free--> generator
+ *   RX --filled--> checker --free--> RX
+ *
+ * The generator fills pool blocks with a continuous pattern stream, TX
+ * submits them in batches and keeps up to -d in flight, RX keeps as many
+ * receive transfers queued, never for data that isn't generated yet, and
+ * the checker verifies the stream in order and hands the blocks back. TX
+ * only sends a block once its RX is queued, so the FIFO never has to hold
+ * more than the hardware can.
+ *
+ * Every stage records how long it sat starved (its input ring empty, or
+ * RX waiting for the generator) and blocked (its output ring full, or TX
+ * waiting for RX) and how often; the rest is busy time, which includes
+ * waiting for the DMA in TX and RX. The stage with the highest busy share
+ * limits the stream. Runs for -t seconds, then drains.
+ *
+ * make && ./fpgadma-pipeline -L
+ * ./fpgadma-pipeline [-L] [-i instance] [-s block bytes] [-b blocks]
+ *                    [-r ring slots] [-d depth] [-p counter|lfsr|walk1]
+ *                    [-t seconds] [-a gen,tx,rx,check cpus]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "fpgadma.h"
+#include "fpgadma-verify.h"
+
+#define CACHELINE	64
+#define MAX_RANGES	4
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * Single producer, single consumer: head is only written by the producer
+ * and tail only by the consumer, each on its own cache line; the release
+ * store of one publishes the slots to the acquire load of the other.
+ */
+struct spsc {
+	_Alignas(CACHELINE) atomic_uint head;
+	_Alignas(CACHELINE) atomic_uint tail;
+	_Alignas(CACHELINE) unsigned int mask;
+	void **slot;
+};
+
+static int spsc_init(struct spsc *r, unsigned int min)
+{
+	unsigned int size = 1;
+
+	while (size < min)
+		size <<= 1;
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	r->mask = size - 1;
+	r->slot = calloc(size, sizeof(*r->slot));
+	return r->slot ? 0 : -ENOMEM;
+}
+
+static int spsc_push(struct spsc *r, void *p)
+{
+	unsigned int head = atomic_load_explicit(&r->head,
+						 memory_order_relaxed);
+
+	if (head - atomic_load_explicit(&r->tail, memory_order_acquire) >
+	    r->mask)
+		return 0;
+	r->slot[head & r->mask] = p;
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+	return 1;
+}
+
+static void *spsc_peek(struct spsc *r)
+{
+	unsigned int tail = atomic_load_explicit(&r->tail,
+						 memory_order_relaxed);
+
+	if (tail == atomic_load_explicit(&r->head, memory_order_acquire))
+		return NULL;
+	return r->slot[tail & r->mask];
+}
+
+static void *spsc_pop(struct spsc *r)
+{
+	void *p = spsc_peek(r);
+
+	if (p)
+		atomic_store_explicit(&r->tail,
+				      atomic_load_explicit(&r->tail,
+							   memory_order_relaxed)
+				      + 1, memory_order_release);
+	return p;
+}
+
+/* ------------------------------------------------------------------------ */
+
+enum { GEN, TX, RX, CHECK, NUM_STAGES };
+
+static const char *const stage_names[NUM_STAGES] = {
+	"generator", "tx", "rx", "checker",
+};
+
+struct block {
+	struct fpgadma_buf buf;
+	uint64_t seq;
+	int32_t cookie;
+};
+
+struct stage {
+	pthread_t thread;
+	int cpu;
+	uint64_t items;
+	double start, end;
+	double starved, blocked;	/* seconds */
+	uint64_t starve_events, block_events;
+	double wait_since;		/* of the wait in progress, or 0 */
+	int blocking;
+};
+
+struct pipeline {
+	struct fpgadma_dev *dma;
+	size_t size;
+	unsigned int depth;
+	int pattern;
+	struct spsc filled_tx, free_tx, filled_rx, free_rx;
+	struct stage st[NUM_STAGES];
+	atomic_int stop;		/* generator: no more blocks */
+	atomic_int gen_done;
+	atomic_int failed;
+	atomic_ullong generated;	/* blocks handed to TX */
+	atomic_ullong rx_queued;	/* blocks with their RX queued */
+	uint64_t bytes;
+	size_t bad_ranges;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* one pass of a wait loop: starved or blocked until stage_run() */
+static void stage_wait(struct stage *s, int blocking)
+{
+	if (!s->wait_since || s->blocking != blocking) {
+		if (s->wait_since)
+			*(s->blocking ? &s->blocked : &s->starved) +=
+				now() - s->wait_since;
+		s->wait_since = now();
+		s->blocking = blocking;
+		if (blocking)
+			s->block_events++;
+		else
+			s->starve_events++;
+	}
+	sched_yield();
+}
+
+static void stage_run(struct stage *s)
+{
+	if (!s->wait_since)
+		return;
+	*(s->blocking ? &s->blocked : &s->starved) += now() - s->wait_since;
+	s->wait_since = 0;
+}
+
+static void stage_begin(struct stage *s)
+{
+	cpu_set_t set;
+
+	if (s->cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(s->cpu, &set);
+		sched_setaffinity(0, sizeof(set), &set);
+	}
+	s->start = now();
+}
+
+static void stage_end(struct stage *s)
+{
+	stage_run(s);
+	s->end = now();
+}
+
+static void fail(struct pipeline *pl, const char *what, int err)
+{
+	if (!atomic_exchange(&pl->failed, 1))
+		fprintf(stderr, "%s: %s\n", what, strerror(-err));
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void *generator(void *arg)
+{
+	struct pipeline *pl = arg;
+	struct stage *s = &pl->st[GEN];
+	struct fpgadma_pattern pat;
+	struct block *b;
+
+	stage_begin(s);
+	fpgadma_pattern_init(&pat, pl->pattern, 0);
+	while (!atomic_load(&pl->stop) && !atomic_load(&pl->failed)) {
+		b = spsc_pop(&pl->free_tx);
+		if (!b) {
+			stage_wait(s, 0);
+			continue;
+		}
+		stage_run(s);
+		fpgadma_pattern_fill(&pat, b->buf.ptr, pl->size);
+		b->seq = s->items++;
+		while (!spsc_push(&pl->filled_tx, b))
+			stage_wait(s, 1);
+		stage_run(s);
+		atomic_store(&pl->generated, s->items);
+	}
+	atomic_store(&pl->gen_done, 1);
+	stage_end(s);
+	return NULL;
+}
+
+/*
+ * TX and RX: collect what can be queued into one batch, keep up to depth
+ * in flight and retire them in order, @next gets every retired block
+ */
+struct dma_stage {
+	struct pipeline *pl;
+	struct stage *s;
+	uint32_t dir;
+	struct block **inflight;
+	unsigned int first, count;
+	struct spsc *next;
+};
+
+static int dma_retire(struct dma_stage *d, int wait)
+{
+	struct block *b;
+	int ret;
+
+	while (d->count) {
+		b = d->inflight[d->first];
+		if (!fpgadma_done(d->pl->dma, d->dir, b->cookie)) {
+			if (!wait)
+				return 0;
+			ret = fpgadma_wait(d->pl->dma, d->dir, b->cookie);
+			if (ret)
+				return ret;
+		}
+		wait = 0;
+		while (!spsc_push(d->next, b))
+			stage_wait(d->s, 1);
+		stage_run(d->s);
+		d->first = (d->first + 1) % d->pl->depth;
+		d->count--;
+		d->s->items++;
+	}
+	return 0;
+}
+
+static int dma_submit(struct dma_stage *d, struct block **blocks,
+		      unsigned int n, struct fpgadma_batch *batch)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < n; i++)
+		fpgadma_batch_add(batch, &blocks[i]->buf, 0, d->pl->size,
+				  d->dir, 0);
+	ret = fpgadma_batch_submit(d->pl->dma, batch);
+	if (ret < 0)
+		return ret;
+	if ((unsigned int)ret < n)
+		return -EIO;
+	for (i = 0; i < n; i++) {
+		blocks[i]->cookie = batch->xfers[i].cookie;
+		d->inflight[(d->first + d->count++) % d->pl->depth] =
+			blocks[i];
+	}
+	return 0;
+}
+
+static void *dma_thread(struct pipeline *pl, int idx, uint32_t dir,
+			struct spsc *in, struct spsc *next)
+{
+	struct dma_stage d = {
+		.pl = pl, .s = &pl->st[idx], .dir = dir, .next = next,
+	};
+	struct fpga_dma_xfer *xfers;
+	struct fpgadma_batch batch;
+	struct block **take, *b;
+	uint64_t seq = 0, limit;
+	unsigned int n;
+	int ret = 0, gate;
+
+	d.inflight = calloc(pl->depth, sizeof(*d.inflight));
+	take = calloc(pl->depth, sizeof(*take));
+	xfers = calloc(pl->depth, sizeof(*xfers));
+	if (!d.inflight || !take || !xfers) {
+		fail(pl, stage_names[idx], -ENOMEM);
+		goto out;
+	}
+	fpgadma_batch_init(&batch, xfers, pl->depth);
+	stage_begin(d.s);
+	while (!atomic_load(&pl->failed)) {
+		ret = dma_retire(&d, 0);
+		if (ret)
+			break;
+		/* TX sends what has its RX queued, RX receives what exists */
+		limit = dir == FPGA_DMA_TX ? atomic_load(&pl->rx_queued) :
+			atomic_load(&pl->generated);
+		gate = 0;
+		for (n = 0; d.count + n < pl->depth; n++) {
+			b = spsc_peek(in);
+			if (!b)
+				break;
+			if ((dir == FPGA_DMA_TX ? b->seq : seq + n) >= limit) {
+				gate = 1;
+				break;
+			}
+			take[n] = spsc_pop(in);
+		}
+		if (n) {
+			stage_run(d.s);
+			ret = dma_submit(&d, take, n, &batch);
+			if (ret)
+				break;
+			if (dir == FPGA_DMA_RX) {
+				seq += n;
+				atomic_store(&pl->rx_queued, seq);
+			}
+			continue;
+		}
+		if (d.count) {
+			/* nothing new to queue, the DMA is what we wait for */
+			stage_run(d.s);
+			ret = dma_retire(&d, 1);
+			if (ret)
+				break;
+			continue;
+		}
+		if (atomic_load(&pl->gen_done) &&
+		    (dir == FPGA_DMA_TX ? !spsc_peek(in) :
+		     seq == atomic_load(&pl->generated)))
+			break;
+		/* TX held back by RX counts as blocked, the rest as starved */
+		stage_wait(d.s, gate && dir == FPGA_DMA_TX);
+	}
+	if (ret)
+		fail(pl, stage_names[idx], ret);
+	stage_end(d.s);
+out:
+	free(d.inflight);
+	free(take);
+	free(xfers);
+	return NULL;
+}
+
+static void *tx_thread(void *arg)
+{
+	struct pipeline *pl = arg;
+
+	return dma_thread(pl, TX, FPGA_DMA_TX, &pl->filled_tx, &pl->free_tx);
+}
+
+static void *rx_thread(void *arg)
+{
+	struct pipeline *pl = arg;
+
+	return dma_thread(pl, RX, FPGA_DMA_RX, &pl->free_rx, &pl->filled_rx);
+}
+
+static void *checker(void *arg)
+{
+	struct pipeline *pl = arg;
+	struct stage *s = &pl->st[CHECK];
+	struct fpgadma_range r[MAX_RANGES];
+	struct fpgadma_pattern pat;
+	struct block *b;
+	char what[48];
+	size_t n;
+
+	stage_begin(s);
+	fpgadma_pattern_init(&pat, pl->pattern, 0);
+	while (!atomic_load(&pl->failed)) {
+		b = spsc_pop(&pl->filled_rx);
+		if (!b) {
+			if (atomic_load(&pl->gen_done) &&
+			    s->items == atomic_load(&pl->generated))
+				break;
+			stage_wait(s, 0);
+			continue;
+		}
+		stage_run(s);
+		n = fpgadma_pattern_check(&pat, b->buf.ptr, pl->size, r,
+					  MAX_RANGES);
+		if (n) {
+			snprintf(what, sizeof(what), "block %llu",
+				 (unsigned long long)s->items);
+			fpgadma_print_ranges(stdout, what, r, n, MAX_RANGES);
+			pl->bad_ranges += n;
+		}
+		pl->bytes += pl->size;
+		s->items++;
+		while (!spsc_push(&pl->free_rx, b))
+			stage_wait(s, 1);
+		stage_run(s);
+	}
+	stage_end(s);
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void report(struct pipeline *pl, double seconds)
+{
+	double busy, t, worst = -1;
+	int i, bottleneck = 0;
+
+	printf("%-10s %10s %7s %8s %8s %10s %10s\n", "stage", "blocks",
+	       "busy%", "starved%", "blocked%", "starved_n", "blocked_n");
+	for (i = 0; i < NUM_STAGES; i++) {
+		struct stage *s = &pl->st[i];
+
+		t = s->end - s->start;
+		if (t <= 0)
+			t = 1e-9;
+		busy = 100 * (t - s->starved - s->blocked) / t;
+		printf("%-10s %10llu %7.1f %8.1f %8.1f %10llu %10llu\n",
+		       stage_names[i], (unsigned long long)s->items, busy,
+		       100 * s->starved / t, 100 * s->blocked / t,
+		       (unsigned long long)s->starve_events,
+		       (unsigned long long)s->block_events);
+		if (busy > worst) {
+			worst = busy;
+			bottleneck = i;
+		}
+	}
+	printf("%.2f MB/s sustained over %.2f s, %zu mismatching ranges, "
+	       "bottleneck: %s\n", pl->bytes / seconds / 1e6, seconds,
+	       pl->bad_ranges, stage_names[bottleneck]);
+}
+
+static int parse_cpus(const char *arg, struct pipeline *pl)
+{
+	char *end;
+	int i;
+
+	for (i = 0; i < NUM_STAGES; i++) {
+		pl->st[i].cpu = strtol(arg, &end, 0);
+		if (end == arg)
+			return -1;
+		if (*end != ',')
+			break;
+		arg = end + 1;
+	}
+	/* the last one given applies to the rest */
+	for (i++; i < NUM_STAGES; i++)
+		pl->st[i].cpu = pl->st[i - 1].cpu;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static void *(*const fn[NUM_STAGES])(void *) = {
+		generator, tx_thread, rx_thread, checker,
+	};
+	struct pipeline pl;
+	struct fpgadma_pool *pool = NULL;
+	struct block *blocks;
+	unsigned int nblocks = 16, ring = 4, i;
+	int loopback = 0, instance = 0, opt, ret;
+	double seconds = 5, start;
+
+	memset(&pl, 0, sizeof(pl));
+	pl.size = 64 << 10;
+	pl.depth = 4;
+	pl.pattern = FPGADMA_PAT_COUNTER;
+	for (i = 0; i < NUM_STAGES; i++)
+		pl.st[i].cpu = -1;
+
+	while ((opt = getopt(argc, argv, "Li:s:b:r:d:p:t:a:")) != -1) {
+		switch (opt) {
+		case 'L':
+			loopback = 1;
+			break;
+		case 'i':
+			instance = atoi(optarg);
+			break;
+		case 's':
+			pl.size = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			nblocks = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			ring = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			pl.depth = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			pl.pattern = !strcmp(optarg, "lfsr") ? FPGADMA_PAT_LFSR :
+				     !strcmp(optarg, "walk1") ?
+				     FPGADMA_PAT_WALK1 : FPGADMA_PAT_COUNTER;
+			break;
+		case 't':
+			seconds = atof(optarg);
+			break;
+		case 'a':
+			if (parse_cpus(optarg, &pl))
+				goto usage;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (!pl.size || pl.size % 8 || !nblocks || !ring || !pl.depth)
+		goto usage;
+
+	ret = loopback ? fpgadma_open_loopback(NULL, &pl.dma) :
+	      fpgadma_open(instance, &pl.dma);
+	if (ret) {
+		fprintf(stderr, "open: %s\n", strerror(-ret));
+		return 1;
+	}
+	/* the free rings start out holding every block */
+	blocks = calloc(2 * nblocks, sizeof(*blocks));
+	ret = blocks ? fpgadma_pool_create(pl.dma, pl.size, 2 * nblocks,
+					   &pool) : -ENOMEM;
+	if (!ret)
+		ret = spsc_init(&pl.free_tx, nblocks) ?:
+		      spsc_init(&pl.free_rx, nblocks) ?:
+		      spsc_init(&pl.filled_tx, ring) ?:
+		      spsc_init(&pl.filled_rx, ring);
+	for (i = 0; !ret && i < 2 * nblocks; i++) {
+		ret = fpgadma_buf_get(pool, &blocks[i].buf);
+		if (!ret)
+			spsc_push(i < nblocks ? &pl.free_tx : &pl.free_rx,
+				  &blocks[i]);
+	}
+	if (ret) {
+		fprintf(stderr, "setup: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	printf("%s, %zu byte blocks, %u per direction, ring %u, depth %u, "
+	       "verify %s\n", loopback ? "loopback" : "device", pl.size,
+	       nblocks, ring, pl.depth, fpgadma_verify_impl());
+	start = now();
+	for (i = 0; i < NUM_STAGES; i++)
+		pthread_create(&pl.st[i].thread, NULL, fn[i], &pl);
+	usleep(seconds * 1e6);
+	atomic_store(&pl.stop, 1);
+	for (i = 0; i < NUM_STAGES; i++)
+		pthread_join(pl.st[i].thread, NULL);
+	report(&pl, now() - start);
+
+	for (i = 0; i < 2 * nblocks; i++)
+		fpgadma_buf_put(&blocks[i].buf);
+	fpgadma_pool_destroy(pool);
+	fpgadma_close(pl.dma);
+	return atomic_load(&pl.failed) || pl.bad_ranges ? 1 : 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-L] [-i instance] [-s block bytes] "
+		"[-b blocks] [-r ring slots] [-d depth] "
+		"[-p counter|lfsr|walk1] [-t seconds] [-a cpus]\n", argv[0]);
+	return 1;
+}
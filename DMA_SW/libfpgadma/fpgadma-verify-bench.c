@@ -0,0 +1,155 @@
+/* libfpgadma Verification Benchmark
+ *
+ * Times pattern fill, pattern check, buffer compare and CRC32C over one
+ * large buffer with every set of kernels this CPU can run, next to
+ * memcpy() as the memory bandwidth reference, and checks that the vector
+ * kernels give the scalar results: the same pattern words, the same CRC
+ * and the same mismatch ranges for a few injected errors.
+ *
+ * make && ./fpgadma-verify-bench [-s MB] [-r repeats]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "fpgadma-verify.h"
+
+#define MAX_RANGES	8
+
+static const char *const impls[] = { "scalar", "sse2", "avx2", "neon" };
+static const char *const pat_names[] = { "counter", "lfsr", "walk1" };
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, size_t len, int reps, double t)
+{
+	printf("  %-14s %8.0f MB/s\n", what, len * (double)reps / t / 1e6);
+}
+
+/* flip a bit in a single word, in two adjacent words and in a block */
+static void inject(char *buf, size_t len)
+{
+	buf[len / 3] ^= 1;
+	buf[len / 2] ^= 0x80;
+	buf[len / 2 + 4] ^= 0x80;
+	memset(buf + len - 100, 0x55, 37);
+}
+
+int main(int argc, char *argv[])
+{
+	struct fpgadma_range ref[MAX_RANGES], got[MAX_RANGES];
+	struct fpgadma_pattern pat;
+	size_t len = 64 << 20, nref = 0, n = 0;
+	uint32_t crc_ref = 0, crc = 0;
+	char *a, *b, *fill_ref[3];
+	int reps = 5, bad = 0, opt, i, p, r;
+	double t;
+
+	while ((opt = getopt(argc, argv, "s:r:")) != -1) {
+		switch (opt) {
+		case 's':
+			len = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s MB] [-r repeats]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	a = malloc(len);
+	b = malloc(len);
+	for (p = 0; p < 3; p++)
+		fill_ref[p] = malloc(len);
+	if (!a || !b || !fill_ref[0] || !fill_ref[1] || !fill_ref[2]) {
+		fprintf(stderr, "no memory for %zu MB buffers\n", len >> 20);
+		return 1;
+	}
+	memset(a, 0, len);
+	memset(b, 0, len);
+
+	printf("%zu MB, best kernels here: %s\n", len >> 20,
+	       fpgadma_verify_impl());
+	t = now();
+	for (r = 0; r < reps; r++)
+		memcpy(b, a, len);
+	report("memcpy", len, reps, now() - t);
+
+	for (i = 0; i < (int)(sizeof(impls) / sizeof(impls[0])); i++) {
+		if (fpgadma_verify_use(impls[i]))
+			continue;
+		printf("%s\n", impls[i]);
+		for (p = 0; p < 3; p++) {
+			char name[32];
+
+			t = now();
+			for (r = 0; r < reps; r++) {
+				fpgadma_pattern_init(&pat, p, 1);
+				fpgadma_pattern_fill(&pat, a, len);
+			}
+			snprintf(name, sizeof(name), "fill %s", pat_names[p]);
+			report(name, len, reps, now() - t);
+			if (!i)
+				memcpy(fill_ref[p], a, len);
+			else if (memcmp(fill_ref[p], a, len))
+				bad = printf("  %s differs from scalar\n",
+					     name);
+
+			t = now();
+			for (r = 0; r < reps; r++) {
+				fpgadma_pattern_init(&pat, p, 1);
+				n = fpgadma_pattern_check(&pat, a, len, NULL, 0);
+			}
+			snprintf(name, sizeof(name), "check %s", pat_names[p]);
+			report(name, len, reps, now() - t);
+			if (n)
+				bad = printf("  %s: %zu ranges\n", name, n);
+		}
+
+		memcpy(b, a, len);
+		t = now();
+		for (r = 0; r < reps; r++)
+			n = fpgadma_compare(a, b, len, NULL, 0);
+		report("compare", len, reps, now() - t);
+		if (n)
+			bad = printf("  compare: %zu ranges\n", n);
+
+		t = now();
+		for (r = 0; r < reps; r++)
+			crc = fpgadma_crc32c(0, a, len);
+		report("crc32c", len, reps, now() - t);
+		if (!i)
+			crc_ref = crc;
+		else if (crc != crc_ref)
+			bad = printf("  crc32c %08x, scalar %08x\n", crc,
+				     crc_ref);
+
+		inject(b, len);
+		memset(got, 0, sizeof(got));
+		n = fpgadma_compare(a, b, len, got, MAX_RANGES);
+		if (!i) {
+			memcpy(ref, got, sizeof(ref));
+			nref = n;
+			fpgadma_print_ranges(stdout, "  injected", got, n,
+					     MAX_RANGES);
+		} else if (n != nref || memcmp(ref, got, sizeof(ref))) {
+			bad = printf("  mismatch ranges differ from scalar\n");
+		}
+	}
+
+	/* known answer */
+	if (fpgadma_crc32c(0, "123456789", 9) != 0xe3069283)
+		bad = printf("crc32c check value wrong\n");
+	printf("%s\n", bad ? "FAILED" : "ok");
+	return bad ? 1 : 0;
+}
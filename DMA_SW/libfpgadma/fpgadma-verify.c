@@ -0,0 +1,605 @@
+/*
+ * libfpgadma - loopback data verification
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * Every kernel works on blocks: compares find the first 64 byte block that
+ * differs and only that block is walked word by word, pattern fills write
+ * groups of 8 words, the width of one AVX2 register and of the LFSR lane
+ * set. The scalar versions define the results, the vector ones have to
+ * produce the same words. ARMv7 has no CRC or carry-less multiply
+ * instructions, so CRC32C there is slicing-by-8; x86 uses SSE4.2 crc32.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fpgadma-verify.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VF_X86
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VF_NEON
+#include <arm_neon.h>
+#endif
+
+#define VF_BLOCK	64
+#define VF_GROUP	8	/* words per fill step */
+#define VF_CHUNK	4096	/* pattern generated per check step */
+
+struct vf_impl {
+	const char *name;
+	/* offset of the first differing block, @len if none; len % 64 == 0 */
+	size_t (*cmp)(const char *a, const char *b, size_t len);
+	void (*counter)(uint32_t *w, size_t groups, uint32_t start);
+	void (*lfsr)(uint32_t *w, size_t groups, uint32_t *lane);
+	uint32_t (*crc)(uint32_t crc, const char *p, size_t len);
+};
+
+static pthread_once_t vf_once = PTHREAD_ONCE_INIT;
+static const struct vf_impl *vf;
+static uint32_t vf_crc_table[8][256];
+
+/* ------------------------------------------------------------------------ */
+
+static uint32_t vf_xorshift(uint32_t x)
+{
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+static size_t cmp_scalar(const char *a, const char *b, size_t len)
+{
+	uint64_t x, y, d;
+	size_t i, j;
+
+	for (i = 0; i < len; i += VF_BLOCK) {
+		for (d = 0, j = 0; j < VF_BLOCK; j += 8) {
+			memcpy(&x, a + i + j, 8);
+			memcpy(&y, b + i + j, 8);
+			d |= x ^ y;
+		}
+		if (d)
+			break;
+	}
+	return i;
+}
+
+static void counter_scalar(uint32_t *w, size_t groups, uint32_t start)
+{
+	size_t i;
+
+	for (i = 0; i < groups * VF_GROUP; i++)
+		w[i] = start + i;
+}
+
+static void lfsr_scalar(uint32_t *w, size_t groups, uint32_t *lane)
+{
+	size_t g;
+	int j;
+
+	for (g = 0; g < groups; g++, w += VF_GROUP)
+		for (j = 0; j < VF_GROUP; j++)
+			w[j] = lane[j] = vf_xorshift(lane[j]);
+}
+
+/* slicing-by-8 over the reflected Castagnoli polynomial */
+static uint32_t crc_scalar(uint32_t crc, const char *p, size_t len)
+{
+	const unsigned char *s = (const unsigned char *)p;
+	uint32_t lo, hi;
+
+	crc = ~crc;
+	for (; len && ((uintptr_t)s & 7); len--)
+		crc = vf_crc_table[0][(crc ^ *s++) & 0xff] ^ (crc >> 8);
+	for (; len >= 8; len -= 8, s += 8) {
+		memcpy(&lo, s, 4);
+		memcpy(&hi, s + 4, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		lo = __builtin_bswap32(lo);
+		hi = __builtin_bswap32(hi);
+#endif
+		lo ^= crc;
+		crc = vf_crc_table[7][lo & 0xff] ^
+		      vf_crc_table[6][(lo >> 8) & 0xff] ^
+		      vf_crc_table[5][(lo >> 16) & 0xff] ^
+		      vf_crc_table[4][lo >> 24] ^
+		      vf_crc_table[3][hi & 0xff] ^
+		      vf_crc_table[2][(hi >> 8) & 0xff] ^
+		      vf_crc_table[1][(hi >> 16) & 0xff] ^
+		      vf_crc_table[0][hi >> 24];
+	}
+	for (; len; len--)
+		crc = vf_crc_table[0][(crc ^ *s++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static const struct vf_impl vf_scalar = {
+	.name = "scalar",
+	.cmp = cmp_scalar,
+	.counter = counter_scalar,
+	.lfsr = lfsr_scalar,
+	.crc = crc_scalar,
+};
+
+/* ------------------------------------------------------------------------ */
+
+#ifdef VF_X86
+#define VF_XOR_SSE2(a, b, o)						\
+	_mm_xor_si128(_mm_loadu_si128((const __m128i *)((a) + (o))),	\
+		      _mm_loadu_si128((const __m128i *)((b) + (o))))
+
+__attribute__((target("sse2")))
+static size_t cmp_sse2(const char *a, const char *b, size_t len)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i d;
+	size_t i;
+
+	for (i = 0; i < len; i += VF_BLOCK) {
+		d = _mm_or_si128(_mm_or_si128(VF_XOR_SSE2(a, b, i),
+					      VF_XOR_SSE2(a, b, i + 16)),
+				 _mm_or_si128(VF_XOR_SSE2(a, b, i + 32),
+					      VF_XOR_SSE2(a, b, i + 48)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(d, zero)) != 0xffff)
+			break;
+	}
+	return i;
+}
+
+__attribute__((target("sse2")))
+static void counter_sse2(uint32_t *w, size_t groups, uint32_t start)
+{
+	const __m128i step = _mm_set1_epi32(VF_GROUP);
+	__m128i lo = _mm_add_epi32(_mm_set1_epi32(start),
+				   _mm_setr_epi32(0, 1, 2, 3));
+	__m128i hi = _mm_add_epi32(lo, _mm_set1_epi32(4));
+	size_t g;
+
+	for (g = 0; g < groups; g++, w += VF_GROUP) {
+		_mm_storeu_si128((__m128i *)w, lo);
+		_mm_storeu_si128((__m128i *)(w + 4), hi);
+		lo = _mm_add_epi32(lo, step);
+		hi = _mm_add_epi32(hi, step);
+	}
+}
+
+#define VF_XORSHIFT_SSE2(x) do {				\
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));		\
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));		\
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));		\
+} while (0)
+
+__attribute__((target("sse2")))
+static void lfsr_sse2(uint32_t *w, size_t groups, uint32_t *lane)
+{
+	__m128i lo = _mm_loadu_si128((const __m128i *)lane);
+	__m128i hi = _mm_loadu_si128((const __m128i *)(lane + 4));
+	size_t g;
+
+	for (g = 0; g < groups; g++, w += VF_GROUP) {
+		VF_XORSHIFT_SSE2(lo);
+		VF_XORSHIFT_SSE2(hi);
+		_mm_storeu_si128((__m128i *)w, lo);
+		_mm_storeu_si128((__m128i *)(w + 4), hi);
+	}
+	_mm_storeu_si128((__m128i *)lane, lo);
+	_mm_storeu_si128((__m128i *)(lane + 4), hi);
+}
+
+#define VF_XOR_AVX2(a, b, o)						\
+	_mm256_xor_si256(_mm256_loadu_si256((const __m256i *)((a) + (o))), \
+			 _mm256_loadu_si256((const __m256i *)((b) + (o))))
+
+__attribute__((target("avx2")))
+static size_t cmp_avx2(const char *a, const char *b, size_t len)
+{
+	__m256i d;
+	size_t i;
+
+	for (i = 0; i < len; i += VF_BLOCK) {
+		d = _mm256_or_si256(VF_XOR_AVX2(a, b, i),
+				    VF_XOR_AVX2(a, b, i + 32));
+		if (!_mm256_testz_si256(d, d))
+			break;
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static void counter_avx2(uint32_t *w, size_t groups, uint32_t start)
+{
+	const __m256i step = _mm256_set1_epi32(VF_GROUP);
+	__m256i v = _mm256_add_epi32(_mm256_set1_epi32(start),
+				     _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	size_t g;
+
+	for (g = 0; g < groups; g++, w += VF_GROUP) {
+		_mm256_storeu_si256((__m256i *)w, v);
+		v = _mm256_add_epi32(v, step);
+	}
+}
+
+__attribute__((target("avx2")))
+static void lfsr_avx2(uint32_t *w, size_t groups, uint32_t *lane)
+{
+	__m256i x = _mm256_loadu_si256((const __m256i *)lane);
+	size_t g;
+
+	for (g = 0; g < groups; g++, w += VF_GROUP) {
+		x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+		x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+		x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+		_mm256_storeu_si256((__m256i *)w, x);
+	}
+	_mm256_storeu_si256((__m256i *)lane, x);
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc, const char *p, size_t len)
+{
+	uint64_t c = ~crc, v;
+
+	for (; len && ((uintptr_t)p & 7); len--)
+		c = _mm_crc32_u8(c, *p++);
+#ifdef __x86_64__
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&v, p, 8);
+		c = _mm_crc32_u64(c, v);
+	}
+#else
+	for (; len >= 4; len -= 4, p += 4) {
+		memcpy(&v, p, 4);
+		c = _mm_crc32_u32(c, (uint32_t)v);
+	}
+#endif
+	for (; len; len--)
+		c = _mm_crc32_u8(c, *p++);
+	return ~(uint32_t)c;
+}
+
+static struct vf_impl vf_sse2 = {
+	.name = "sse2",
+	.cmp = cmp_sse2,
+	.counter = counter_sse2,
+	.lfsr = lfsr_sse2,
+	.crc = crc_scalar,
+};
+
+static struct vf_impl vf_avx2 = {
+	.name = "avx2",
+	.cmp = cmp_avx2,
+	.counter = counter_avx2,
+	.lfsr = lfsr_avx2,
+	.crc = crc_scalar,
+};
+#endif /* VF_X86 */
+
+/* ------------------------------------------------------------------------ */
+
+#ifdef VF_NEON
+static size_t cmp_neon(const char *a, const char *b, size_t len)
+{
+	const uint8_t *x = (const uint8_t *)a, *y = (const uint8_t *)b;
+	uint64x2_t d;
+	size_t i;
+
+	for (i = 0; i < len; i += VF_BLOCK) {
+		d = vreinterpretq_u64_u8(vorrq_u8(
+			vorrq_u8(veorq_u8(vld1q_u8(x + i), vld1q_u8(y + i)),
+				 veorq_u8(vld1q_u8(x + i + 16),
+					  vld1q_u8(y + i + 16))),
+			vorrq_u8(veorq_u8(vld1q_u8(x + i + 32),
+					  vld1q_u8(y + i + 32)),
+				 veorq_u8(vld1q_u8(x + i + 48),
+					  vld1q_u8(y + i + 48)))));
+		if (vgetq_lane_u64(d, 0) | vgetq_lane_u64(d, 1))
+			break;
+	}
+	return i;
+}
+
+static void counter_neon(uint32_t *w, size_t groups, uint32_t start)
+{
+	static const uint32_t idx[4] = { 0, 1, 2, 3 };
+	const uint32x4_t step = vdupq_n_u32(VF_GROUP);
+	uint32x4_t lo = vaddq_u32(vdupq_n_u32(start), vld1q_u32(idx));
+	uint32x4_t hi = vaddq_u32(lo, vdupq_n_u32(4));
+	size_t g;
+
+	for (g = 0; g < groups; g++, w += VF_GROUP) {
+		vst1q_u32(w, lo);
+		vst1q_u32(w + 4, hi);
+		lo = vaddq_u32(lo, step);
+		hi = vaddq_u32(hi, step);
+	}
+}
+
+#define VF_XORSHIFT_NEON(x) do {				\
+	x = veorq_u32(x, vshlq_n_u32(x, 13));			\
+	x = veorq_u32(x, vshrq_n_u32(x, 17));			\
+	x = veorq_u32(x, vshlq_n_u32(x, 5));			\
+} while (0)
+
+static void lfsr_neon(uint32_t *w, size_t groups, uint32_t *lane)
+{
+	uint32x4_t lo = vld1q_u32(lane);
+	uint32x4_t hi = vld1q_u32(lane + 4);
+	size_t g;
+
+	for (g = 0; g < groups; g++, w += VF_GROUP) {
+		VF_XORSHIFT_NEON(lo);
+		VF_XORSHIFT_NEON(hi);
+		vst1q_u32(w, lo);
+		vst1q_u32(w + 4, hi);
+	}
+	vst1q_u32(lane, lo);
+	vst1q_u32(lane + 4, hi);
+}
+
+static const struct vf_impl vf_neon = {
+	.name = "neon",
+	.cmp = cmp_neon,
+	.counter = counter_neon,
+	.lfsr = lfsr_neon,
+	.crc = crc_scalar,
+};
+#endif /* VF_NEON */
+
+/* ------------------------------------------------------------------------ */
+
+/* the best kernels this CPU runs, or @name */
+static const struct vf_impl *vf_pick(const char *name)
+{
+	const struct vf_impl *best = &vf_scalar;
+
+#ifdef VF_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2"))
+		vf_sse2.crc = vf_avx2.crc = crc_sse42;
+	if (__builtin_cpu_supports("sse2")) {
+		if (name && !strcmp(name, vf_sse2.name))
+			return &vf_sse2;
+		best = &vf_sse2;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		if (name && !strcmp(name, vf_avx2.name))
+			return &vf_avx2;
+		best = &vf_avx2;
+	}
+#endif
+#ifdef VF_NEON
+	/*
+	 * Not checked against scalar on a board yet, so only used when
+	 * asked for; run fpgadma-verify-bench on the target first.
+	 */
+	if (name && !strcmp(name, vf_neon.name))
+		return &vf_neon;
+#endif
+	if (name)
+		return strcmp(name, vf_scalar.name) ? NULL : &vf_scalar;
+	return best;
+}
+
+static void vf_init(void)
+{
+	uint32_t c;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+		vf_crc_table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			vf_crc_table[j][i] =
+				vf_crc_table[0][vf_crc_table[j - 1][i] & 0xff] ^
+				(vf_crc_table[j - 1][i] >> 8);
+	vf = vf_pick(getenv("FPGADMA_VERIFY"));
+	if (!vf)
+		vf = vf_pick(NULL);
+}
+
+static const struct vf_impl *vf_get(void)
+{
+	pthread_once(&vf_once, vf_init);
+	return vf;
+}
+
+const char *fpgadma_verify_impl(void)
+{
+	return vf_get()->name;
+}
+
+int fpgadma_verify_use(const char *name)
+{
+	const struct vf_impl *im;
+
+	vf_get();
+	im = vf_pick(name);
+	if (!im)
+		return -ENOENT;
+	vf = im;
+	return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* mismatches found so far; consecutive bad words make one range */
+struct vf_ranges {
+	struct fpgadma_range *r;
+	unsigned int max;
+	size_t n;
+	size_t end;		/* of the last range */
+};
+
+static void vf_add(struct vf_ranges *vr, size_t off, size_t len)
+{
+	if (vr->n && vr->end == off) {
+		if (vr->n <= vr->max)
+			vr->r[vr->n - 1].len += len;
+	} else {
+		if (vr->n < vr->max) {
+			vr->r[vr->n].off = off;
+			vr->r[vr->n].len = len;
+		}
+		vr->n++;
+	}
+	vr->end = off + len;
+}
+
+/* @a and @b are at byte @base of what the caller checks */
+static void vf_compare(const struct vf_impl *im, const char *a,
+		       const char *b, size_t len, size_t base,
+		       struct vf_ranges *vr)
+{
+	size_t off = 0, end, w, n;
+
+	while (off < len) {
+		off += im->cmp(a + off, b + off,
+			       (len - off) & ~(size_t)(VF_BLOCK - 1));
+		if (off >= len)
+			break;
+		/* a differing block, or the tail: word by word */
+		end = len - off < VF_BLOCK ? len : off + VF_BLOCK;
+		for (w = off; w < end; w += n) {
+			n = end - w < 4 ? end - w : 4;
+			if (memcmp(a + w, b + w, n))
+				vf_add(vr, base + w, n);
+		}
+		off = end;
+	}
+}
+
+size_t fpgadma_compare(const void *expect, const void *got, size_t len,
+		       struct fpgadma_range *ranges, unsigned int max)
+{
+	struct vf_ranges vr = { ranges, ranges ? max : 0, 0, 0 };
+
+	vf_compare(vf_get(), expect, got, len, 0, &vr);
+	return vr.n;
+}
+
+uint32_t fpgadma_crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	return vf_get()->crc(crc, buf, len);
+}
+
+void fpgadma_print_ranges(FILE *f, const char *what,
+			  const struct fpgadma_range *ranges, size_t n,
+			  unsigned int max)
+{
+	size_t i;
+
+	fprintf(f, "%s: %zu mismatching range%s\n", what, n,
+		n == 1 ? "" : "s");
+	for (i = 0; i < n && i < max; i++)
+		fprintf(f, "  bytes %#zx - %#zx (%zu word%s)\n",
+			ranges[i].off, ranges[i].off + ranges[i].len - 1,
+			(ranges[i].len + 3) / 4, ranges[i].len > 4 ? "s" : "");
+	if (n > max)
+		fprintf(f, "  ...\n");
+}
+
+/* ------------------------------------------------------------------------ */
+
+void fpgadma_pattern_init(struct fpgadma_pattern *pat, int type,
+			  uint32_t seed)
+{
+	int j;
+
+	memset(pat, 0, sizeof(*pat));
+	pat->type = type;
+	pat->seed = seed;
+	for (j = 0; j < VF_GROUP; j++) {
+		pat->lane[j] = seed ^ (0x9e3779b9u * (j + 1));
+		if (!pat->lane[j])
+			pat->lane[j] = 1;
+	}
+}
+
+static uint32_t vf_pattern_word(struct fpgadma_pattern *pat)
+{
+	uint32_t i = pat->seed + (uint32_t)pat->index;
+	uint32_t *lane;
+
+	switch (pat->type) {
+	case FPGADMA_PAT_LFSR:
+		lane = &pat->lane[pat->index % VF_GROUP];
+		*lane = vf_xorshift(*lane);
+		i = *lane;
+		break;
+	case FPGADMA_PAT_WALK1:
+		i = 1u << (i % 32);
+		break;
+	}
+	pat->index++;
+	return i;
+}
+
+/* @n words, whole groups from the vector kernels */
+static void vf_pattern_words(const struct vf_impl *im,
+			     struct fpgadma_pattern *pat, uint32_t *w,
+			     size_t n)
+{
+	uint32_t period[32], start;
+	size_t groups, i;
+
+	for (; n && pat->index % VF_GROUP; n--)
+		*w++ = vf_pattern_word(pat);
+	groups = n / VF_GROUP;
+	start = pat->seed + (uint32_t)pat->index;
+	switch (pat->type) {
+	case FPGADMA_PAT_COUNTER:
+		im->counter(w, groups, start);
+		break;
+	case FPGADMA_PAT_LFSR:
+		im->lfsr(w, groups, pat->lane);
+		break;
+	case FPGADMA_PAT_WALK1:
+		/* 32 word period, a memcpy of it at a time */
+		for (i = 0; i < 32; i++)
+			period[i] = 1u << ((start + i) % 32);
+		for (i = 0; i + 32 <= groups * VF_GROUP; i += 32)
+			memcpy(w + i, period, sizeof(period));
+		memcpy(w + i, period, (groups * VF_GROUP - i) * 4);
+		break;
+	}
+	w += groups * VF_GROUP;
+	pat->index += groups * VF_GROUP;
+	for (n -= groups * VF_GROUP; n; n--)
+		*w++ = vf_pattern_word(pat);
+}
+
+void fpgadma_pattern_fill(struct fpgadma_pattern *pat, void *buf, size_t len)
+{
+	vf_pattern_words(vf_get(), pat, buf, len / 4);
+}
+
+size_t fpgadma_pattern_check(struct fpgadma_pattern *pat, const void *buf,
+			     size_t len, struct fpgadma_range *ranges,
+			     unsigned int max)
+{
+	const struct vf_impl *im = vf_get();
+	struct vf_ranges vr = { ranges, ranges ? max : 0, 0, 0 };
+	uint32_t expect[VF_CHUNK / 4] __attribute__((aligned(VF_BLOCK)));
+	size_t off, n;
+
+	len &= ~(size_t)3;
+	/* generated a cache sized chunk at a time, compared while hot */
+	for (off = 0; off < len; off += n) {
+		n = len - off < VF_CHUNK ? len - off : VF_CHUNK;
+		vf_pattern_words(im, pat, expect, n / 4);
+		vf_compare(im, (const char *)expect, (const char *)buf + off,
+			   n, off, &vr);
+	}
+	return vr.n;
+}
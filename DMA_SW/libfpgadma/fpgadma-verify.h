@@ -0,0 +1,79 @@
+/*
+ * libfpgadma - loopback data verification
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * Test patterns, buffer compares and CRC32C for loopback tests, with
+ * SSE2/AVX2 and SSE4.2 kernels picked at run time, NEON on request, and
+ * a scalar fallback. Mismatches are reported as byte ranges of
+ * consecutive bad 32-bit words rather than word by word. Has no
+ * dependency on the rest of the library, programs that only want this
+ * can build fpgadma-verify.c on its own.
+ */
+#ifndef _FPGADMA_VERIFY_H
+#define _FPGADMA_VERIFY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* word i of a pattern stream, 32-bit words, for seed s */
+#define FPGADMA_PAT_COUNTER	0	/* s + i */
+#define FPGADMA_PAT_LFSR	1	/* 8 interleaved xorshift32 sequences */
+#define FPGADMA_PAT_WALK1	2	/* 1 << ((s + i) % 32) */
+
+/* generator state, a stream continues over successive fill/check calls */
+struct fpgadma_pattern {
+	int type;
+	uint32_t seed;
+	uint64_t index;		/* next word of the stream */
+	uint32_t lane[8];	/* LFSR state, word i comes from lane i % 8 */
+};
+
+/* bytes [off, off + len) differ */
+struct fpgadma_range {
+	size_t off;
+	size_t len;
+};
+
+void fpgadma_pattern_init(struct fpgadma_pattern *pat, int type,
+			  uint32_t seed);
+/* @len is a multiple of 4 */
+void fpgadma_pattern_fill(struct fpgadma_pattern *pat, void *buf, size_t len);
+/*
+ * Check @buf against the next @len bytes (whole words) of the stream.
+ * Returns the number of mismatching ranges, the first @max of them are
+ * stored in @ranges.
+ */
+size_t fpgadma_pattern_check(struct fpgadma_pattern *pat, const void *buf,
+			     size_t len, struct fpgadma_range *ranges,
+			     unsigned int max);
+
+/* as fpgadma_pattern_check(), against a second buffer */
+size_t fpgadma_compare(const void *expect, const void *got, size_t len,
+		       struct fpgadma_range *ranges, unsigned int max);
+
+/* CRC32C (Castagnoli), 0 to start, the previous result to continue */
+uint32_t fpgadma_crc32c(uint32_t crc, const void *buf, size_t len);
+
+/* one line per range, "@what: N mismatching ranges" and the first @max */
+void fpgadma_print_ranges(FILE *f, const char *what,
+			  const struct fpgadma_range *ranges, size_t n,
+			  unsigned int max);
+
+/* kernels in use: "avx2", "sse2", "neon" (only if forced) or "scalar" */
+const char *fpgadma_verify_impl(void);
+/* force one of them, for testing; -ENOENT if this CPU can't run it */
+int fpgadma_verify_use(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FPGADMA_VERIFY_H */
@@ -0,0 +1,416 @@
+/*
+ * libfpgadma - user space interface to the FPGA DMA transfer module
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "fpgadma.h"
+#include "fpgadma-backend.h"
+
+#define FPGADMA_HUGE_SIZE	(2UL << 20)
+/* blocks never share a cache line, the CPU side of one can't dirty another */
+#define FPGADMA_ALIGN		64
+
+struct fpgadma_pool {
+	struct fpgadma_dev *dma;
+	char *base;
+	size_t size;		/* of the mapping */
+	size_t block_size;
+	uint32_t handle;	/* registered buffer */
+	pthread_mutex_t lock;
+	uint32_t *free;		/* stack of free block numbers */
+	unsigned int nfree;
+};
+
+static int fpgadma_ioctl(struct fpgadma_dev *dma, unsigned long cmd,
+			 void *arg)
+{
+	return dma->ops->ioctl(dma, cmd, arg);
+}
+
+/* ------------------------------------------------------------------------ */
+
+static int fpgadma_dev_ioctl(struct fpgadma_dev *dma, unsigned long cmd,
+			     void *arg)
+{
+	int ret;
+
+	do {
+		ret = ioctl(dma->fd, cmd, arg);
+	} while (ret < 0 && errno == EINTR);
+	return ret < 0 ? -errno : ret;
+}
+
+static ssize_t fpgadma_dev_rw(struct fpgadma_dev *dma, uint32_t dir,
+			      void *buf, size_t len)
+{
+	ssize_t ret;
+
+	do {
+		ret = dir == FPGA_DMA_TX ? write(dma->fd, buf, len) :
+		      read(dma->fd, buf, len);
+	} while (ret < 0 && errno == EINTR);
+	return ret < 0 ? -errno : ret;
+}
+
+static void fpgadma_dev_release(struct fpgadma_dev *dma)
+{
+	close(dma->fd);
+}
+
+static const struct fpgadma_ops fpgadma_dev_ops = {
+	.ioctl = fpgadma_dev_ioctl,
+	.rw = fpgadma_dev_rw,
+	.release = fpgadma_dev_release,
+};
+
+/* common tail of the open functions, takes over @dma */
+int fpgadma_setup(struct fpgadma_dev *dma, struct fpgadma_dev **dmap)
+{
+	struct fpga_dma_status st;
+	int ret;
+
+	ret = fpgadma_status(dma, &st);
+	if (ret) {
+		fpgadma_close(dma);
+		return ret;
+	}
+	dma->data_width = st.data_width ? st.data_width : 1;
+	*dmap = dma;
+	return 0;
+}
+
+int fpgadma_open(int instance, struct fpgadma_dev **dmap)
+{
+	struct fpgadma_dev *dma;
+	char name[32];
+	int ret;
+
+	dma = calloc(1, sizeof(*dma));
+	if (!dma)
+		return -ENOMEM;
+	snprintf(name, sizeof(name), FPGA_DMA_DEV_FMT, instance);
+	dma->fd = open(name, O_RDWR | O_CLOEXEC);
+	if (dma->fd < 0) {
+		ret = -errno;
+		free(dma);
+		return ret;
+	}
+	dma->ops = &fpgadma_dev_ops;
+	return fpgadma_setup(dma, dmap);
+}
+
+void fpgadma_close(struct fpgadma_dev *dma)
+{
+	if (!dma)
+		return;
+	dma->ops->release(dma);
+	free(dma);
+}
+
+int fpgadma_is_loopback(const struct fpgadma_dev *dma)
+{
+	return dma->ops != &fpgadma_dev_ops;
+}
+
+int fpgadma_fd(const struct fpgadma_dev *dma)
+{
+	return dma->fd;
+}
+
+int fpgadma_status(struct fpgadma_dev *dma, struct fpga_dma_status *st)
+{
+	return fpgadma_ioctl(dma, FPGA_DMA_IOC_STATUS, st);
+}
+
+int fpgadma_csr_read(struct fpgadma_dev *dma, unsigned int reg,
+		     uint32_t *val)
+{
+	if (!dma->ops->csr_read)
+		return -ENOTTY;
+	return dma->ops->csr_read(dma, reg, val);
+}
+
+int fpgadma_csr_write(struct fpgadma_dev *dma, unsigned int reg,
+		      uint32_t val)
+{
+	if (!dma->ops->csr_write)
+		return -ENOTTY;
+	return dma->ops->csr_write(dma, reg, val);
+}
+
+int fpgadma_set_engine(struct fpgadma_dev *dma, uint32_t engine)
+{
+	return fpgadma_ioctl(dma, FPGA_DMA_IOC_SET_ENGINE, &engine);
+}
+
+ssize_t fpgadma_write(struct fpgadma_dev *dma, const void *buf, size_t len)
+{
+	return dma->ops->rw(dma, FPGA_DMA_TX, (void *)buf, len);
+}
+
+ssize_t fpgadma_read(struct fpgadma_dev *dma, void *buf, size_t len)
+{
+	return dma->ops->rw(dma, FPGA_DMA_RX, buf, len);
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* MAP_HUGETLB if pages are reserved, else a THP hint, else small pages */
+static void *fpgadma_map(size_t size)
+{
+	void *p;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED)
+		return p;
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	madvise(p, size, MADV_HUGEPAGE);
+	return p;
+}
+
+int fpgadma_pool_create(struct fpgadma_dev *dma, size_t block_size,
+			unsigned int blocks, struct fpgadma_pool **poolp)
+{
+	struct fpga_dma_buf reg;
+	struct fpgadma_pool *pool;
+	size_t align;
+	unsigned int i;
+	int ret;
+
+	if (!block_size || !blocks)
+		return -EINVAL;
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return -ENOMEM;
+	pool->dma = dma;
+	align = dma->data_width > FPGADMA_ALIGN ? dma->data_width :
+		FPGADMA_ALIGN;
+	pool->block_size = (block_size + align - 1) / align * align;
+	pool->size = pool->block_size * blocks;
+	pool->size = (pool->size + FPGADMA_HUGE_SIZE - 1) &
+		     ~(FPGADMA_HUGE_SIZE - 1);
+	pool->free = calloc(blocks, sizeof(*pool->free));
+	pool->base = fpgadma_map(pool->size);
+	if (!pool->free || !pool->base) {
+		ret = -ENOMEM;
+		goto err;
+	}
+	/* fault everything in, pinning would do it one page at a time */
+	memset(pool->base, 0, pool->size);
+
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (unsigned long)pool->base;
+	reg.len = pool->size;
+	reg.dir = FPGA_DMA_TXRX;
+	ret = fpgadma_ioctl(dma, FPGA_DMA_IOC_REG_BUF, &reg);
+	if (ret)
+		goto err;
+	pool->handle = reg.handle;
+
+	for (i = 0; i < blocks; i++)
+		pool->free[i] = blocks - 1 - i;
+	pool->nfree = blocks;
+	pthread_mutex_init(&pool->lock, NULL);
+	*poolp = pool;
+	return 0;
+
+err:
+	if (pool->base)
+		munmap(pool->base, pool->size);
+	free(pool->free);
+	free(pool);
+	return ret;
+}
+
+/* all blocks must be back and idle; the driver unpins the memory */
+void fpgadma_pool_destroy(struct fpgadma_pool *pool)
+{
+	if (!pool)
+		return;
+	fpgadma_ioctl(pool->dma, FPGA_DMA_IOC_UNREG_BUF, &pool->handle);
+	munmap(pool->base, pool->size);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->free);
+	free(pool);
+}
+
+int fpgadma_buf_get(struct fpgadma_pool *pool, struct fpgadma_buf *buf)
+{
+	uint32_t index;
+
+	pthread_mutex_lock(&pool->lock);
+	if (!pool->nfree) {
+		pthread_mutex_unlock(&pool->lock);
+		return -EAGAIN;
+	}
+	index = pool->free[--pool->nfree];
+	pthread_mutex_unlock(&pool->lock);
+
+	buf->ptr = pool->base + (size_t)index * pool->block_size;
+	buf->len = pool->block_size;
+	buf->pool = pool;
+	buf->index = index;
+	return 0;
+}
+
+void fpgadma_buf_put(const struct fpgadma_buf *buf)
+{
+	struct fpgadma_pool *pool = buf->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->free[pool->nfree++] = buf->index;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void fpgadma_xfer_init(struct fpga_dma_xfer *xfer,
+			      const struct fpgadma_buf *buf, size_t off,
+			      size_t len, uint32_t dir, uint32_t flags)
+{
+	struct fpgadma_pool *pool = buf->pool;
+
+	memset(xfer, 0, sizeof(*xfer));
+	xfer->addr = (char *)buf->ptr - pool->base + off;
+	xfer->len = len;
+	xfer->dir = dir;
+	xfer->flags = flags | FPGA_DMA_XFER_REGBUF;
+	xfer->handle = pool->handle;
+}
+
+void fpgadma_batch_init(struct fpgadma_batch *batch,
+			struct fpga_dma_xfer *xfers, unsigned int max)
+{
+	batch->xfers = xfers;
+	batch->count = 0;
+	batch->max = max;
+}
+
+int fpgadma_batch_add(struct fpgadma_batch *batch,
+		      const struct fpgadma_buf *buf, size_t off, size_t len,
+		      uint32_t dir, uint32_t flags)
+{
+	if (off > buf->len || len > buf->len - off)
+		return -EINVAL;
+	if (batch->count == batch->max)
+		return -ENOSPC;
+	fpgadma_xfer_init(&batch->xfers[batch->count++], buf, off, len, dir,
+			  flags);
+	return 0;
+}
+
+int fpgadma_batch_add_user(struct fpgadma_batch *batch, void *ptr,
+			   size_t len, uint32_t dir, uint32_t flags)
+{
+	struct fpga_dma_xfer *xfer;
+
+	if (batch->count == batch->max)
+		return -ENOSPC;
+	xfer = &batch->xfers[batch->count++];
+	memset(xfer, 0, sizeof(*xfer));
+	xfer->addr = (unsigned long)ptr;
+	xfer->len = len;
+	xfer->dir = dir;
+	xfer->flags = flags;
+	return 0;
+}
+
+int fpgadma_batch_submit(struct fpgadma_dev *dma,
+			 struct fpgadma_batch *batch)
+{
+	struct fpga_dma_batch b;
+	unsigned int queued = 0;
+	int ret = 0;
+
+	/* the driver may stop early on a signal, go on from there */
+	while (queued < batch->count) {
+		memset(&b, 0, sizeof(b));
+		b.xfers = (unsigned long)(batch->xfers + queued);
+		b.count = batch->count - queued;
+		ret = fpgadma_ioctl(dma, FPGA_DMA_IOC_SUBMIT_BATCH, &b);
+		if (ret <= 0)
+			break;
+		queued += ret;
+	}
+	batch->count = 0;
+	return queued ? (int)queued : ret;
+}
+
+/* ------------------------------------------------------------------------ */
+
+int fpgadma_set_notify(struct fpgadma_dev *dma, unsigned int batch,
+		       unsigned int delay_us)
+{
+	struct fpga_dma_notify n;
+
+	memset(&n, 0, sizeof(n));
+	n.eventfd = -1;
+	n.batch = batch;
+	n.delay_us = delay_us;
+	return fpgadma_ioctl(dma, FPGA_DMA_IOC_SET_NOTIFY, &n);
+}
+
+int fpgadma_poll(struct fpgadma_dev *dma, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = dma->fd, .events = POLLIN };
+	__u32 n;
+	int ret;
+
+	ret = poll(&pfd, 1, timeout_ms);
+	if (ret < 0)
+		return -errno;
+	if (!ret)
+		return 0;
+	ret = fpgadma_ioctl(dma, FPGA_DMA_IOC_EVENTS, &n);
+	return ret ? ret : (int)n;
+}
+
+int fpgadma_done(struct fpgadma_dev *dma, uint32_t dir, int32_t cookie)
+{
+	struct fpga_dma_status st;
+	int32_t last;
+
+	if (fpgadma_status(dma, &st))
+		return 0;
+	last = dir == FPGA_DMA_RX ? st.rx_last_cookie : st.tx_last_cookie;
+	/*
+	 * Cookies grow per channel and the channel completes in order; the
+	 * difference is taken unsigned so it stays defined when they wrap.
+	 */
+	return last > 0 && (int32_t)((uint32_t)last - (uint32_t)cookie) >= 0;
+}
+
+int fpgadma_wait(struct fpgadma_dev *dma, uint32_t dir, int32_t cookie)
+{
+	struct fpga_dma_wait w = { .dir = dir, .cookie = cookie };
+
+	return fpgadma_ioctl(dma, FPGA_DMA_IOC_WAIT, &w);
+}
+
+int fpgadma_transceive(struct fpgadma_dev *dma, const struct fpgadma_buf *tx,
+		       const struct fpgadma_buf *rx, size_t len)
+{
+	struct fpga_dma_transceive xc;
+
+	if (len > tx->len || len > rx->len)
+		return -EINVAL;
+	fpgadma_xfer_init(&xc.tx, tx, 0, len, FPGA_DMA_TX, 0);
+	fpgadma_xfer_init(&xc.rx, rx, 0, len, FPGA_DMA_RX, 0);
+	return fpgadma_ioctl(dma, FPGA_DMA_IOC_TRANSCEIVE, &xc);
+}
@@ -0,0 +1,145 @@
+/*
+ * libfpgadma - user space interface to the FPGA DMA transfer module
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * Wraps /dev/fpga_dmaN: buffers come from a pool that is registered with
+ * the driver once (pinned and mapped for the lifetime of the pool), many
+ * transfers are queued with one FPGA_DMA_IOC_SUBMIT_BATCH and completions
+ * are collected through poll() on the device. All functions return 0 (or
+ * a count) on success and a negative errno on failure.
+ *
+ * fpgadma_open_loopback() gives the same interface without hardware: a
+ * software model of the driver and the loopback FIFO, for tests and
+ * benchmarks on any Linux host.
+ */
+#ifndef _FPGADMA_H
+#define _FPGADMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "fpga-dma.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct fpgadma_dev;
+struct fpgadma_pool;
+
+/* one block of a pool; ptr is ready to be filled or read by the CPU */
+struct fpgadma_buf {
+	void *ptr;
+	size_t len;
+	struct fpgadma_pool *pool;
+	uint32_t index;		/* block number within the pool */
+};
+
+/* transfers collected for one FPGA_DMA_IOC_SUBMIT_BATCH */
+struct fpgadma_batch {
+	struct fpga_dma_xfer *xfers;
+	unsigned int count;
+	unsigned int max;
+};
+
+/* software loopback, zeros select the defaults of the DE1-SoC design */
+struct fpgadma_loopback_config {
+	uint32_t fifo_depth;	/* words, default 1024 */
+	uint32_t data_width;	/* bytes per word, default 8 */
+	uint32_t queue_depth;	/* transfers in flight per direction, 8 */
+	uint32_t burst_words;	/* default 16 */
+	uint32_t timeout_ms;	/* of a wait, default 1000 */
+};
+
+/* CSR port of flow_control_fifo_tx_ack, in 32-bit words */
+#define FPGADMA_CSR_WR_WTRMK	0	/* TX burst while fill <= this */
+#define FPGADMA_CSR_RD_WTRMK	1	/* RX burst while fill >= this */
+#define FPGADMA_CSR_BURST	2	/* request lines, read only */
+#define FPGADMA_CSR_FIFO_STATUS	3	/* full, empty and fill level */
+#define FPGADMA_CSR_DATA_WIDTH	4	/* in bits */
+#define FPGADMA_CSR_FIFO_DEPTH	5	/* in words */
+#define FPGADMA_CSR_FIFO_CLEAR	6	/* write 1 to empty the FIFO */
+#define FPGADMA_CSR_FIFO2_STATUS 7
+#define FPGADMA_CSR_WORDS	8
+
+#define FPGADMA_CSR_TX_SINGLE	(1 << 0)
+#define FPGADMA_CSR_TX_BURST	(1 << 1)
+#define FPGADMA_CSR_RX_SINGLE	(1 << 2)
+#define FPGADMA_CSR_RX_BURST	(1 << 3)
+
+#define FPGADMA_CSR_FIFO_FULL	(1 << 25)
+#define FPGADMA_CSR_FIFO_EMPTY	(1 << 24)
+#define FPGADMA_CSR_FIFO_USED	((1 << 24) - 1)
+
+/* instance N is /dev/fpga_dmaN */
+int fpgadma_open(int instance, struct fpgadma_dev **dma);
+int fpgadma_open_loopback(const struct fpgadma_loopback_config *cfg,
+			  struct fpgadma_dev **dma);
+void fpgadma_close(struct fpgadma_dev *dma);
+int fpgadma_is_loopback(const struct fpgadma_dev *dma);
+int fpgadma_fd(const struct fpgadma_dev *dma);
+int fpgadma_status(struct fpgadma_dev *dma, struct fpga_dma_status *st);
+/* FIFO registers of the loopback model, -ENOTTY on a device */
+int fpgadma_csr_read(struct fpgadma_dev *dma, unsigned int reg,
+		     uint32_t *val);
+int fpgadma_csr_write(struct fpgadma_dev *dma, unsigned int reg,
+		      uint32_t val);
+
+/* read()/write() and the FPGA_DMA_ENGINE_* they use */
+int fpgadma_set_engine(struct fpgadma_dev *dma, uint32_t engine);
+ssize_t fpgadma_write(struct fpgadma_dev *dma, const void *buf, size_t len);
+ssize_t fpgadma_read(struct fpgadma_dev *dma, void *buf, size_t len);
+
+/*
+ * @blocks buffers of @block_size bytes (rounded up to whole words) in one
+ * registered allocation, backed by huge pages when the system has them.
+ * Get and put are thread safe; get returns -EAGAIN when all are in use.
+ */
+int fpgadma_pool_create(struct fpgadma_dev *dma, size_t block_size,
+			unsigned int blocks, struct fpgadma_pool **pool);
+void fpgadma_pool_destroy(struct fpgadma_pool *pool);
+int fpgadma_buf_get(struct fpgadma_pool *pool, struct fpgadma_buf *buf);
+void fpgadma_buf_put(const struct fpgadma_buf *buf);
+
+void fpgadma_batch_init(struct fpgadma_batch *batch,
+			struct fpga_dma_xfer *xfers, unsigned int max);
+/* -ENOSPC once max transfers are collected */
+int fpgadma_batch_add(struct fpgadma_batch *batch,
+		      const struct fpgadma_buf *buf, size_t off, size_t len,
+		      uint32_t dir, uint32_t flags);
+/* plain user memory, pinned by the driver for this transfer only */
+int fpgadma_batch_add_user(struct fpgadma_batch *batch, void *ptr,
+			   size_t len, uint32_t dir, uint32_t flags);
+/*
+ * Queue everything collected so far, in order, and empty the batch.
+ * Returns how many were queued; their cookies and queued lengths are in
+ * xfers[0 .. ret - 1] until the next fpgadma_batch_add().
+ */
+int fpgadma_batch_submit(struct fpgadma_dev *dma,
+			 struct fpgadma_batch *batch);
+
+/* every completion, or one per @batch of them / after @delay_us */
+int fpgadma_set_notify(struct fpgadma_dev *dma, unsigned int batch,
+		       unsigned int delay_us);
+/*
+ * Wait up to @timeout_ms (-1 forever) for completions of this handle.
+ * Returns how many were signalled since the last call, 0 on timeout.
+ */
+int fpgadma_poll(struct fpgadma_dev *dma, int timeout_ms);
+/* nonzero once the transfer with @cookie is done */
+int fpgadma_done(struct fpgadma_dev *dma, uint32_t dir, int32_t cookie);
+/* wait for @cookie, 0 for everything queued in @dir */
+int fpgadma_wait(struct fpgadma_dev *dma, uint32_t dir, int32_t cookie);
+
+/* loop @len bytes of @tx back into @rx and wait for both */
+int fpgadma_transceive(struct fpgadma_dev *dma, const struct fpgadma_buf *tx,
+		       const struct fpgadma_buf *rx, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FPGADMA_H */
@@ -0,0 +1,219 @@
+/*
+ * libfpgadma - C++ wrappers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * Owning, move-only handles over the C interface in fpgadma.h: a Device
+ * closes its file, a Pool unregisters its memory and a Buffer goes back
+ * to its pool when they go out of scope. Errors are thrown as
+ * std::system_error with the errno the driver returned.
+ */
+#ifndef _FPGADMA_HPP
+#define _FPGADMA_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include "fpgadma.h"
+
+namespace fpgadma {
+
+inline int check(int ret, const char *what)
+{
+	if (ret < 0)
+		throw std::system_error(-ret, std::generic_category(), what);
+	return ret;
+}
+
+class Device {
+public:
+	explicit Device(int instance = 0)
+	{
+		check(fpgadma_open(instance, &dma_), "fpgadma_open");
+	}
+	/* the software loopback instead of a device */
+	explicit Device(const struct fpgadma_loopback_config &cfg)
+	{
+		check(fpgadma_open_loopback(&cfg, &dma_),
+		      "fpgadma_open_loopback");
+	}
+	~Device() { fpgadma_close(dma_); }
+	Device(Device &&o) noexcept : dma_(std::exchange(o.dma_, nullptr)) {}
+	Device &operator=(Device &&o) noexcept
+	{
+		std::swap(dma_, o.dma_);
+		return *this;
+	}
+	Device(const Device &) = delete;
+	Device &operator=(const Device &) = delete;
+
+	struct fpgadma_dev *get() const { return dma_; }
+	int fd() const { return fpgadma_fd(dma_); }
+	bool is_loopback() const { return fpgadma_is_loopback(dma_); }
+
+	struct fpga_dma_status status()
+	{
+		struct fpga_dma_status st;
+
+		check(fpgadma_status(dma_, &st), "status");
+		return st;
+	}
+	void set_notify(unsigned int batch, unsigned int delay_us = 0)
+	{
+		check(fpgadma_set_notify(dma_, batch, delay_us), "set_notify");
+	}
+	/* completions signalled since the last call, 0 on timeout */
+	int poll(int timeout_ms = -1)
+	{
+		return check(fpgadma_poll(dma_, timeout_ms), "poll");
+	}
+	bool done(uint32_t dir, int32_t cookie)
+	{
+		return fpgadma_done(dma_, dir, cookie);
+	}
+	void wait(uint32_t dir, int32_t cookie = 0)
+	{
+		check(fpgadma_wait(dma_, dir, cookie), "wait");
+	}
+
+private:
+	struct fpgadma_dev *dma_ = nullptr;
+};
+
+class Buffer {
+public:
+	Buffer() = default;
+	explicit Buffer(const struct fpgadma_buf &b) : buf_(b), owned_(true) {}
+	~Buffer() { reset(); }
+	Buffer(Buffer &&o) noexcept
+		: buf_(o.buf_), owned_(std::exchange(o.owned_, false)) {}
+	Buffer &operator=(Buffer &&o) noexcept
+	{
+		std::swap(buf_, o.buf_);
+		std::swap(owned_, o.owned_);
+		return *this;
+	}
+	Buffer(const Buffer &) = delete;
+	Buffer &operator=(const Buffer &) = delete;
+
+	void reset()
+	{
+		if (owned_)
+			fpgadma_buf_put(&buf_);
+		owned_ = false;
+	}
+	explicit operator bool() const { return owned_; }
+	void *data() const { return buf_.ptr; }
+	size_t size() const { return buf_.len; }
+	const struct fpgadma_buf *get() const { return &buf_; }
+
+	template <typename T> T *as() const
+	{
+		return static_cast<T *>(buf_.ptr);
+	}
+
+private:
+	struct fpgadma_buf buf_ = {};
+	bool owned_ = false;
+};
+
+class Pool {
+public:
+	Pool(Device &dev, size_t block_size, unsigned int blocks)
+	{
+		check(fpgadma_pool_create(dev.get(), block_size, blocks, &pool_),
+		      "fpgadma_pool_create");
+	}
+	/* every Buffer of the pool must be gone and its transfers done */
+	~Pool() { fpgadma_pool_destroy(pool_); }
+	Pool(Pool &&o) noexcept : pool_(std::exchange(o.pool_, nullptr)) {}
+	Pool &operator=(Pool &&o) noexcept
+	{
+		std::swap(pool_, o.pool_);
+		return *this;
+	}
+	Pool(const Pool &) = delete;
+	Pool &operator=(const Pool &) = delete;
+
+	/* an empty Buffer when all blocks are in use */
+	Buffer try_get()
+	{
+		struct fpgadma_buf b;
+
+		if (fpgadma_buf_get(pool_, &b))
+			return Buffer();
+		return Buffer(b);
+	}
+	Buffer get()
+	{
+		Buffer b = try_get();
+
+		if (!b)
+			check(-EAGAIN, "pool exhausted");
+		return b;
+	}
+
+private:
+	struct fpgadma_pool *pool_ = nullptr;
+};
+
+/* transfers collected and queued with one FPGA_DMA_IOC_SUBMIT_BATCH */
+class Batch {
+public:
+	explicit Batch(unsigned int max) : xfers_(max)
+	{
+		fpgadma_batch_init(&batch_, xfers_.data(), max);
+	}
+	Batch(const Batch &) = delete;
+	Batch &operator=(const Batch &) = delete;
+
+	bool add(const Buffer &buf, size_t off, size_t len, uint32_t dir,
+		 uint32_t flags = 0)
+	{
+		int ret = fpgadma_batch_add(&batch_, buf.get(), off, len, dir,
+					    flags);
+
+		if (ret == -ENOSPC)
+			return false;
+		check(ret, "batch_add");
+		return true;
+	}
+	bool tx(const Buffer &buf, size_t len)
+	{
+		return add(buf, 0, len, FPGA_DMA_TX);
+	}
+	bool rx(const Buffer &buf, size_t len)
+	{
+		return add(buf, 0, len, FPGA_DMA_RX);
+	}
+	unsigned int size() const { return batch_.count; }
+
+	/* how many were queued; cookie(i) is valid for those */
+	unsigned int submit(Device &dev)
+	{
+		return check(fpgadma_batch_submit(dev.get(), &batch_),
+			     "batch_submit");
+	}
+	int32_t cookie(unsigned int i) const { return xfers_[i].cookie; }
+
+private:
+	std::vector<struct fpga_dma_xfer> xfers_;
+	struct fpgadma_batch batch_;
+};
+
+/* loop @len bytes of @tx back into @rx and wait for both */
+inline void transceive(Device &dev, const Buffer &tx, const Buffer &rx,
+		       size_t len)
+{
+	check(fpgadma_transceive(dev.get(), tx.get(), rx.get(), len),
+	      "transceive");
+}
+
+} /* namespace fpgadma */
+
+#endif /* _FPGADMA_HPP */
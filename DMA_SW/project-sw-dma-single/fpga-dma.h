@@ -1,3 +0,0 @@
-static ssize_t dbgfs_write_dma(struct file *file, const char *user_buf,size_t count, loff_t *ppos);
-static ssize_t dbgfs_read_dma(struct file *file, char *user_buf,size_t count, loff_t *ppos);
-